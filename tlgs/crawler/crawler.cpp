@@ -1,28 +1,35 @@
 #include "crawler.hpp"
 
 #include <atomic>
+#include <ctime>
 #include <filesystem>
 #include <random>
+#include <set>
 #include <stdexcept>
+#include <unordered_map>
 #include <algorithm>
 
-#include <nlohmann/json.hpp> 
-
 #include <dremini/GeminiClient.hpp>
 #include <drogon/HttpAppFramework.h>
 #include <drogon/utils/Utilities.h>
 #include <drogon/utils/coroutine.h>
 
+#include <tlgsutils/bloom_filter.hpp>
+#include <tlgsutils/bulk_insert.hpp>
 #include <tlgsutils/gemini_parser.hpp>
+#include <tlgsutils/pg_array.hpp>
 #include <tlgsutils/robots_txt_parser.hpp>
+#include <tlgsutils/task_arena.hpp>
 #include <tlgsutils/url_parser.hpp>
 #include <tlgsutils/utils.hpp>
+#include <tlgsutils/when_all.hpp>
 #include <trantor/utils/Logger.h>
 #include <tlgsutils/counter.hpp>
 
 #include <tbb/concurrent_unordered_map.h>
 
 #include "iconv.hpp"
+#include "gemini_stream.hpp"
 #include "blacklist.hpp"
 
 #include <fmt/core.h>
@@ -31,16 +38,14 @@ using namespace drogon;
 using namespace dremini;
 using namespace trantor;
 
-static std::string pgSQLRealEscape(std::string str)
+// Limits how many robots.txt are fetched at once when checking outlinks of a single page
+static constexpr size_t max_concurrent_robots_fetches = 8;
+
+static bool isUtf8Charset(std::string_view charset)
 {
-    drogon::utils::replaceAll(str, "\\", "\\\\");
-    drogon::utils::replaceAll(str, std::string(1, '\0'), "\\0");
-    drogon::utils::replaceAll(str, "\n", "\\n");
-    drogon::utils::replaceAll(str, "\r", "\\r");
-    drogon::utils::replaceAll(str, "'", "''");
-    drogon::utils::replaceAll(str, "\"", "\\\"");
-    drogon::utils::replaceAll(str, "\x1a", "\\Z");
-    return str;
+    std::string lower(charset);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return lower == "utf-8" || lower == "utf8";
 }
 
 static std::string tryConvertEncoding(const std::string_view& str, const std::string& src_enc, const std::string& dst_enc, bool ignore_err = true)
@@ -49,7 +54,7 @@ static std::string tryConvertEncoding(const std::string_view& str, const std::st
     // because the input string might have bad encoding
     std::string res;
     try {
-        iconvpp::converter converter(src_enc, dst_enc, true);
+        iconvpp::converter converter(dst_enc, src_enc, ignore_err);
         converter.convert(str, res);
     }
     catch(...) {
@@ -87,9 +92,103 @@ static std::pair<std::string, std::unordered_map<std::string, std::string>> pars
     return {mime_str, params};
 }
 
-Task<std::optional<std::string>> GeminiCrawler::getNextPotentialCarwlUrl()
+Task<void> GeminiCrawler::loadPermaRedirects()
+{
+    auto db = app().getDbClient();
+    auto redirects = co_await db->execSqlCoro("SELECT from_url, to_url FROM perma_redirects;");
+    for(const auto& redirect : redirects)
+        perma_redirects_.add(redirect["from_url"].as<std::string_view>(), redirect["to_url"].as<std::string>());
+    LOG_INFO << "Loaded " << perma_redirects_.size() << " permanent redirects";
+}
+
+Task<void> GeminiCrawler::loadKnownUrls()
+{
+    if(url_filter_path_.empty())
+        co_return;
+
+    // Pages deleted from the DB stay in the filter. So they are not added back when found again until the filter is
+    // rebuilt. Rebuild regularly to bound that
+    constexpr std::time_t max_filter_age = 3*24*3600;
+    try {
+        auto filter = tlgs::BloomFilter::load(url_filter_path_);
+        if(std::time(nullptr) - filter.createdAt() < max_filter_age) {
+            known_urls_ = std::make_unique<tlgs::BloomFilter>(std::move(filter));
+            LOG_INFO << "Loaded known URL filter from " << url_filter_path_;
+            co_return;
+        }
+        LOG_INFO << "Known URL filter " << url_filter_path_ << " is outdated. Rebuilding from DB";
+    }
+    catch(std::exception& e) {
+        LOG_INFO << "Cannot load known URL filter: " << e.what() << ". Building from DB";
+    }
+
+    auto db = app().getDbClient();
+    auto count = co_await db->execSqlCoro("SELECT COUNT(*) AS count FROM pages;");
+    // Leave room for the index to grow until the next rebuild. A new seed every build so a URL unlucky enough to be
+    // a false positive doesn't stay one forever
+    const size_t expected_urls = std::max<size_t>(count[0]["count"].as<size_t>() * 2, 1000000);
+    auto filter = std::make_unique<tlgs::BloomFilter>(expected_urls, 0.01, std::mt19937_64(std::random_device{}())());
+    constexpr size_t urls_per_batch = 100000;
+    std::string last_url;
+    while(true) {
+        auto urls = co_await db->execSqlCoro("SELECT url FROM pages WHERE url > $1 ORDER BY url LIMIT $2;", last_url, urls_per_batch);
+        for(const auto& row : urls)
+            filter->add(row["url"].as<std::string_view>());
+        if(urls.size() < urls_per_batch)
+            break;
+        last_url = urls[urls.size()-1]["url"].as<std::string>();
+    }
+    known_urls_ = std::move(filter);
+    LOG_INFO << "Built known URL filter of " << count[0]["count"].as<size_t>() << " pages";
+    saveKnownUrls();
+}
+
+Task<void> GeminiCrawler::bumpIndexEpoch()
+{
+    try {
+        auto db = app().getDbClient();
+        auto t = co_await db->newTransactionCoro();
+        // Pages only log how they change the text statistics. Fold the changes in. So new results are scored with
+        // statistics of the same index
+        co_await t->execSqlCoro("WITH d AS (DELETE FROM term_stat_deltas RETURNING term, delta) "
+            "INSERT INTO term_stats (term, doc_freq) SELECT term, sum(delta) FROM d GROUP BY term ORDER BY term "
+            "ON CONFLICT (term) DO UPDATE SET doc_freq = term_stats.doc_freq + EXCLUDED.doc_freq;");
+        auto result = co_await t->execSqlCoro("WITH d AS (DELETE FROM corpus_stat_deltas RETURNING docs, title_length, body_length) "
+            "UPDATE index_state SET epoch = epoch + 1, updated_at = CURRENT_TIMESTAMP, "
+            "doc_count = doc_count + (SELECT COALESCE(sum(docs), 0) FROM d), "
+            "title_length_sum = title_length_sum + (SELECT COALESCE(sum(title_length), 0) FROM d), "
+            "body_length_sum = body_length_sum + (SELECT COALESCE(sum(body_length), 0) FROM d) "
+            "RETURNING epoch;");
+        if(result.size() != 0)
+            LOG_DEBUG << "Index epoch is now " << result[0]["epoch"].as<int64_t>();
+    }
+    catch(std::exception& e) {
+        LOG_WARN << "Failed to bump index epoch: " << e.what();
+    }
+}
+
+void GeminiCrawler::logDnsCacheStats() const
+{
+    auto stats = dns_cache_.stats();
+    LOG_INFO << "DNS cache: " << stats.entries << " hosts, " << stats.hits << " hits, " << stats.misses << " misses ("
+        << stats.hitRate() * 100 << "% hit rate)";
+}
+
+void GeminiCrawler::saveKnownUrls()
+{
+    if(known_urls_ == nullptr || url_filter_path_.empty())
+        return;
+    try {
+        known_urls_->save(url_filter_path_);
+    }
+    catch(std::exception& e) {
+        LOG_ERROR << "Failed to save known URL filter: " << e.what();
+    }
+}
+
+Task<std::optional<CrawlItem>> GeminiCrawler::getNextPotentialCarwlUrl()
 {
-    std::string result;
+    CrawlItem result;
     if(craw_queue_.try_pop(result))
         co_return result;
 
@@ -107,10 +206,11 @@ Task<std::optional<std::string>> GeminiCrawler::getNextPotentialCarwlUrl()
             std::string sample_str;
             if(tablesample_pct <= 80)
                 sample_str = fmt::format("TABLESAMPLE SYSTEM({})", tablesample_pct);
+            // Also bring back what crawlPage() needs to know about the page. Saves it from looking them up one by one
             auto urls = co_await db->execSqlCoro(fmt::format("UPDATE pages SET last_queued_at = CURRENT_TIMESTAMP "
                 "WHERE url in (SELECT url FROM pages {} WHERE (last_crawled_at < CURRENT_TIMESTAMP - INTERVAL '3' DAY "
                 "OR last_crawled_at IS NULL) AND (last_queued_at < CURRENT_TIMESTAMP - INTERVAL '5' MINUTE OR last_queued_at IS NULL) "
-                "LIMIT {} FOR UPDATE) RETURNING url"
+                "LIMIT {} FOR UPDATE) RETURNING url, indexed_content_hash, raw_content_hash, last_status, last_crawled_at"
                 ,sample_str , urls_per_batch));
             if(urls.size() < urls_per_batch*0.9) {
                 const int new_value = std::min(tablesample_pct + 10, 100);
@@ -120,14 +220,24 @@ Task<std::optional<std::string>> GeminiCrawler::getNextPotentialCarwlUrl()
                 co_return {};
             
             thread_local std::mt19937 rng(std::random_device{}());
-            std::vector<std::string> vec;
+            std::vector<CrawlItem> vec;
             vec.reserve(urls.size());
-            for(const auto& url : urls)
-                vec.push_back(url["url"].as<std::string>());
+            for(const auto& row : urls) {
+                CrawlItem item;
+                item.url = row["url"].as<std::string>();
+                item.have_state = true;
+                item.have_record = true;
+                item.indexed_content_hash = row["indexed_content_hash"].as<std::string>();
+                item.raw_content_hash = row["raw_content_hash"].as<std::string>();
+                item.last_status = row["last_status"].isNull() ? 0 : row["last_status"].as<int>();
+                if(!row["last_crawled_at"].isNull())
+                    item.last_crawled_at = trantor::Date::fromDbStringLocal(row["last_crawled_at"].as<std::string>());
+                vec.push_back(std::move(item));
+            }
             // XXX: Half-working attempt at randomizing the crawling order.
             std::shuffle(vec.begin(), vec.end(), rng);
-            for(auto&& url : vec)
-                craw_queue_.emplace(std::move(url));
+            for(auto&& item : vec)
+                craw_queue_.emplace(std::move(item));
         }
         catch(std::exception& e) {
             // Only keep trying if is a transaction rollback
@@ -145,6 +255,69 @@ Task<std::optional<std::string>> GeminiCrawler::getNextPotentialCarwlUrl()
 }
 
 
+bool GeminiCrawler::passesLocalChecks(const tlgs::Url& url)
+{
+    if(url.protocol() != "gemini") {
+        LOG_ERROR << url.str() << " is not a Gemini URL";
+        return false;
+    }
+    if(inBlacklist(url.str()))
+        return false;
+    // Do not crawl hosts known to be down until they are due for a retry
+    return host_health_.available(url.host(), url.port());
+}
+
+Task<std::optional<std::vector<std::string>>> GeminiCrawler::fetchRobotsPolicy(tlgs::Url url)
+{
+    LOG_TRACE << url.hostWithPort(1965) << " has no up to date robots policy stored in DB. Asking the host for robots.txt";
+    HttpResponsePtr resp;
+    try {
+        std::string robot_url = tlgs::Url(url).withParam("").withPath("/robots.txt").withFragment("").str();
+        LOG_TRACE << "Fetching robots.txt from " << robot_url;
+        resp = co_await fetchGeminiPrefix(robot_url, 10, fetchLoop(), 0x2625a0, {}, 10, &dns_cache_);
+    }
+    catch(std::exception& e) {
+        // XXX: Failed to handshake with the host. We should retry later
+        // Shoud we cache the result as no policy is available?
+        // policy_cache[cache_key] = {};
+        std::string error = e.what();
+        if(error == "Timeout" || error == "NetworkFailure")
+            host_health_.recordFailure(url.host(), url.port());
+        co_return std::nullopt;
+    }
+
+    assert(resp != nullptr);
+    host_health_.recordSuccess(url.host(), url.port());
+    auto [mime, _] = parseMime(resp->getHeader("meta"));
+    int status = std::stoi(resp->getHeader("gemini-status"));
+    // HACK: Some capsules have broken MIME
+    bool have_robots_txt = status == 20 && (mime == "text/plain" || mime == "text/gemini");
+    std::vector<std::string> disallowed_path;
+    if(have_robots_txt) {
+        disallowed_path = tlgs::parseRobotsTxt(std::string(resp->body()), {"*", "tlgs", "indexer"});
+    }
+
+    try {
+        auto db = app().getDbClient();
+        auto t = co_await db->newTransactionCoro();
+        co_await t->execSqlCoro("DELETE FROM robot_policies WHERE host = $1 AND port = $2;", url.host(), url.port());
+        tlgs::BulkInsert<3> policy_insert("robot_policies", {"host text", "port integer", "disallowed text"});
+        for(const auto& disallow : disallowed_path)
+            policy_insert.add(url.host(), url.port(), disallow);
+        if(!policy_insert.empty())
+            co_await policy_insert.execute(t);
+        co_await t->execSqlCoro("INSERT INTO robot_policies_status(host, port, last_crawled_at, have_policy) VALUES ($1, $2, CURRENT_TIMESTAMP, $3) "
+            "ON CONFLICT (host, port) DO UPDATE SET last_crawled_at = CURRENT_TIMESTAMP, have_policy = $3;"
+            , url.host(), url.port(), have_robots_txt);
+    }
+    catch(...) {
+        // Screw it. Someone else updated the policies. They've done the same job. We can keep on working
+    }
+
+    policy_cache_.insert(url.hostWithPort(1965), disallowed_path, 60);
+    co_return disallowed_path;
+}
+
 Task<bool> GeminiCrawler::shouldCrawl(std::string url_str)
 {
     if(url_str.empty())
@@ -154,25 +327,15 @@ Task<bool> GeminiCrawler::shouldCrawl(std::string url_str)
         LOG_ERROR << "Failed to parse URL " << url_str;
         co_return false;
     }
-    if(url.protocol() != "gemini") {
-        LOG_ERROR << url_str << " is not a Gemini URL";
-        co_return false;
-    }
-    if(inBlacklist(url.str()))
-        co_return false;
-    // Do not crawl hosts known to be down
-    // TODO: Put this on SQL
-    auto timeout = host_timeout_count_.find(url.hostWithPort(1965));
-    if(timeout != host_timeout_count_.end() && timeout->second > 3)
+    if(passesLocalChecks(url) == false)
         co_return false;
 
     // TODO: Use a LRU cache
     // Consult the database to see if this URL is in robots.txt. Contents from the DB is cache locally to 
     // redule the number of DB queries
     const std::string cache_key = url.hostWithPort(1965);
-    static drogon::CacheMap<std::string, std::vector<std::string>> policy_cache(loop_, 5);
     std::vector<std::string> disallowed_path;
-    if(policy_cache.findAndFetch(cache_key, disallowed_path))
+    if(policy_cache_.findAndFetch(cache_key, disallowed_path))
         co_return !tlgs::isPathBlocked(url.path(), disallowed_path);
 
     LOG_TRACE << "Cannot find " << cache_key << " in local policy cache";
@@ -180,48 +343,9 @@ Task<bool> GeminiCrawler::shouldCrawl(std::string url_str)
     auto policy_status = co_await db->execSqlCoro("SELECT have_policy FROM robot_policies_status "
         "WHERE host = $1 AND port = $2 AND last_crawled_at > CURRENT_TIMESTAMP - INTERVAL '2' DAY", url.host(), url.port());
     if(policy_status.size() == 0) {
-        LOG_TRACE << url.hostWithPort(1965) << " has no up to date robots policy stored in DB. Asking the host for robots.txt";
-        HttpResponsePtr resp;
-        // FIXME: THe crawler may request robots.txt multiple times if multiple URLs on the same host are requested.
-        // This is not as efficient as it could be. But does not cause any problems otherwise.
-        try {
-            std::string robot_url = tlgs::Url(url).withParam("").withPath("/robots.txt").withFragment("").str();
-            LOG_TRACE << "Fetching robots.txt from " << robot_url;
-            resp = co_await dremini::sendRequestCoro(robot_url, 10, loop_, 0x2625a0, {}, 10);
-        }
-        catch(std::exception& e) {
-            // XXX: Failed to handshake with the host. We should retry later
-            // Shoud we cache the result as no policy is available?
-            // policy_cache[cache_key] = {};
-            std::string error = e.what();
-            if(error == "Timeout" || error == "NetworkFailure")
-                host_timeout_count_[url.hostWithPort(1965)]++;
-            co_return true;
-        }
-
-        assert(resp != nullptr);
-        auto [mime, _] = parseMime(resp->contentTypeString());
-        int status = std::stoi(resp->getHeader("gemini-status"));
-        // HACK: Some capsules have broken MIME
-        bool have_robots_txt = status == 20 && (mime == "text/plain" || mime == "text/gemini");
-        if(have_robots_txt) {
-            disallowed_path = tlgs::parseRobotsTxt(std::string(resp->body()), {"*", "tlgs", "indexer"});
-        }
-
-        try {
-            auto t = co_await db->newTransactionCoro();
-            co_await t->execSqlCoro("DELETE FROM robot_policies WHERE host = $1 AND port = $2;", url.host(), url.port());
-            for(const auto& disallow : disallowed_path) {
-                co_await t->execSqlCoro("INSERT INTO robot_policies (host, port, disallowed) VALUES ($1, $2, $3)",
-                    url.host(), url.port(), disallow);
-            }
-            co_await t->execSqlCoro("INSERT INTO robot_policies_status(host, port, last_crawled_at, have_policy) VALUES ($1, $2, CURRENT_TIMESTAMP, $3) "
-                "ON CONFLICT (host, port) DO UPDATE SET last_crawled_at = CURRENT_TIMESTAMP, have_policy = $3;"
-                , url.host(), url.port(), have_robots_txt);
-        }
-        catch(...) {
-            // Screw it. Someone else updated the policies. They've done the same job. We can keep on working
-        }
+        auto policy = co_await fetchRobotsPolicy(url);
+        // Be optimistic when the host can't tell us its policy
+        co_return !policy.has_value() || !tlgs::isPathBlocked(url.path(), *policy);
     }
     else if(policy_status[0]["have_policy"].as<bool>()) {
         LOG_TRACE << url.hostWithPort(1965) << " has robots policy stored in DB.";
@@ -232,39 +356,123 @@ Task<bool> GeminiCrawler::shouldCrawl(std::string url_str)
     }
 
     bool should_crawl = !tlgs::isPathBlocked(url.path(), disallowed_path);
-    policy_cache.insert(cache_key, std::move(disallowed_path), 60);
+    policy_cache_.insert(cache_key, std::move(disallowed_path), 60);
     co_return should_crawl;
 }
 
-Task<std::optional<std::string>> GeminiCrawler::getNextCrawlPage() 
+Task<std::vector<bool>> GeminiCrawler::shouldCrawl(const std::vector<tlgs::Url>& urls)
+{
+    std::vector<bool> result(urls.size(), false);
+    // Group URLs by host so robots.txt is looked up once per host instead of once per URL
+    std::unordered_map<std::string, std::vector<size_t>> host_urls;
+    for(size_t i=0;i<urls.size();i++) {
+        if(urls[i].good() == false || passesLocalChecks(urls[i]) == false)
+            continue;
+        host_urls[urls[i].hostWithPort(1965)].push_back(i);
+    }
+    if(host_urls.empty())
+        co_return result;
+
+    // std::nullopt means the host can't tell us its policy. Which we treat as allowed like shouldCrawl(std::string)
+    std::unordered_map<std::string, std::optional<std::vector<std::string>>> policies;
+    std::unordered_map<std::string, std::string> db_key_to_host;
+    tlgs::PgArrayBuilder hosts, ports;
+    for(const auto& [host, indices] : host_urls) {
+        std::vector<std::string> disallowed_path;
+        if(policy_cache_.findAndFetch(host, disallowed_path)) {
+            policies[host] = std::move(disallowed_path);
+            continue;
+        }
+        const auto& url = urls[indices.front()];
+        db_key_to_host[url.host() + ":" + std::to_string(url.port())] = host;
+        hosts.append(url.host());
+        ports.append(url.port());
+    }
+
+    if(!hosts.empty()) {
+        // Policies of every host missing from the local cache in one round trip
+        auto db = app().getDbClient();
+        auto stored = co_await db->execSqlCoro("SELECT s.host, s.port, s.have_policy, p.disallowed FROM robot_policies_status s "
+            "LEFT JOIN robot_policies p ON s.have_policy AND p.host = s.host AND p.port = s.port "
+            "WHERE (s.host, s.port) IN (SELECT * FROM unnest($1::text[], $2::integer[])) "
+            "AND s.last_crawled_at > CURRENT_TIMESTAMP - INTERVAL '2' DAY;", hosts.str(), ports.str());
+        for(const auto& row : stored) {
+            auto it = db_key_to_host.find(row["host"].as<std::string>() + ":" + row["port"].as<std::string>());
+            if(it == db_key_to_host.end())
+                continue;
+            auto& policy = policies[it->second];
+            if(policy.has_value() == false)
+                policy = std::vector<std::string>{};
+            if(row["disallowed"].isNull() == false)
+                policy->push_back(row["disallowed"].as<std::string>());
+        }
+        for(const auto& [_, host] : db_key_to_host) {
+            auto it = policies.find(host);
+            if(it != policies.end())
+                policy_cache_.insert(host, *it->second, 60);
+        }
+
+        // Whatever is left has no up to date policy. Ask the hosts concurrently
+        std::vector<std::string> fetch_hosts;
+        std::vector<Task<std::optional<std::vector<std::string>>>> fetches;
+        for(const auto& [_, host] : db_key_to_host) {
+            if(policies.contains(host))
+                continue;
+            fetch_hosts.push_back(host);
+            fetches.push_back(fetchRobotsPolicy(urls[host_urls[host].front()]));
+        }
+        auto fetched = co_await tlgs::whenAll(std::move(fetches), max_concurrent_robots_fetches);
+        for(size_t i=0;i<fetch_hosts.size();i++)
+            policies[fetch_hosts[i]] = std::move(fetched[i]);
+    }
+
+    for(const auto& [host, indices] : host_urls) {
+        const auto& policy = policies[host];
+        for(auto idx : indices)
+            result[idx] = !policy.has_value() || !tlgs::isPathBlocked(urls[idx].path(), *policy);
+    }
+    co_return result;
+}
+
+Task<std::optional<CrawlItem>> GeminiCrawler::getNextCrawlPage() 
 {
-    auto db = app().getDbClient();
     while(1) {
-        auto next_url = co_await getNextPotentialCarwlUrl();
-        if(next_url.has_value() == false)
+        auto next_item = co_await getNextPotentialCarwlUrl();
+        if(next_item.has_value() == false)
             co_return {};
         
-        auto url_str = next_url.value();
+        auto item = std::move(next_item.value());
+        const auto& url_str = item.url;
 
         // URL should not contain any ASCII control characters
         auto it = std::find_if(url_str.begin(), url_str.end(), [](char c) { return c < 0x20; });
         auto can_crawl = it == url_str.end() && co_await shouldCrawl(url_str);
         if(can_crawl == false) {
-            co_await db->execSqlCoro("UPDATE pages SET last_crawled_at = CURRENT_TIMESTAMP, last_status = $2, last_meta = $3 WHERE url = $1;"
-                , url_str, 0, std::string("blocked"));
-            co_await db->execSqlCoro("DELETE FROM pages WHERE url = $1 AND last_crawl_success_at < CURRENT_TIMESTAMP - INTERVAL '30' DAY;"
-                , url_str);
+            status_writer_.push(url_str, {.status = 0, .meta = "blocked", .purge_stale = true});
             continue;
         }
 
         // shouldCrawl() validates the URL. So we can safely use tlgs::Url here
-        co_return tlgs::Url(url_str).str();
+        auto normalized_url = tlgs::Url(url_str).str();
+        // The state we have belongs to the unnormalized URL
+        if(normalized_url != item.url)
+            item = CrawlItem{.url = std::move(normalized_url)};
+        co_return item;
     }
 
     LOG_FATAL << "Should not reach here in Crawler::getNextCrawlPage()";
     co_return {};
 }
 
+trantor::EventLoop* GeminiCrawler::fetchLoop()
+{
+    // Spread connections over all IO loops. So one busy connection doesn't hold up every other fetch
+    const size_t num_loops = app().getThreadNum();
+    if(num_loops == 0)
+        return loop_;
+    return app().getIOLoop(next_fetch_loop_.fetch_add(1, std::memory_order_relaxed) % num_loops);
+}
+
 void GeminiCrawler::dispatchCrawl()
 {
     if(ended_)
@@ -286,12 +494,12 @@ void GeminiCrawler::dispatchCrawl()
         return;
 
     async_run([counter, this]() mutable -> Task<void> {try{
-        auto url_str = co_await getNextCrawlPage();
+        auto item = co_await getNextCrawlPage();
         // Crawling has ended if the following is true
         // 1. There's no more URL to crawl
         // 2. The current crawl is the last one in existance
         //    * Since a crawler can add new items into the queue
-        if(url_str.has_value() == false) {
+        if(item.has_value() == false) {
             if(counter->release() == 1)
                 ended_ = true;
             co_return;
@@ -299,14 +507,14 @@ void GeminiCrawler::dispatchCrawl()
         loop_->runInLoop([this](){dispatchCrawl();});
 
         try {
-            bool success = co_await crawlPage(url_str.value());
+            bool success = co_await crawlPage(item.value());
             if(success)
-                LOG_INFO << "Processed " << url_str.value();
+                LOG_INFO << "Processed " << item->url;
             // else // we already print out the error message in crawlPage()
             //     LOG_ERROR << "Failed to process " << url_str.value();
         }
         catch(std::exception& e) {
-            LOG_ERROR << "Exception escaped crawling "<< url_str.value() <<": " << e.what();
+            LOG_ERROR << "Exception escaped crawling "<< item->url <<": " << e.what();
             abort();
         }
         loop_->queueInLoop([this](){dispatchCrawl();});
@@ -317,9 +525,10 @@ void GeminiCrawler::dispatchCrawl()
     }});
 }
 
-Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
+Task<bool> GeminiCrawler::crawlPage(const CrawlItem& item)
 {
     auto db = app().getDbClient();
+    const auto& url_str = item.url;
     const auto url = tlgs::Url(url_str);
     if(url.good() == false || url.str() != url_str) {
         // It's fine we delete unnormalized URLs since the crawler will just add them back later when encounter it again
@@ -333,13 +542,24 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
     try {
         if(co_await shouldCrawl(url.str()) == false)
             throw std::runtime_error("Blocked by robots.txt");
-        auto record = co_await db->execSqlCoro("SELECT url, indexed_content_hash , raw_content_hash, last_status"
-            ", last_crawled_at FROM pages WHERE url = $1;", url.str());
-        bool have_record = record.size() != 0;
-        auto indexed_content_hash = have_record ? record[0]["indexed_content_hash"].as<std::string>() : "";
-        auto raw_content_hash = have_record ? record[0]["raw_content_hash"].as<std::string>() : "";
+        // URLs from the frontier come with their state. Only URLs added by hand need to be looked up
+        CrawlItem state = item;
+        if(state.have_state == false) {
+            auto record = co_await db->execSqlCoro("SELECT url, indexed_content_hash , raw_content_hash, last_status"
+                ", last_crawled_at FROM pages WHERE url = $1;", url.str());
+            state.have_record = record.size() != 0;
+            if(state.have_record) {
+                state.indexed_content_hash = record[0]["indexed_content_hash"].as<std::string>();
+                state.raw_content_hash = record[0]["raw_content_hash"].as<std::string>();
+                state.last_status = record[0]["last_status"].isNull() ? 0 : record[0]["last_status"].as<int>();
+                if(!record[0]["last_crawled_at"].isNull())
+                    state.last_crawled_at = trantor::Date::fromDbStringLocal(record[0]["last_crawled_at"].as<std::string>());
+            }
+        }
+        const auto& indexed_content_hash = state.indexed_content_hash;
+        const auto& raw_content_hash = state.raw_content_hash;
 
-        if(!have_record) {
+        if(!state.have_record) {
             co_await db->execSqlCoro("INSERT INTO pages(url, domain_name, port, first_seen_at)"
                 " VALUES ($1, $2, $3, CURRENT_TIMESTAMP);",
                 url.str(), url.host(), url.port());
@@ -347,17 +567,8 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
         else {
             // 53 proxy error. Likely misconfigured proxy/domain or bad links pointing to the wrong domain that is on the 
             // smae IP. Only retry once every 21 days
-            auto last_status = record[0]["last_status"].isNull() ? 0 : record[0]["last_status"].as<int>();
-            auto last_crawled_at = [&](){
-                auto var = record[0]["last_crawled_at"];
-                if(var.isNull())
-                    return trantor::Date();
-                else
-                    return trantor::Date::fromDbStringLocal(var.as<std::string>());
-            }();
-
-            if(last_status == 53 && last_crawled_at.after(21*7*24*3600) < trantor::Date::now()) {
-                co_await db->execSqlCoro("UPDATE pages SET last_crawled_at = CURRENT_TIMESTAMP, last_status = 0 WHERE url = $1;", url.str());
+            if(state.last_status == 53 && state.last_crawled_at.after(21*7*24*3600) < trantor::Date::now()) {
+                status_writer_.push(url.str(), {.status = 0});
                 LOG_INFO << "Skipping " << url.str() << " that was proxy-errored recently";
                 co_return true;
             }
@@ -370,15 +581,17 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
         int status;
         tlgs::Url crawl_url = url;
         do {
-            auto redirect = co_await db->execSqlCoro("SELECT to_url FROM perma_redirects WHERE from_url = $1;", crawl_url.str());
-            if(redirect.size() != 0) {
-                crawl_url = tlgs::Url(redirect[0]["to_url"].as<std::string>());
-                redirection_count++;
+            // Known permanent redirects are followed without asking the host. Chains resolve in one step
+            auto redirect_to = perma_redirects_.resolve(crawl_url.str());
+            if(redirect_to.has_value()) {
+                crawl_url = tlgs::Url(*redirect_to);
                 status = 30;
                 continue;
             }
-            // 2.5MB is the maximum size of page we will index. 10s timeout, max 5 redirects and 25s max transfer time.
-            resp = co_await dremini::sendRequestCoro(crawl_url.str(), 10, loop_, 0x2625a0, indexd_mimes, 25.0);
+            // Only the first max_index_size_ bytes (2.5MB by default) are indexed. Larger pages are truncated instead of
+            // failing. 10s timeout, max 5 redirects and 25s max transfer time.
+            resp = co_await fetchGeminiPrefix(crawl_url.str(), 10, fetchLoop(), max_index_size_, indexd_mimes, 25.0, &dns_cache_);
+            host_health_.recordSuccess(crawl_url.host(), crawl_url.port());
 
             status = std::stoi(resp->getHeader("gemini-status"));
             if(status / 10 == 3) {
@@ -391,6 +604,7 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
                     throw std::runtime_error("Redirected to blocked URL");
 
                 if(status == 31) {
+                    perma_redirects_.add(crawl_url.str(), redirect_url.str());
                     co_await db->execSqlCoro("INSERT INTO perma_redirects (from_url, to_url) VALUES ($1, $2) ON CONFLICT (from_url) DO UPDATE SET to_url = $2;",
                             crawl_url.str(), redirect_url.str());
                 }
@@ -402,6 +616,7 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
             throw std::runtime_error("No concrete response. Too many redirects?");
 
         const auto& meta = resp->getHeader("meta");
+        const bool truncated = !resp->getHeader("truncated").empty();
         std::string mime;
         std::optional<std::string> charset;
         std::optional<std::string> lang;
@@ -422,50 +637,60 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
 
             // No reason to reindex if the content hasn't changed. `force_reindex_` is used to force reindexing of files
             if(force_reindex_ == false && raw_content_hash == new_raw_content_hash) {
-                co_await db->execSqlCoro("UPDATE pages SET last_crawled_at = CURRENT_TIMESTAMP, last_crawl_success_at = CURRENT_TIMESTAMP, "
-                    "last_status = $2, last_meta = $3, content_type = $4 WHERE url = $1;",
-                    url.str(), status, meta, mime);
-                    co_return true;
+                status_writer_.push(url.str(), {.status = status, .meta = meta, .content_type = mime, .success = true});
+                co_return true;
             }
 
-            // We should only have text files at this point. Try convert everything to UTF-8 because iconv will
-            // ignore all encoding errors. Thus make Postgres happy for files with doggy encodings.
-            std::string body_raw = tryConvertEncoding(resp->body(), charset.value_or("utf-8"), "utf-8");
-            // The worst case is 25% from UTF-32 to UTF-8. Smaller than 20% is definatelly a binary file. We don't want to index it.
-            if(body_raw.size() < resp->body().size()/5)
-                throw std::runtime_error("Possible binary files sent as text");
-
-            if(mime == "text/gemini") {
-                auto nodes = dremini::parseGemini(body_raw);
-                tlgs::GeminiDocument doc = tlgs::extractGeminiConcise(nodes);
-                body = std::move(doc.text);
-                links = std::move(doc.links);
-                title = std::move(doc.title);
-                if(tlgs::isGemsub(nodes, url, "gemini"))
-                    feed_type = "gemsub";
-
-                // remove empty links
-                links.erase(std::remove_if(links.begin(), links.end(), [](const std::string& link) {
-                    return link.empty();
-                }), links.end());
-                if(title.empty())
+            // Conversion and parsing are CPU heavy. Keep them away from the loops driving the connections
+            co_await tlgs::runInArena([&]() {
+                // We should only have text files at this point. Try convert everything to UTF-8 because iconv will
+                // ignore all encoding errors. Thus make Postgres happy for files with doggy encodings. Most pages are
+                // valid UTF-8 already. Those are used straight from the response without any copy
+                std::string converted;
+                std::string_view body_raw = resp->body();
+                if(!isUtf8Charset(charset.value_or("utf-8")) || !tlgs::isValidUtf8(body_raw)) {
+                    converted = tryConvertEncoding(body_raw, charset.value_or("utf-8"), "utf-8");
+                    body_raw = converted;
+                }
+                // The worst case is 25% from UTF-32 to UTF-8. Smaller than 20% is definatelly a binary file. We don't want to index it.
+                if(body_raw.size() < resp->body().size()/5)
+                    throw std::runtime_error("Possible binary files sent as text");
+
+                if(mime == "text/gemini") {
+                    auto nodes = dremini::parseGemini(body_raw);
+                    tlgs::GeminiDocument doc = tlgs::extractGeminiConcise(nodes);
+                    body = std::move(doc.text);
+                    links = std::move(doc.links);
+                    title = std::move(doc.title);
+                    if(tlgs::isGemsub(nodes, url, "gemini"))
+                        feed_type = "gemsub";
+
+                    // remove empty links
+                    links.erase(std::remove_if(links.begin(), links.end(), [](const std::string& link) {
+                        return link.empty();
+                    }), links.end());
+                    if(title.empty())
+                        title = url.str();
+                }
+                else if(mime == "text/plain" || mime == "plaintext" || mime == "text/markdown" || mime == "text/x-rst") {
+                    if(url.path().ends_with("/twtxt.txt"))
+                        feed_type = "twtxt";
                     title = url.str();
-            }
-            else if(mime == "text/plain" || mime == "plaintext" || mime == "text/markdown" || mime == "text/x-rst") {
-                if(url.path().ends_with("/twtxt.txt"))
-                    feed_type = "twtxt";
-                title = url.str();
-                body = std::move(body_raw);
-            }
-            else {
-                if(mime == "application/rss+xml")
-                    feed_type = "rss";
-                else if(mime == "application/atom+xml")
-                    feed_type = "atom";
-                title = url.str();
-                body = "";
-                body_size = 0;
-            }
+                    if(converted.empty())
+                        body = std::string(body_raw);
+                    else
+                        body = std::move(converted);
+                }
+                else {
+                    if(mime == "application/rss+xml")
+                        feed_type = "rss";
+                    else if(mime == "application/atom+xml")
+                        feed_type = "atom";
+                    title = url.str();
+                    body = "";
+                    body_size = 0;
+                }
+            });
         }
         else if(status/10 == 1) {
             body = meta;
@@ -475,10 +700,7 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
         }
         else {
             LOG_ERROR << "Failed to fetch " << url.str() << ": " << status;
-            co_await db->execSqlCoro("UPDATE pages SET last_crawled_at = CURRENT_TIMESTAMP, last_status = $2, last_meta = $3 WHERE url = $1;"
-                , url.str(), status, meta);
-            co_await db->execSqlCoro("DELETE FROM pages WHERE url = $1 AND last_crawl_success_at < CURRENT_TIMESTAMP - INTERVAL '30' DAY;"
-                , url.str());
+            status_writer_.push(url.str(), {.status = status, .meta = meta, .purge_stale = true});
             co_return false;
         }
         // safeguard in case title is too long for Postgres
@@ -489,111 +711,118 @@ Task<bool> GeminiCrawler::crawlPage(const std::string& url_str)
         // Absolutelly no reason to reindex if the content hasn't changed even after post processing.
         if(new_indexed_content_hash == indexed_content_hash && new_raw_content_hash == raw_content_hash) {
             // Maybe this is too strict? The conent doesn't change means the content_type doesn't change, right...?
-            co_await db->execSqlCoro("UPDATE pages SET last_crawled_at = CURRENT_TIMESTAMP, last_crawl_success_at = CURRENT_TIMESTAMP, "
-                "last_status = $2, last_meta = $3, content_type = $4 WHERE url = $1;",
-                url.str(), status, meta, mime);
+            status_writer_.push(url.str(), {.status = status, .meta = meta, .content_type = mime, .success = true});
             co_return true;
         }
 
         std::set<tlgs::Url> link_urls;
-        for(const auto& link : links) {
-            // ignore links like mailto: ldap:. etc..
-            if(tlgs::isNonUriAction(link))
-                continue;
+        std::vector<std::string> cross_site_links;
+        std::vector<std::string> internal_links;
+        tlgs::PgArrayBuilder link_to_urls, link_is_cross_sites, link_to_hosts, link_to_ports;
+        // Normalizing every link is not cheap on link heavy pages either
+        co_await tlgs::runInArena([&]() {
+            for(const auto& link : links) {
+                // ignore links like mailto: ldap:. etc..
+                if(tlgs::isNonUriAction(link))
+                    continue;
 
-            auto link_url = tlgs::Url(link);
-            if(link_url.good()) {
-                if(link_url.protocol() == "")
-                    link_url.withProtocol(url.protocol());
-                if(link_url.protocol() != "gemini")
+                auto link_url = tlgs::Url(link);
+                if(link_url.good()) {
+                    if(link_url.protocol() == "")
+                        link_url.withProtocol(url.protocol());
+                    if(link_url.protocol() != "gemini")
+                        continue;
+                }
+                // sometimes invalid host/port causes the URL to be invalid. Ignore them
+                else if(link.starts_with("gemini://")) {
                     continue;
-            }
-            // sometimes invalid host/port causes the URL to be invalid. Ignore them
-            else if(link.starts_with("gemini://")) {
-                continue;
-            }
-            // Drop links that are too long and obviously invalid
-            else if(link.size() > 1024) {
-                continue;
-            }
-            else  {
-                link_url = linkCompose(url, link);
-                if(link_url.good() == false)
+                }
+                // Drop links that are too long and obviously invalid
+                else if(link.size() > 1024) {
                     continue;
-            }
-            // We shall not send fragments
-            link_url.withFragment("");
-
-            // HACK: avoid mistyped links like gemini://en.gmn.clttr.info/cgmnlm.gmi?gemini://en.gmn.clttr.info/cgmnlm.gmi
-            if(link_url.str().starts_with(link_url.param()) && link_url.path().ends_with(".gmi"))
-                link_url.withParam("");
-            link_urls.insert(std::move(link_url));
-        }
+                }
+                else  {
+                    link_url = linkCompose(url, link);
+                    if(link_url.good() == false)
+                        continue;
+                }
+                // We shall not send fragments
+                link_url.withFragment("");
 
-        // TODO: Use C++20 ranges. My basic implementation is not as efficent as it could be.
-        auto cross_site_links = tlgs::map(tlgs::filter(link_urls, [&url](const tlgs::Url& link_url) {
-                return link_url.host() != url.host() || url.port() != link_url.port();
-            })
-            , [](const tlgs::Url& link_url) {
-                return link_url.str();
-            });
-        auto internal_links = tlgs::map(tlgs::filter(link_urls, [&url](const tlgs::Url& link_url) {
-                return !(link_url.host() != url.host() || url.port() != link_url.port());
-            })
-            , [](const tlgs::Url& link_url) {
-                return link_url.str();
-            });
+                // HACK: avoid mistyped links like gemini://en.gmn.clttr.info/cgmnlm.gmi?gemini://en.gmn.clttr.info/cgmnlm.gmi
+                if(link_url.str().starts_with(link_url.param()) && link_url.path().ends_with(".gmi"))
+                    link_url.withParam("");
+                link_urls.insert(std::move(link_url));
+            }
 
-        // TODO: Guess the language of the content. Then index them with different parsers
-        co_await db->execSqlCoro("UPDATE pages SET content_body = $2, size = $3, charset = $4, lang = $5, last_crawled_at = CURRENT_TIMESTAMP, "
-            "last_crawl_success_at = CURRENT_TIMESTAMP, last_status = $6, last_meta = $7, content_type = $8, title = $9, "
-            "cross_site_links = $10::json, internal_links = $11::json, indexed_content_hash = $12, raw_content_hash = $13, feed_type = $14 WHERE url = $1;",
-            url.str(), body, body_size, charset, lang, status, meta, mime, title, nlohmann::json(cross_site_links).dump()
-            , nlohmann::json(internal_links).dump(), new_indexed_content_hash, new_raw_content_hash, feed_type);
-
-        // Full text index update
-        auto index_firendly_url = indexFriendly(url);
-        co_await db->execSqlCoro("UPDATE pages SET search_vector = to_tsvector(REPLACE(title, '.', ' ') || ' ' || $2 || ' ' || content_body), "
-            "title_vector = to_tsvector(REPLACE(title, '.', ' ') || ' ' || $2), last_indexed_at = CURRENT_TIMESTAMP WHERE url = $1;"
-            , url.str(), index_firendly_url);
-        if(internal_links.size() == 0 && cross_site_links.size() == 0)
-            co_return true;
+            // TODO: Use C++20 ranges. My basic implementation is not as efficent as it could be.
+            cross_site_links = tlgs::map(tlgs::filter(link_urls, [&url](const tlgs::Url& link_url) {
+                    return link_url.host() != url.host() || url.port() != link_url.port();
+                })
+                , [](const tlgs::Url& link_url) {
+                    return link_url.str();
+                });
+            internal_links = tlgs::map(tlgs::filter(link_urls, [&url](const tlgs::Url& link_url) {
+                    return !(link_url.host() != url.host() || url.port() != link_url.port());
+                })
+                , [](const tlgs::Url& link_url) {
+                    return link_url.str();
+                });
+
+            for(const auto& link_url : link_urls) {
+                link_to_urls.append(link_url.str());
+                link_is_cross_sites.append(link_url.host() != url.host() || url.port() != link_url.port());
+                link_to_hosts.append(link_url.host());
+                link_to_ports.append(link_url.port());
+            }
+        });
 
-        // Update link formation
-        // XXX: Drogon does not support bulk insert API. We have to do with string concatenation (with proper escaping)
-        std::string link_query = "INSERT INTO links (url, host, port, to_url, is_cross_site, to_host, to_port) VALUES ";
-        std::string page_query = "INSERT INTO pages (url, domain_name, port, first_seen_at) VALUES ";
-        size_t page_count = 0;
+        // Pages we haven't seen before are added to the crawl queue. Pages almost certainly in the DB already need
+        // neither admission checks nor an insert
+        tlgs::PgArrayBuilder new_urls, new_hosts, new_ports;
+        std::vector<tlgs::Url> discovered;
         for(const auto& link_url : link_urls) {
-            bool is_cross_site = link_url.host() != url.host() || url.port() != link_url.port();
-
-            link_query += fmt::format("('{}', '{}', {}, '{}', {}, '{}', {}), ",
-                pgSQLRealEscape(url.str()), pgSQLRealEscape(url.host()), url.port(), pgSQLRealEscape(link_url.str()),
-                is_cross_site, pgSQLRealEscape(link_url.host()), link_url.port());
-
-            if(co_await shouldCrawl(link_url.str()) == false)
+            if(known_urls_ == nullptr || known_urls_->mayContain(link_url.str()) == false)
+                discovered.push_back(link_url);
+        }
+        auto admitted = co_await shouldCrawl(discovered);
+        for(size_t i=0;i<discovered.size();i++) {
+            if(admitted[i] == false)
                 continue;
-            page_query += fmt::format("('{}', '{}', {}, CURRENT_TIMESTAMP), ",
-                pgSQLRealEscape(link_url.str()), pgSQLRealEscape(link_url.host()), link_url.port());
-            page_count++;
+            new_urls.append(discovered[i].str());
+            new_hosts.append(discovered[i].host());
+            new_ports.append(discovered[i].port());
         }
 
-        co_await db->execSqlCoro("DELETE FROM links WHERE url = $1", url.str());
-        co_await db->execSqlCoro(link_query.substr(0, link_query.size() - 2) + " ON CONFLICT DO NOTHING;");
-        if(page_count != 0)
-            co_await db->execSqlCoro(page_query.substr(0, page_query.size() - 2) + " ON CONFLICT DO NOTHING;");
+        // TODO: Guess the language of the content. Then index them with different parsers
+        // Content, full text index, links and newly discovered pages are all written by one server side function.
+        // See tlgs_ctl for it's definition
+        co_await db->execSqlCoro("SELECT tlgs_commit_page($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12::text[], $13::text[], "
+            "$14, $15, $16, $17, $18::text[], $19::boolean[], $20::text[], $21::integer[], $22::text[], $23::text[], $24::integer[], $25);",
+            url.str(), url.host(), url.port(), std::move(body), body_size, charset, lang, status, meta, mime, title
+            , tlgs::toPgArray(cross_site_links), tlgs::toPgArray(internal_links), new_indexed_content_hash, new_raw_content_hash
+            , feed_type, indexFriendly(url), link_to_urls.str(), link_is_cross_sites.str(), link_to_hosts.str(), link_to_ports.str()
+            , new_urls.str(), new_hosts.str(), new_ports.str(), truncated);
+        index_changed_ = true;
+        if(truncated)
+            LOG_INFO << url.str() << " is too large. Only the first " << body_size << " bytes are indexed";
+
+        if(known_urls_ != nullptr) {
+            known_urls_->add(url.str());
+            for(size_t i=0;i<discovered.size();i++) {
+                if(admitted[i])
+                    known_urls_->add(discovered[i].str());
+            }
+        }
     }
     catch(std::exception& e) {
         error = e.what();
     }
 
     if(error == "Timeout" || error == "NetworkFailure")
-        host_timeout_count_[url.hostWithPort(1965)]++;
+        host_health_.recordFailure(url.host(), url.port());
     if(error != "") {
-        co_await db->execSqlCoro("UPDATE pages SET last_crawled_at = CURRENT_TIMESTAMP, last_status = $2, last_meta = $3 WHERE url = $1;"
-            , url.str(), 0, error);
-        co_await db->execSqlCoro("DELETE FROM pages WHERE url = $1 AND last_crawl_success_at < CURRENT_TIMESTAMP - INTERVAL '30' DAY;"
-            , url.str());
+        status_writer_.push(url.str(), {.status = 0, .meta = error, .purge_stale = true});
         co_return false;
     }
     co_return true;
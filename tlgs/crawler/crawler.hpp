@@ -1,12 +1,36 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <optional>
-#include <tbb/concurrent_unordered_map.h>
 #include <tbb/concurrent_queue.h>
 #include <trantor/net/EventLoop.h>
+#include <trantor/utils/Date.h>
 #include <drogon/utils/coroutine.h>
+#include <drogon/CacheMap.h>
+#include <tlgsutils/bloom_filter.hpp>
+#include <tlgsutils/redirect_map.hpp>
+#include <tlgsutils/url_parser.hpp>
+
+#include "gemini_stream.hpp"
+#include "host_health.hpp"
+#include "status_writer.hpp"
+
+/**
+ * @brief A page waiting to be crawled. Along with what we already know about it
+ */
+struct CrawlItem
+{
+    std::string url;
+    // Whether the fields below are loaded from the DB. URLs added by addUrl() don't have them
+    bool have_state = false;
+    bool have_record = false;
+    std::string indexed_content_hash;
+    std::string raw_content_hash;
+    int last_status = 0;
+    trantor::Date last_crawled_at;
+};
 
 
 class GeminiCrawler : public trantor::NonCopyable
@@ -16,7 +40,17 @@ public:
     template<typename T>
     using Task = drogon::Task<T>;
 
-    GeminiCrawler(EventLoop* loop) : loop_(loop) {}
+    GeminiCrawler(EventLoop* loop)
+        : loop_(loop), policy_cache_(loop, 5), status_writer_(loop), host_health_(loop), dns_cache_(4096, std::chrono::minutes(5))
+    {
+        // Crawls are long. Report how well the cache does every now and then
+        loop_->runEvery(600, [this]() { logDnsCacheStats(); });
+        // Let the search server know the index changed. Not on every page, it only needs to be prompt
+        loop_->runEvery(600, [this]() {
+            if(index_changed_.exchange(false))
+                drogon::async_run([this]() -> Task<void> { co_await bumpIndexEpoch(); });
+        });
+    }
 
     /**
      * @brief Adds a url to the crawling queue.
@@ -26,7 +60,7 @@ public:
 
     void addUrl(const std::string& url)
     {
-        craw_queue_.push(url);
+        craw_queue_.push(CrawlItem{.url = url});
     }
 
     /**
@@ -72,8 +106,18 @@ public:
      */
     Task<void> crawlAll()
     {
+        co_await host_health_.load();
+        co_await loadPermaRedirects();
+        co_await loadKnownUrls();
         dispatchCrawl();
-        return awaitEnd();
+        co_await awaitEnd();
+        // Crawls don't wait for their status to be written. Make sure nothing is lost when we exit
+        co_await status_writer_.drain();
+        co_await host_health_.drain();
+        // Status updates may have removed pages as well. Always tell the server we are done
+        co_await bumpIndexEpoch();
+        saveKnownUrls();
+        logDnsCacheStats();
     }
 
     void setMaxConcurrentConnections(size_t n)
@@ -90,6 +134,23 @@ public:
     {
         force_reindex_ = enable;
     }
+
+    /**
+     * @brief Only index the first `size` bytes of a page. The rest is not downloaded at all
+     */
+    void setMaxIndexSize(size_t size)
+    {
+        max_index_size_ = size;
+    }
+
+    /**
+     * @brief Keep a Bloom filter of known page URLs in this file. Links found in the filter are not inserted
+     * into the DB again. The filter is rebuilt from the DB if it's missing or older than 3 days.
+     */
+    void setUrlFilterPath(std::string path)
+    {
+        url_filter_path_ = std::move(path);
+    }
 protected:
     /**
      * @brief Launches up to max_concurrent_connections_ concurrent crawler tasks (not threads)
@@ -107,6 +168,24 @@ protected:
      * @return true if the crawler should crawl this URL.
      */
     Task<bool> shouldCrawl(std::string url_str);
+    /**
+     * @brief Batched version of shouldCrawl(). robots.txt policies are looked up once per host, all hosts
+     * missing from the local cache are loaded in one query and the rest are fetched concurrently.
+     * @param urls The URLs to check.
+     *
+     * @return for each URL, true if the crawler should crawl it.
+     */
+    Task<std::vector<bool>> shouldCrawl(const std::vector<tlgs::Url>& urls);
+    /**
+     * @brief Checks that don't need the robots.txt policy. Protocol, blacklist and hosts known to be down.
+     */
+    bool passesLocalChecks(const tlgs::Url& url);
+    /**
+     * @brief Fetch robots.txt from the host. Then store the policy in the DB and the local cache.
+     *
+     * @return the disallowed paths. std::nullopt if the host can't be reached
+     */
+    Task<std::optional<std::vector<std::string>>> fetchRobotsPolicy(tlgs::Url url);
     /**
      * 
      * @brief Get the next URL that the crawler should crawl.
@@ -114,20 +193,47 @@ protected:
      * 
      * @return std::nullopt if no URL is available.
      */
-    Task<std::optional<std::string>> getNextCrawlPage();
-    Task<std::optional<std::string>> getNextPotentialCarwlUrl();
+    Task<std::optional<CrawlItem>> getNextCrawlPage();
+    Task<std::optional<CrawlItem>> getNextPotentialCarwlUrl();
     /**
      * @brief Crawl the given URL. Then add the content found in that URL to the DB
      * 
-     * @param url_str the URL to crawl
+     * @param item the page to crawl
+     */
+    Task<bool> crawlPage(const CrawlItem& item);
+    /**
+     * @brief Load all known permanent redirects from the DB into memory
+     */
+    Task<void> loadPermaRedirects();
+    /**
+     * @brief The IO loop to make the next connection on. Round robin over all IO loops
+     */
+    EventLoop* fetchLoop();
+    /**
+     * @brief Load the known URL filter. Or build it from the DB if the file is missing or outdated
+     */
+    Task<void> loadKnownUrls();
+    void saveKnownUrls();
+    void logDnsCacheStats() const;
+    /**
+     * @brief Increment the index epoch so servers drop cached results. Also brings the BM25 statistics up to date
      */
-    Task<bool> crawlPage(const std::string& url_str);
+    Task<void> bumpIndexEpoch();
 
     EventLoop* loop_;
-    tbb::concurrent_unordered_map<std::string, size_t> host_timeout_count_;
-    tbb::concurrent_queue<std::string> craw_queue_;
+    drogon::CacheMap<std::string, std::vector<std::string>> policy_cache_;
+    PageStatusWriter status_writer_;
+    HostHealth host_health_;
+    DnsCache dns_cache_;
+    tlgs::RedirectMap perma_redirects_;
+    std::string url_filter_path_;
+    std::unique_ptr<tlgs::BloomFilter> known_urls_;
+    tbb::concurrent_queue<CrawlItem> craw_queue_;
     size_t max_concurrent_connections_ = 1;
     std::atomic<size_t> ongoing_crawlings_ = 0;
+    std::atomic<size_t> next_fetch_loop_ = 0;
     std::atomic<bool> ended_ = false;
+    std::atomic<bool> index_changed_ = false;
     bool force_reindex_ = false;
+    size_t max_index_size_ = 0x2625a0;
 };
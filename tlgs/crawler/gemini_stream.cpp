@@ -0,0 +1,305 @@
+#include "gemini_stream.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include <trantor/net/InetAddress.h>
+#include <trantor/net/Resolver.h>
+#include <trantor/net/TcpClient.h>
+#include <trantor/utils/Logger.h>
+
+#include <tlgsutils/url_parser.hpp>
+
+using namespace drogon;
+using namespace trantor;
+
+namespace
+{
+// <STATUS><SPACE><META><CR><LF> with META up to 1024 bytes
+constexpr size_t max_header_size = 2 + 1 + 1024 + 2;
+
+class GeminiPrefixRequest : public std::enable_shared_from_this<GeminiPrefixRequest>
+{
+public:
+    using Callback = std::function<void(const HttpResponsePtr&, std::exception_ptr)>;
+
+    GeminiPrefixRequest(std::string url, EventLoop* loop, size_t max_body_size, std::vector<std::string> mimes,
+        DnsCache* dns_cache)
+        : url_(std::move(url)), loop_(loop), max_body_size_(max_body_size), mimes_(std::move(mimes)), dns_cache_(dns_cache)
+    {
+    }
+
+    void start(double timeout, double max_transfer_time, Callback callback)
+    {
+        // Always start from the loop. And never complete before the caller finished suspending
+        auto self = shared_from_this();
+        loop_->queueInLoop([self, timeout, max_transfer_time, callback = std::move(callback)]() mutable {
+            self->startInLoop(timeout, max_transfer_time, std::move(callback));
+        });
+    }
+
+protected:
+    void startInLoop(double timeout, double max_transfer_time, Callback callback)
+    {
+        callback_ = std::move(callback);
+        tlgs::Url url(url_);
+        if(url.good() == false || url.protocol() != "gemini") {
+            fail("BadURL");
+            return;
+        }
+        host_ = url.host();
+        port_ = url.port();
+
+        auto self = shared_from_this();
+        timeout_timer_ = loop_->runAfter(timeout, [self]() {
+            if(!self->header_done_)
+                self->fail("Timeout");
+        });
+        transfer_timer_ = loop_->runAfter(max_transfer_time, [self]() {
+            // Index what we have got so far instead of holding the slot
+            if(self->header_done_)
+                self->finish(true);
+            else
+                self->fail("Timeout");
+        });
+
+        if(dns_cache_ != nullptr) {
+            if(auto addr = dns_cache_->get(host_); addr.has_value()) {
+                connect(InetAddress(addr->toIp(), port_, addr->isIpV6()));
+                return;
+            }
+        }
+
+        resolver_ = Resolver::newResolver(loop_, timeout);
+        resolver_->resolve(host_, [self](const InetAddress& addr) {
+            self->loop_->runInLoop([self, addr]() {
+                if(addr.ipNetEndian() == 0 && !addr.isIpV6()) {
+                    self->fail("NetworkFailure");
+                    return;
+                }
+                if(self->dns_cache_ != nullptr)
+                    self->dns_cache_->insert(self->host_, addr);
+                self->connect(InetAddress(addr.toIp(), self->port_, addr.isIpV6()));
+            });
+        });
+    }
+
+    void connect(const InetAddress& addr)
+    {
+        if(done_)
+            return;
+        auto self = shared_from_this();
+        client_ = std::make_shared<TcpClient>(loop_, addr, "GeminiPrefixRequest");
+        // Gemini capsules almost always use self signed certificates
+        client_->enableSSL(false, false, host_);
+        client_->setConnectionCallback([self](const TcpConnectionPtr& conn) {
+            if(conn->connected())
+                conn->send(self->url_ + "\r\n");
+            else if(self->header_done_)
+                self->finish(false);
+            else
+                self->fail("NetworkFailure");
+        });
+        client_->setConnectionErrorCallback([self]() {
+            self->fail("NetworkFailure");
+        });
+        client_->setMessageCallback([self](const TcpConnectionPtr& conn, MsgBuffer* buf) {
+            self->onMessage(buf);
+        });
+        client_->connect();
+    }
+
+    void onMessage(MsgBuffer* buf)
+    {
+        if(done_) {
+            buf->retrieveAll();
+            return;
+        }
+
+        if(!header_done_) {
+            const size_t old_size = header_.size();
+            header_.append(buf->peek(), buf->readableBytes());
+            auto end = header_.find("\r\n");
+            if(end == std::string::npos) {
+                buf->retrieveAll();
+                if(header_.size() > max_header_size)
+                    fail("BadResponse");
+                return;
+            }
+            // Whatever comes after the header is the beginning of the body
+            buf->retrieve(end + 2 - old_size);
+            header_.resize(end);
+            if(!parseHeader())
+                return;
+        }
+
+        const size_t n = std::min(max_body_size_ - body_.size(), buf->readableBytes());
+        body_.append(buf->peek(), n);
+        buf->retrieveAll();
+        if(body_.size() >= max_body_size_)
+            finish(true);
+    }
+
+    bool parseHeader()
+    {
+        header_done_ = true;
+        if(header_.size() < 2 || !isdigit(header_[0]) || !isdigit(header_[1]) || (header_.size() > 2 && header_[2] != ' ')) {
+            fail("BadResponse");
+            return false;
+        }
+        status_ = (header_[0] - '0') * 10 + (header_[1] - '0');
+        meta_ = header_.size() > 3 ? header_.substr(3) : "";
+
+        // Only successful responses of MIME types we index have a body worth reading
+        if(status_ / 10 != 2 || !wantBody()) {
+            finish(false);
+            return false;
+        }
+        body_.reserve(std::min<size_t>(max_body_size_, 64 * 1024));
+        return true;
+    }
+
+    bool wantBody() const
+    {
+        if(mimes_.empty())
+            return true;
+        std::string mime = meta_.substr(0, meta_.find(';'));
+        mime.erase(0, mime.find_first_not_of(" \t"));
+        mime.erase(mime.find_last_not_of(" \t") + 1);
+        return std::find(mimes_.begin(), mimes_.end(), mime) != mimes_.end();
+    }
+
+    void finish(bool truncated)
+    {
+        if(done_)
+            return;
+        // Other charsets are cut to whole characters when converted to UTF-8
+        if(truncated && utf8Body())
+            trimPartialCharacter();
+
+        auto resp = HttpResponse::newHttpResponse();
+        resp->addHeader("gemini-status", std::to_string(status_));
+        resp->addHeader("meta", meta_);
+        if(truncated)
+            resp->addHeader("truncated", "true");
+        resp->setBody(std::move(body_));
+        complete(resp, nullptr);
+    }
+
+    // Gemini bodies are UTF-8 unless a charset says otherwise
+    bool utf8Body() const
+    {
+        size_t pos = meta_.find(';');
+        while(pos != std::string::npos) {
+            size_t next = meta_.find(';', pos + 1);
+            std::string param = meta_.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1);
+            std::transform(param.begin(), param.end(), param.begin(), ::tolower);
+            param.erase(0, param.find_first_not_of(" \t"));
+            param.erase(param.find_last_not_of(" \t") + 1);
+            if(param.starts_with("charset="))
+                return param == "charset=utf-8" || param == "charset=utf8";
+            pos = next;
+        }
+        return true;
+    }
+
+    // Don't leave half a UTF-8 character at the end of a truncated body
+    void trimPartialCharacter()
+    {
+        size_t continuations = 0;
+        size_t lead = body_.size();
+        while(lead > 0 && continuations < 4 && (static_cast<unsigned char>(body_[lead - 1]) & 0xC0) == 0x80) {
+            lead--;
+            continuations++;
+        }
+        if(lead == 0)
+            return;
+        const auto byte = static_cast<unsigned char>(body_[lead - 1]);
+        size_t expected = 0;
+        if((byte & 0xE0) == 0xC0)
+            expected = 1;
+        else if((byte & 0xF0) == 0xE0)
+            expected = 2;
+        else if((byte & 0xF8) == 0xF0)
+            expected = 3;
+        if(continuations < expected)
+            body_.resize(lead - 1);
+    }
+
+    void fail(const std::string& error)
+    {
+        if(done_)
+            return;
+        complete(nullptr, std::make_exception_ptr(std::runtime_error(error)));
+    }
+
+    void complete(const HttpResponsePtr& resp, std::exception_ptr exception)
+    {
+        done_ = true;
+        loop_->invalidateTimer(timeout_timer_);
+        loop_->invalidateTimer(transfer_timer_);
+        auto callback = std::move(callback_);
+        // We may be inside a callback of the client. Release it once the stack unwinds
+        auto client = std::move(client_);
+        if(client != nullptr) {
+            client->disconnect();
+            loop_->queueInLoop([client]() {});
+        }
+        resolver_.reset();
+        callback(resp, exception);
+    }
+
+    std::string url_;
+    EventLoop* loop_;
+    size_t max_body_size_;
+    std::vector<std::string> mimes_;
+    DnsCache* dns_cache_;
+    std::string host_;
+    int port_ = 0;
+
+    Callback callback_;
+    std::shared_ptr<Resolver> resolver_;
+    TcpClientPtr client_;
+    TimerId timeout_timer_{};
+    TimerId transfer_timer_{};
+
+    std::string header_;
+    bool header_done_ = false;
+    int status_ = 0;
+    std::string meta_;
+    std::string body_;
+    bool done_ = false;
+};
+
+struct GeminiPrefixAwaiter : public CallbackAwaiter<HttpResponsePtr>
+{
+    GeminiPrefixAwaiter(std::shared_ptr<GeminiPrefixRequest> request, double timeout, double max_transfer_time)
+        : request_(std::move(request)), timeout_(timeout), max_transfer_time_(max_transfer_time)
+    {
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        request_->start(timeout_, max_transfer_time_, [this, handle](const HttpResponsePtr& resp, std::exception_ptr exception) {
+            if(exception)
+                setException(exception);
+            else
+                setValue(resp);
+            handle.resume();
+        });
+    }
+
+private:
+    std::shared_ptr<GeminiPrefixRequest> request_;
+    double timeout_;
+    double max_transfer_time_;
+};
+}
+
+Task<HttpResponsePtr> fetchGeminiPrefix(std::string url, double timeout, EventLoop* loop,
+    size_t max_body_size, std::vector<std::string> mimes, double max_transfer_time, DnsCache* dns_cache)
+{
+    auto request = std::make_shared<GeminiPrefixRequest>(std::move(url), loop, max_body_size, std::move(mimes), dns_cache);
+    co_return co_await GeminiPrefixAwaiter(request, timeout, max_transfer_time);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <drogon/HttpResponse.h>
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+#include <trantor/net/InetAddress.h>
+
+#include <tlgsutils/lru_cache.hpp>
+
+/**
+ * @brief Resolved addresses by host name. Shared between requests so hosts are only resolved once in a while
+ */
+using DnsCache = tlgs::LruCache<std::string, trantor::InetAddress>;
+
+/**
+ * @brief Fetch a Gemini page but only keep the first `max_body_size` bytes of the body. The connection is closed
+ * as soon as that much is read. So huge documents cost no more than their prefix.
+ *
+ * The response is shaped like what dremini returns. The status and meta are in the `gemini-status` and `meta`
+ * headers. When the body is cut short the `truncated` header is set. Bodies are only read for MIME types in
+ * `mimes`. UTF-8 bodies are cut at a character boundary. Bodies in other charsets are cut anywhere.
+ *
+ * @param url the URL to fetch
+ * @param timeout seconds to wait for connecting and receiving the response header
+ * @param loop the loop to run the connection on
+ * @param max_body_size keep at most this many bytes of the body
+ * @param mimes MIME types to read the body of
+ * @param max_transfer_time seconds allowed for the whole request. The body is truncated if reading takes longer
+ * @param dns_cache where to look up and store resolved addresses. nullptr to always resolve
+ * @note Throws std::runtime_error. "Timeout" and "NetworkFailure" when the host can't be reached
+ */
+drogon::Task<drogon::HttpResponsePtr> fetchGeminiPrefix(std::string url, double timeout, trantor::EventLoop* loop,
+    size_t max_body_size, std::vector<std::string> mimes, double max_transfer_time, DnsCache* dns_cache = nullptr);
@@ -0,0 +1,162 @@
+#include "host_health.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <drogon/HttpAppFramework.h>
+#include <trantor/utils/Logger.h>
+
+#include <tlgsutils/counter.hpp>
+#include <tlgsutils/pg_array.hpp>
+
+using namespace drogon;
+
+// Only refresh last_success_at of healthy hosts this often. Otherwise every page would mean a write
+static constexpr double success_write_interval = 3600;
+
+HostHealth::HostHealth(trantor::EventLoop* loop, double flush_interval)
+    : loop_(loop)
+{
+    timer_ = loop_->runEvery(flush_interval, [this]() { flush(); });
+}
+
+HostHealth::~HostHealth()
+{
+    loop_->invalidateTimer(timer_);
+}
+
+std::string HostHealth::key(const std::string& host, int port)
+{
+    return host + ":" + std::to_string(port);
+}
+
+double HostHealth::backoff(int failures)
+{
+    if(failures < failure_threshold)
+        return 0;
+    const int exponent = std::min(failures - failure_threshold, 16);
+    return std::min(base_backoff * std::pow(2.0, exponent), max_backoff);
+}
+
+Task<void> HostHealth::load()
+{
+    auto db = app().getDbClient();
+    auto rows = co_await db->execSqlCoro("SELECT host, port, consecutive_failures, next_retry_at, last_success_at FROM hosts;");
+    std::lock_guard lock(mtx_);
+    for(const auto& row : rows) {
+        HostState state;
+        state.host = row["host"].as<std::string>();
+        state.port = row["port"].as<int>();
+        state.consecutive_failures = row["consecutive_failures"].as<int>();
+        if(!row["next_retry_at"].isNull())
+            state.next_retry_at = trantor::Date::fromDbStringLocal(row["next_retry_at"].as<std::string>());
+        if(!row["last_success_at"].isNull())
+            state.last_success_at = trantor::Date::fromDbStringLocal(row["last_success_at"].as<std::string>());
+        hosts_[key(state.host, state.port)] = std::move(state);
+    }
+    LOG_INFO << "Loaded health of " << hosts_.size() << " hosts";
+}
+
+bool HostHealth::available(const std::string& host, int port) const
+{
+    std::lock_guard lock(mtx_);
+    auto it = hosts_.find(key(host, port));
+    if(it == hosts_.end())
+        return true;
+    return !(trantor::Date::now() < it->second.next_retry_at);
+}
+
+void HostHealth::recordFailure(const std::string& host, int port)
+{
+    std::lock_guard lock(mtx_);
+    auto k = key(host, port);
+    auto& state = hosts_[k];
+    state.host = host;
+    state.port = port;
+    state.consecutive_failures++;
+    state.next_retry_at = trantor::Date::now().after(backoff(state.consecutive_failures));
+    if(state.consecutive_failures == failure_threshold)
+        LOG_INFO << k << " keeps failing. Backing off";
+    dirty_[std::move(k)] = state;
+}
+
+void HostHealth::recordSuccess(const std::string& host, int port)
+{
+    auto now = trantor::Date::now();
+    std::lock_guard lock(mtx_);
+    auto k = key(host, port);
+    auto& state = hosts_[k];
+    if(state.consecutive_failures == 0 && now < state.last_success_at.after(success_write_interval))
+        return;
+    if(state.consecutive_failures >= failure_threshold)
+        LOG_INFO << k << " is back";
+    state.host = host;
+    state.port = port;
+    state.consecutive_failures = 0;
+    state.next_retry_at = trantor::Date();
+    state.last_success_at = now;
+    dirty_[std::move(k)] = state;
+}
+
+void HostHealth::flush()
+{
+    std::unordered_map<std::string, HostState> batch;
+    {
+        std::lock_guard lock(mtx_);
+        if(dirty_.empty())
+            return;
+        batch.swap(dirty_);
+    }
+    auto counter = std::make_shared<tlgs::Counter>(writes_in_flight_);
+    async_run([this, counter, batch = std::move(batch)]() mutable -> Task<void> {
+        co_await write(std::move(batch));
+    });
+}
+
+Task<void> HostHealth::write(std::unordered_map<std::string, HostState> batch)
+{
+    tlgs::PgArrayBuilder hosts, ports, failures, next_retries, last_successes;
+    for(const auto& [_, state] : batch) {
+        hosts.append(state.host);
+        ports.append(state.port);
+        failures.append(state.consecutive_failures);
+        if(state.next_retry_at.microSecondsSinceEpoch() == 0)
+            next_retries.appendNull();
+        else
+            next_retries.append(state.next_retry_at.toDbStringLocal());
+        if(state.last_success_at.microSecondsSinceEpoch() == 0)
+            last_successes.appendNull();
+        else
+            last_successes.append(state.last_success_at.toDbStringLocal());
+    }
+
+    auto db = app().getDbClient();
+    try {
+        // Other instances may be failing on the same host. Keep the more pessimistic view until someone succeeds
+        co_await db->execSqlCoro("INSERT INTO hosts(host, port, consecutive_failures, next_retry_at, last_success_at, last_failure_at) "
+            "SELECT u.host, u.port, u.failures, u.next_retry_at, u.last_success_at, "
+            "CASE WHEN u.failures > 0 THEN CURRENT_TIMESTAMP END "
+            "FROM unnest($1::text[], $2::integer[], $3::integer[], $4::timestamp[], $5::timestamp[]) "
+            "AS u(host, port, failures, next_retry_at, last_success_at) "
+            "ON CONFLICT (host, port) DO UPDATE SET "
+            "consecutive_failures = CASE WHEN EXCLUDED.consecutive_failures = 0 THEN 0 "
+            "ELSE GREATEST(hosts.consecutive_failures, EXCLUDED.consecutive_failures) END, "
+            "next_retry_at = CASE WHEN EXCLUDED.consecutive_failures = 0 THEN NULL "
+            "ELSE GREATEST(hosts.next_retry_at, EXCLUDED.next_retry_at) END, "
+            "last_success_at = COALESCE(EXCLUDED.last_success_at, hosts.last_success_at), "
+            "last_failure_at = COALESCE(EXCLUDED.last_failure_at, hosts.last_failure_at);"
+            , hosts.str(), ports.str(), failures.str(), next_retries.str(), last_successes.str());
+    }
+    catch(std::exception& e) {
+        LOG_ERROR << "Failed to write health of " << batch.size() << " hosts: " << e.what();
+    }
+}
+
+Task<void> HostHealth::drain()
+{
+    flush();
+    while(writes_in_flight_ != 0) {
+        co_await drogon::sleepCoro(loop_, 0.05);
+        flush();
+    }
+}
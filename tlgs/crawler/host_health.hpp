@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+#include <trantor/utils/Date.h>
+
+/**
+ * @brief What we know about a host's availability
+ */
+struct HostState
+{
+    std::string host;
+    int port = 1965;
+    int consecutive_failures = 0;
+    // Don't contact the host before this. Default constructed means no restriction
+    trantor::Date next_retry_at;
+    trantor::Date last_success_at;
+};
+
+/**
+ * @brief Tracks hosts that fail to respond. Backed by the `hosts` table so the state is shared between crawler
+ * instances and survives restarts. Hosts that keep failing are retried after exponentially growing delays.
+ * Changes are written in batches like PageStatusWriter does.
+ */
+class HostHealth : public trantor::NonCopyable
+{
+public:
+    /**
+     * @param loop the loop running the flush timer
+     * @param flush_interval seconds between periodic flushes
+     */
+    HostHealth(trantor::EventLoop* loop, double flush_interval = 5.0);
+    ~HostHealth();
+
+    /**
+     * @brief Load the hosts that are currently failing from the DB
+     */
+    drogon::Task<void> load();
+
+    /**
+     * @brief Whether the host may be contacted now
+     */
+    bool available(const std::string& host, int port) const;
+
+    /**
+     * @brief The host didn't respond (timeout, connection or TLS failure)
+     */
+    void recordFailure(const std::string& host, int port);
+
+    /**
+     * @brief The host responded. With any status
+     */
+    void recordSuccess(const std::string& host, int port);
+
+    /**
+     * @brief Write all pending changes and wait for every write in flight to finish.
+     */
+    drogon::Task<void> drain();
+
+    /**
+     * @brief Delay before the next attempt after `failures` consecutive failures
+     */
+    static double backoff(int failures);
+
+    // Failures tolerated before backing off. Single timeouts are common and not a sign of a dead host
+    static constexpr int failure_threshold = 3;
+    static constexpr double base_backoff = 3600;
+    static constexpr double max_backoff = 30 * 24 * 3600;
+
+protected:
+    void flush();
+    drogon::Task<void> write(std::unordered_map<std::string, HostState> batch);
+    static std::string key(const std::string& host, int port);
+
+    trantor::EventLoop* loop_;
+    trantor::TimerId timer_;
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, HostState> hosts_;
+    std::unordered_map<std::string, HostState> dirty_;
+    std::atomic<size_t> writes_in_flight_ = 0;
+};
@@ -31,9 +31,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <iconv.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <string>
-#include <vector>
 
 namespace iconvpp {
 
@@ -65,21 +65,28 @@ class converter {
   }
 
   void convert(const std::string_view& input, std::string& output) const {
-    // copy the string to a buffer as iconv function requires a non-const char
-    // pointer.
-    std::vector<char> in_buf(input.begin(), input.end());
-    char* src_ptr = &in_buf[0];
+    // iconv never writes to the input. It only wants a non-const pointer. So no
+    // need to copy the input
+    char* src_ptr = const_cast<char*>(input.data());
     size_t src_size = input.size();
 
-    std::vector<char> buf(buf_size_);
+    // Convert straight into the output. Most conversions end up about the size
+    // of the input so start there and grow when needed
     std::string dst;
+    dst.resize(std::max(input.size(), buf_size_));
+    size_t used = 0;
     while (0 < src_size) {
-      char* dst_ptr = &buf[0];
-      size_t dst_size = buf.size();
+      char* dst_ptr = dst.data() + used;
+      size_t dst_size = dst.size() - used;
       size_t res = ::iconv(iconv_, &src_ptr, &src_size, &dst_ptr, &dst_size);
+      used = dst.size() - dst_size;
       if (res == (size_t)-1) {
         if (errno == E2BIG)  {
-          // ignore this error
+          dst.resize(dst.size() * 2);
+        } else if (errno == EINVAL && ignore_error_) {
+          // Incomplete character at the end of the input. Ex: a truncated
+          // body. Drop it instead of decoding what's left out of step
+          break;
         } else if (ignore_error_) {
           // skip character
           ++src_ptr;
@@ -88,8 +95,8 @@ class converter {
           check_convert_error();
         }
       }
-      dst.append(&buf[0], buf.size() - dst_size);
     }
+    dst.resize(used);
     dst.swap(output);
   }
 
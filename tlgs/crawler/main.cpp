@@ -2,6 +2,7 @@
 #include <vector>
 #include <utility>
 #include <unordered_map>
+#include <sys/resource.h>
 #include <trantor/utils/Logger.h>
 #include <drogon/HttpAppFramework.h>
 #include "crawler.hpp"
@@ -13,6 +14,13 @@
 using namespace drogon;
 using namespace trantor;
 
+static void logPeakMemory()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    LOG_INFO << "Peak RSS: " << usage.ru_maxrss / 1024 << " MB";
+}
+
 int main(int argc, char** argv)
 {
     trantor::Logger::setLogLevel(trantor::Logger::LogLevel::kInfo);
@@ -21,20 +29,28 @@ int main(int argc, char** argv)
     std::string seed_link_file;
     size_t concurrent_connections = 1;
     bool force_reindex = false;
+    std::string url_filter_file;
+    size_t max_index_size = 0x2625a0;
     std::string config_file = "/etc/tlgs/config.json";
     cli.add_option("-s,--seed", seed_link_file, "Path to seed links for initalizing crawling");
     cli.add_option("-c", concurrent_connections, "Number of concurrent connections");
     cli.add_option("--force-reindex", force_reindex, "Force re-indexing of all links");
+    cli.add_option("--max-index-size", max_index_size, "Only index the first N bytes of large pages (default 2.5MB)");
+    cli.add_option("--url-filter", url_filter_file, "Path to the known URL filter. Skips inserting links already in the index");
     cli.add_option("config_file", config_file, "Path to TLGS config file");
 
     CLI11_PARSE(cli, argc, argv);
     LOG_INFO << "Loading config from " << config_file;
     app().loadConfigFile(config_file);
 
+    // Keep an eye on memory. Concurrent large pages are what drives it up
+    app().getLoop()->runEvery(600, logPeakMemory);
     app().getLoop()->queueInLoop(async_func([&]() -> Task<void> {
         auto crawler = std::make_shared<GeminiCrawler>(app().getIOLoop(0));
         crawler->setMaxConcurrentConnections(concurrent_connections);
         crawler->enableForceReindex(force_reindex);
+        crawler->setUrlFilterPath(url_filter_file);
+        crawler->setMaxIndexSize(max_index_size);
         if(!seed_link_file.empty()) {
             std::ifstream in(seed_link_file);
             if(in.is_open() == false) {
@@ -51,6 +67,7 @@ int main(int argc, char** argv)
         }
 
         co_await crawler->crawlAll();
+        logPeakMemory();
         app().quit();
     }));
 
@@ -0,0 +1,95 @@
+#include "status_writer.hpp"
+
+#include <drogon/HttpAppFramework.h>
+#include <trantor/utils/Logger.h>
+
+#include <tlgsutils/counter.hpp>
+#include <tlgsutils/pg_array.hpp>
+
+using namespace drogon;
+
+PageStatusWriter::PageStatusWriter(trantor::EventLoop* loop, double flush_interval, size_t max_batch_size)
+    : loop_(loop), max_batch_size_(max_batch_size)
+{
+    timer_ = loop_->runEvery(flush_interval, [this]() { flush(); });
+}
+
+PageStatusWriter::~PageStatusWriter()
+{
+    loop_->invalidateTimer(timer_);
+}
+
+void PageStatusWriter::push(std::string url, PageStatusUpdate update)
+{
+    bool full;
+    {
+        std::lock_guard lock(mtx_);
+        buffer_[std::move(url)] = std::move(update);
+        full = buffer_.size() >= max_batch_size_;
+    }
+    if(full)
+        flush();
+}
+
+size_t PageStatusWriter::pending() const
+{
+    std::lock_guard lock(mtx_);
+    return buffer_.size();
+}
+
+void PageStatusWriter::flush()
+{
+    std::unordered_map<std::string, PageStatusUpdate> batch;
+    {
+        std::lock_guard lock(mtx_);
+        if(buffer_.empty())
+            return;
+        batch.swap(buffer_);
+    }
+    // Count the write before returning. So drain() can't miss it
+    auto counter = std::make_shared<tlgs::Counter>(writes_in_flight_);
+    async_run([this, counter, batch = std::move(batch)]() mutable -> Task<void> {
+        co_await write(std::move(batch));
+    });
+}
+
+Task<void> PageStatusWriter::write(std::unordered_map<std::string, PageStatusUpdate> batch)
+{
+    tlgs::PgArrayBuilder urls, statuses, metas, content_types, successes, purge_urls;
+    for(const auto& [url, update] : batch) {
+        urls.append(url);
+        statuses.append(update.status);
+        metas.append(update.meta);
+        content_types.append(update.content_type);
+        successes.append(update.success);
+        if(update.purge_stale)
+            purge_urls.append(url);
+    }
+
+    auto db = app().getDbClient();
+    try {
+        co_await db->execSqlCoro("UPDATE pages AS p SET last_crawled_at = CURRENT_TIMESTAMP, "
+            "last_crawl_success_at = CASE WHEN u.success THEN CURRENT_TIMESTAMP ELSE p.last_crawl_success_at END, "
+            "last_status = u.status, last_meta = COALESCE(u.meta, p.last_meta), content_type = COALESCE(u.content_type, p.content_type) "
+            "FROM unnest($1::text[], $2::integer[], $3::text[], $4::text[], $5::boolean[]) AS u(url, status, meta, content_type, success) "
+            "WHERE p.url = u.url;"
+            , urls.str(), statuses.str(), metas.str(), content_types.str(), successes.str());
+        if(!purge_urls.empty()) {
+            co_await db->execSqlCoro("DELETE FROM pages WHERE url = ANY($1::text[]) AND last_crawl_success_at < CURRENT_TIMESTAMP - INTERVAL '30' DAY;"
+                , purge_urls.str());
+        }
+    }
+    catch(std::exception& e) {
+        // Losing bookkeeping is not fatal. The pages will be crawled again later
+        LOG_ERROR << "Failed to write status of " << batch.size() << " pages: " << e.what();
+    }
+}
+
+Task<void> PageStatusWriter::drain()
+{
+    flush();
+    while(writes_in_flight_ != 0 || pending() != 0) {
+        co_await drogon::sleepCoro(loop_, 0.05);
+        flush();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+
+/**
+ * @brief The outcome of a crawl that doesn't change the page content. ex: blocked, failed or unchanged pages
+ */
+struct PageStatusUpdate
+{
+    int status = 0;
+    // std::nullopt keeps the current value in the DB
+    std::optional<std::string> meta;
+    std::optional<std::string> content_type;
+    // Also set last_crawl_success_at
+    bool success = false;
+    // Delete the page if it hasn't been crawled successfully for 30 days
+    bool purge_stale = false;
+};
+
+/**
+ * @brief Write-behind queue for crawl bookkeeping. Updates are buffered and written in batches with a single
+ * statement. Either periodically or when enough updates are queued. So crawls don't wait on trivial writes.
+ *
+ * @note Only the latest update of each URL is kept in the buffer.
+ */
+class PageStatusWriter : public trantor::NonCopyable
+{
+public:
+    /**
+     * @param loop the loop running the flush timer
+     * @param flush_interval seconds between periodic flushes
+     * @param max_batch_size flush as soon as this many updates are queued
+     */
+    PageStatusWriter(trantor::EventLoop* loop, double flush_interval = 1.0, size_t max_batch_size = 256);
+    ~PageStatusWriter();
+
+    void push(std::string url, PageStatusUpdate update);
+
+    /**
+     * @brief Write all queued updates and wait for every write in flight to finish.
+     */
+    drogon::Task<void> drain();
+
+    size_t pending() const;
+
+protected:
+    void flush();
+    drogon::Task<void> write(std::unordered_map<std::string, PageStatusUpdate> batch);
+
+    trantor::EventLoop* loop_;
+    trantor::TimerId timer_;
+    size_t max_batch_size_;
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, PageStatusUpdate> buffer_;
+    std::atomic<size_t> writes_in_flight_ = 0;
+};
@@ -6,6 +6,7 @@
 #include <tlgsutils/utils.hpp>
 #include <nlohmann/json.hpp>
 #include "search_result.hpp"
+#include "index_epoch.hpp"
 
 using namespace drogon;
 
@@ -34,7 +35,8 @@ static CacheMap<std::string, std::shared_ptr<nlohmann::json>> cache(app().getLoo
 Task<HttpResponsePtr> api::v1::known_hosts(HttpRequestPtr req)
 {
     std::shared_ptr<nlohmann::json> hosts;
-    if(cache.findAndFetch("hosts", hosts) == false ) {
+    const auto key = withIndexEpoch("hosts");
+    if(cache.findAndFetch(key, hosts) == false ) {
         auto db = app().getDbClient();
         auto known_hosts = co_await db->execSqlCoro("SELECT DISTINCT domain_name, port FROM pages");
         auto hosts_vector = std::vector<std::string>();
@@ -45,7 +47,7 @@ Task<HttpResponsePtr> api::v1::known_hosts(HttpRequestPtr req)
             hosts_vector.push_back(tlgs::Url("gemini://"+host_name+":"+std::to_string(port)+"/").str());
         }
 		hosts = std::make_shared<nlohmann::json>(hosts_vector);
-        cache.insert("hosts", hosts, 3600*8);
+        cache.insert(key, hosts, 3600*24);
     }
 
     co_await sleepCoro(app().getLoop(), 0.75);
@@ -67,12 +69,13 @@ Task<HttpResponsePtr> api::v1::known_feeds(HttpRequestPtr req)
         throw std::invalid_argument("Invalid feed type");
 
     std::shared_ptr<nlohmann::json> feeds;
-    if(cache.findAndFetch(request_feed_type, feeds) == false ) {
+    const auto key = withIndexEpoch(request_feed_type);
+    if(cache.findAndFetch(key, feeds) == false ) {
         auto db = app().getDbClient();
         auto feeds_in_db = co_await db->execSqlCoro("SELECT url FROM pages WHERE feed_type = $1", request_feed_type);
         auto feeds_vector = tlgs::map(feeds_in_db, [](const auto& feed) { return feed["url"].template as<std::string>(); });
         feeds = std::make_shared<nlohmann::json>(std::move(feeds_vector));
-        cache.insert(request_feed_type, feeds, 3600*8);
+        cache.insert(key, feeds, 3600*24);
     }
 
     co_await sleepCoro(app().getLoop(), 0.75);
@@ -86,7 +89,8 @@ Task<HttpResponsePtr> api::v1::known_feeds(HttpRequestPtr req)
 Task<HttpResponsePtr> api::v1::known_security_txt(HttpRequestPtr req)
 {
     std::shared_ptr<nlohmann::json> security_txt;
-    if(cache.findAndFetch("security_txt", security_txt) == false ) {
+    const auto key = withIndexEpoch("security_txt");
+    if(cache.findAndFetch(key, security_txt) == false ) {
         auto db = app().getDbClient();
         auto known_security_txt = co_await db->execSqlCoro("SELECT url FROM pages WHERE "
             "content_type = 'text/plain' AND url ~ '.*://[^\\/]+/.well-known/security.txt'");
@@ -95,7 +99,7 @@ Task<HttpResponsePtr> api::v1::known_security_txt(HttpRequestPtr req)
         });
         security_txt_vector.reserve(known_security_txt.size());
         security_txt = std::make_shared<nlohmann::json>(security_txt_vector);
-        cache.insert("security_txt", security_txt, 3600*8);
+        cache.insert(key, security_txt, 3600*24);
     }
     co_await sleepCoro(app().getLoop(), 0.75);
     auto resp = HttpResponse::newHttpResponse();
@@ -107,7 +111,8 @@ Task<HttpResponsePtr> api::v1::known_security_txt(HttpRequestPtr req)
 Task<HttpResponsePtr> api::v1::known_perma_redirects(HttpRequestPtr req)
 {
     std::shared_ptr<nlohmann::json> perma_redirects;
-    if(cache.findAndFetch("perma_redirects", perma_redirects) == false ) {
+    const auto key = withIndexEpoch("perma_redirects");
+    if(cache.findAndFetch(key, perma_redirects) == false ) {
         auto db = app().getDbClient();
         auto known_perma_redirects = co_await db->execSqlCoro("SELECT from_url, to_url FROM perma_redirects");
         perma_redirects = std::make_shared<nlohmann::json>();
@@ -117,7 +122,7 @@ Task<HttpResponsePtr> api::v1::known_perma_redirects(HttpRequestPtr req)
                 {"to_url", redirect["to_url"].template as<std::string>()}
             });
         }
-        cache.insert("perma_redirects", perma_redirects, 3600*8);
+        cache.insert(key, perma_redirects, 3600*24);
     }
     co_await sleepCoro(app().getLoop(), 0.75);
     auto resp = HttpResponse::newHttpResponse();
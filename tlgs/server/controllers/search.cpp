@@ -5,17 +5,31 @@
 #include <tlgsutils/utils.hpp>
 #include <tlgsutils/counter.hpp>
 #include <tlgsutils/url_parser.hpp>
-#include <nlohmann/json.hpp>
+#include <tlgsutils/ranking.hpp>
+#include <tlgsutils/pg_array.hpp>
+#include <tlgsutils/lru_cache.hpp>
+#include <tlgsutils/single_flight.hpp>
+#include <tlgsutils/bm25.hpp>
+#include <tlgsutils/search_index.hpp>
+#include <tlgsutils/task_arena.hpp>
+#include <tlgsutils/cancellation.hpp>
+#include <tlgsutils/sql_params.hpp>
 #include <ranges>
 #include <atomic>
 #include <regex>
 #include <span>
 #include <ranges>
 #include <random>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
 #include <filesystem>
 #include <fmt/core.h>
 
 #include "search_result.hpp"
+#include "query_log.hpp"
+#include "index_epoch.hpp"
 
 using namespace drogon;
 
@@ -26,47 +40,98 @@ struct RankedResult
     size_t size;
     uint64_t content_hash;
     float score;
+    uint32_t host_id;
 };
 
-struct SearchController : public HttpController<SearchController>
+/**
+ * @brief How thoroughly results were ranked. Searches running out of time settle for less
+ */
+enum class SearchTier
 {
-public:
-    enum class RankingAlgorithm
-    {
-        HITS,
-        SALSA
-    };
+    // Text score combined with link analysis over the base set
+    Full,
+    // Link analysis only over links between pages of the root set
+    RootSet,
+    // Only titles were searched
+    TitleOnly,
+    // Cancelled before ranking finished. Whatever was ready by then
+    Partial,
+};
 
-    SearchController();
-    Task<HttpResponsePtr> tlgs_search(HttpRequestPtr req);
-    Task<HttpResponsePtr> add_seed(HttpRequestPtr req);
-    Task<HttpResponsePtr> jump_search(HttpRequestPtr req, std::string search_term);
-    Task<HttpResponsePtr> backlinks(HttpRequestPtr req);
+static std::string_view tierName(SearchTier tier)
+{
+    switch(tier) {
+        case SearchTier::Full: return "full";
+        case SearchTier::RootSet: return "root_set";
+        case SearchTier::TitleOnly: return "title_only";
+        case SearchTier::Partial: return "partial";
+    }
+    return "unknown";
+}
 
-    METHOD_LIST_BEGIN
-    ADD_METHOD_TO(SearchController::tlgs_search, "/search", {Get});
-    ADD_METHOD_TO(SearchController::tlgs_search, "/search/{page}", {Get});
-    ADD_METHOD_TO(SearchController::jump_search, "/search_jump/{search_term}", {Get});
-    ADD_METHOD_TO(SearchController::tlgs_search, "/v/search", {Get});
-    ADD_METHOD_TO(SearchController::tlgs_search, "/v/search/{page}", {Get});
-    ADD_METHOD_TO(SearchController::jump_search, "/v/search_jump/{search_term}", {Get});
-    ADD_METHOD_TO(SearchController::backlinks, "/backlinks", {Get});
-    METHOD_LIST_END
+struct RankedResults
+{
+    std::vector<RankedResult> items;
+    // The root set hit the row limit. Filtering these results may miss pages a filtered search would find. And
+    // pages past the end need a larger root set
+    bool truncated = false;
+    // Size limit of the root set these were ranked from
+    size_t root_limit = 0;
+    SearchTier tier = SearchTier::Full;
+};
+
+/**
+ * @brief Interns host names as small integers. So filtering compares integers instead of parsing URLs
+ */
+class HostTable
+{
+public:
+    uint32_t intern(std::string_view host)
+    {
+        {
+            std::shared_lock lock(mtx_);
+            auto it = ids_.find(host);
+            if(it != ids_.end())
+                return it->second;
+        }
+        std::unique_lock lock(mtx_);
+        auto [it, _] = ids_.emplace(std::string(host), ids_.size());
+        return it->second;
+    }
 
+    std::optional<uint32_t> find(std::string_view host) const
+    {
+        std::shared_lock lock(mtx_);
+        auto it = ids_.find(host);
+        if(it == ids_.end())
+            return std::nullopt;
+        return it->second;
+    }
 
-    Task<std::vector<RankedResult>> pageSearch(const std::string& query_str);
-    std::atomic<size_t> search_in_flight{0};
-    RankingAlgorithm ranking_algorithm = RankingAlgorithm::SALSA;
+protected:
+    struct Hash : std::hash<std::string_view>
+    {
+        using is_transparent = void;
+    };
+    mutable std::shared_mutex mtx_;
+    std::unordered_map<std::string, uint32_t, Hash, std::equal_to<>> ids_;
 };
+static HostTable host_table;
 
-auto sanitizeGemini(std::string preview) -> std::string {
-    utils::replaceAll(preview, "\n", " ");
-    utils::replaceAll(preview, "\t", " ");
-    utils::replaceAll(preview, "```", " ");
-    auto idx = preview.find_first_not_of("`*=>#");
-    if(idx == std::string::npos)
-        return preview;
-    return preview.substr(idx);
+/**
+ * @brief Approximate heap usage of a result list. Used to bound the result cache by bytes
+ */
+static size_t memoryUsage(const RankedResults& results)
+{
+    size_t bytes = sizeof(RankedResults) + results.items.capacity() * sizeof(RankedResult);
+    for(const auto& result : results.items) {
+        // Short strings live inside the object
+        if(result.url.capacity() > 15)
+            bytes += result.url.capacity() + 1;
+        if(result.content_type.capacity() > 15)
+            bytes += result.content_type.capacity() + 1;
+    }
+    return bytes;
 }
 
 enum class TokenType
@@ -97,47 +162,267 @@ struct SearchFilter
 
     bool empty() const
     {
-        return content_type.empty() && domain.empty() && size.empty();
+        return content_type.empty() && domain.empty() && size.empty() && title.empty();
+    }
+
+    size_t constraints() const
+    {
+        return content_type.size() + domain.size() + size.size() + title.size();
     }
 };
 
-namespace std
+/**
+ * @brief Ask PostgreSQL to cancel the statement a backend is running. It then fails with an error. Only if the backend
+ * is still in the transaction that started at `xact_start` (in microseconds since the epoch). Once back in the pool it
+ * may be running someone else's
+ *
+ * @param db a client not shared with searches. So the request doesn't queue behind the queries it should cancel
+ */
+static void cancelBackend(const orm::DbClientPtr& db, int64_t pid, int64_t xact_start)
 {
-template<>
-struct hash<FilterConstrant>
+    db->execSqlAsync("SELECT pg_cancel_backend(pid) FROM pg_stat_activity WHERE pid = $1::integer "
+        "AND (extract(epoch FROM xact_start) * 1000000)::bigint = $2;",
+        [](const orm::Result&) {},
+        [pid](const orm::DrogonDbException& e) {
+            LOG_WARN << "Failed to cancel query of DB backend " << pid << ": " << e.base().what();
+        }, pid, xact_start);
+}
+
+/**
+ * @brief A transaction a search runs its queries in. Statements are limited to what's left until the deadline and
+ * cancelled with the search
+ */
+struct SearchSession
 {
-    size_t operator()(const FilterConstrant& fc) const
+    using Clock = std::chrono::steady_clock;
+
+    std::shared_ptr<orm::Transaction> transaction;
+    // No limit if not set. Change with setDeadline()
+    std::optional<Clock::time_point> deadline;
+    // Destroyed first. A cancel request already sent can't hit the next user of the backend thanks to the xact_start
+    // check. Later ones aren't sent
+    tlgs::CancellationToken::Registration cancel_statement;
+
+    /**
+     * @param cancel_db client to send cancel requests over. Running statements aren't cancelled if null
+     * @param cancel cancels the running statement when cancelled
+     */
+    static Task<SearchSession> begin(const orm::DbClientPtr& db, const orm::DbClientPtr& cancel_db,
+        std::optional<Clock::time_point> deadline, tlgs::CancellationToken& cancel)
     {
-        return std::hash<std::string>{}(fc.value) + fc.negate;
+        SearchSession session;
+        session.transaction = co_await db->newTransactionCoro();
+        if(cancel_db == nullptr) {
+            co_await session.setDeadline(deadline);
+            co_return session;
+        }
+        // now() is when the transaction started. The same as xact_start in pg_stat_activity. Compared as a number so
+        // the time zones of the connections don't matter. The timeout is set in the same round trip
+        session.deadline = deadline;
+        auto backend = co_await session.transaction->execSqlCoro("SELECT pg_backend_pid() AS pid, "
+            "(extract(epoch FROM now()) * 1000000)::bigint AS xact_start, " + std::string(set_timeout_sql) + ";",
+            session.statementTimeout());
+        const auto pid = backend[0]["pid"].as<int64_t>();
+        const auto xact_start = backend[0]["xact_start"].as<int64_t>();
+        session.cancel_statement = cancel.onCancel([cancel_db, pid, xact_start]() {
+            cancelBackend(cancel_db, pid, xact_start);
+        });
+        co_return session;
     }
-};
 
-template<>
-struct hash<SizeConstrant>
-{
-    size_t operator()(const SizeConstrant& sc) const
+    bool outOfTime() const
+    {
+        return deadline.has_value() && Clock::now() >= *deadline;
+    }
+
+    /**
+     * @brief Move the deadline. Statements from now on time out at the new one
+     */
+    Task<void> setDeadline(std::optional<Clock::time_point> new_deadline)
     {
-        return std::hash<size_t>{}(sc.size) + sc.greater;
+        deadline = new_deadline;
+        if(!deadline.has_value())
+            co_return;
+        orm::DbClientPtr db = transaction;
+        co_await db->execSqlCoro("SELECT " + std::string(set_timeout_sql) + ";", statementTimeout());
     }
+
+    /**
+     * @brief Run a statement in the transaction. Fails right away once out of time
+     */
+    template <typename... Args>
+    Task<orm::Result> execSqlCoro(std::string sql, Args... args)
+    {
+        // The timeout is only set when the deadline changes. So each statement may run as long as the whole phase.
+        // Not starting statements past the deadline keeps the overrun to a single statement
+        if(outOfTime())
+            throw orm::TimeoutError("Search ran out of time");
+        orm::DbClientPtr db = transaction;
+        co_return co_await db->execSqlCoro(sql, args...);
+    }
+
+protected:
+    // Sets statement_timeout for the rest of the transaction to $1 ms. Unless $1 is empty
+    static constexpr std::string_view set_timeout_sql =
+        "CASE WHEN $1::text <> '' THEN set_config('statement_timeout', $1::text, true) END";
+
+    // What's left until the deadline in ms. Empty without a deadline
+    std::string statementTimeout() const
+    {
+        if(!deadline.has_value())
+            return "";
+        // A timeout of 0 is no timeout. Past the deadline statements time out right away instead
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - Clock::now()).count();
+        return std::to_string(std::max<int64_t>(remaining, 1));
+    }
+};
+
+/**
+ * @brief Finds the pages matching a query and scores their text. Those are the root set of the link analysis
+ */
+struct RetrievalBackend
+{
+    virtual ~RetrievalBackend() = default;
+    /**
+     * @brief The `limit` best matching pages. Rows have the columns pageSearch() needs, the text score as `rank`
+     *
+     * @param session where to run queries
+     */
+    virtual Task<orm::Result> rootSet(SearchSession& session, const std::string& query_str, const SearchFilter& filter,
+        size_t limit) = 0;
 };
 
-template<>
-struct hash<SearchFilter>
+struct SearchController : public HttpController<SearchController>
 {
-    size_t operator()(const SearchFilter& sf) const
+public:
+    enum class RankingAlgorithm
     {
-        size_t hash = 0;
-        for(const auto& fc : sf.content_type)
-            hash ^= std::hash<FilterConstrant>{}(fc);
-        for(const auto& dc : sf.domain)
-            hash ^= std::hash<FilterConstrant>{}(dc);
-        for(const auto& sc : sf.size)
-            hash ^= std::hash<SizeConstrant>{}(sc);
-        for(const auto& tc : sf.title)
-            hash ^= std::hash<FilterConstrant>{}(tc);
-        return hash;
-    }
+        HITS,
+        SALSA
+    };
+
+    SearchController();
+    Task<HttpResponsePtr> tlgs_search(HttpRequestPtr req);
+    Task<HttpResponsePtr> add_seed(HttpRequestPtr req);
+    Task<HttpResponsePtr> jump_search(HttpRequestPtr req, std::string search_term);
+    Task<HttpResponsePtr> backlinks(HttpRequestPtr req);
+
+    METHOD_LIST_BEGIN
+    ADD_METHOD_TO(SearchController::tlgs_search, "/search", {Get});
+    ADD_METHOD_TO(SearchController::tlgs_search, "/search/{page}", {Get});
+    ADD_METHOD_TO(SearchController::jump_search, "/search_jump/{search_term}", {Get});
+    ADD_METHOD_TO(SearchController::tlgs_search, "/v/search", {Get});
+    ADD_METHOD_TO(SearchController::tlgs_search, "/v/search/{page}", {Get});
+    ADD_METHOD_TO(SearchController::jump_search, "/v/search_jump/{search_term}", {Get});
+    ADD_METHOD_TO(SearchController::backlinks, "/backlinks", {Get});
+    METHOD_LIST_END
+
+
+    /**
+     * @brief Find and rank the best `root_limit` pages matching the query. Filters are applied by the DB while
+     * finding the root set. Once `cancel` is cancelled running queries are cancelled and whatever is ranked by then
+     * is returned
+     */
+    Task<RankedResults> pageSearch(const std::string& query_str, const SearchFilter& filter, size_t root_limit,
+        std::shared_ptr<tlgs::CancellationToken> cancel);
+    /**
+     * @brief pageSearch() through the result cache. Concurrent searches of the same query share one pageSearch().
+     * Which is cancelled with the token of the first of them. Cached results ranked from a smaller root set are
+     * replaced if they were truncated
+     */
+    Task<std::shared_ptr<RankedResults>> cachedPageSearch(const std::string& query_str, const SearchFilter& filter,
+        const std::string& cache_key, size_t root_limit, std::shared_ptr<tlgs::CancellationToken> cancel, bool& cached);
+    /**
+     * @brief Run the most popular searches so their results are cached before users ask for them
+     */
+    Task<void> warmup(size_t num_queries);
+    std::atomic<size_t> search_in_flight{0};
+    RankingAlgorithm ranking_algorithm = RankingAlgorithm::SALSA;
+    std::unique_ptr<RetrievalBackend> retrieval;
+    // Seconds a search may take before settling for a cheaper ranking. 0 for no limit
+    double search_time_budget = 2.0;
+    // Seconds after which a search is cancelled. The client has most likely given up by then
+    double search_deadline = 10.0;
+    // DB client cancel requests are sent over. Running statements of cancelled searches finish if not set
+    std::string cancel_db_client;
+    // Average time link analysis took per node and edge
+    std::atomic<double> ranking_ns_per_element{0};
+
+    using ResultCache = tlgs::LruCache<std::string, std::shared_ptr<RankedResults>>;
+    std::unique_ptr<ResultCache> result_cache;
+    tlgs::SingleFlight<std::string, std::shared_ptr<RankedResults>> search_flights;
+    std::unique_ptr<QueryLog> query_log;
 };
+
+auto sanitizeGemini(std::string preview) -> std::string {
+    utils::replaceAll(preview, "\n", " ");
+    utils::replaceAll(preview, "\t", " ");
+    utils::replaceAll(preview, "```", " ");
+    auto idx = preview.find_first_not_of("`*=>#");
+    if(idx == std::string::npos)
+        return preview;
+    return preview.substr(idx);
+}
+
+/**
+ * @brief Bring a query into canonical form. So queries that mean the same share cache entries. The text is matched
+ * with plainto_tsquery, which ANDs all terms. So terms can be sorted and deduplicated. Same for filters.
+ */
+void canonicalizeQuery(std::string& query_str, SearchFilter& filter)
+{
+    std::vector<std::string> terms;
+    std::string term;
+    for(char ch : query_str) {
+        if(isspace(static_cast<unsigned char>(ch))) {
+            if(!term.empty())
+                terms.push_back(std::move(term));
+            term.clear();
+        }
+        else
+            term += ch;
+    }
+    if(!term.empty())
+        terms.push_back(std::move(term));
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    query_str.clear();
+    for(const auto& t : terms) {
+        if(!query_str.empty())
+            query_str += ' ';
+        query_str += t;
+    }
+
+    auto canonicalize = [](auto& constraints, auto key) {
+        std::sort(constraints.begin(), constraints.end(), [&](const auto& a, const auto& b) { return key(a) < key(b); });
+        constraints.erase(std::unique(constraints.begin(), constraints.end(), [&](const auto& a, const auto& b) {
+            return key(a) == key(b);
+        }), constraints.end());
+    };
+    auto constraint_key = [](const FilterConstrant& fc) { return std::tie(fc.value, fc.negate); };
+    canonicalize(filter.content_type, constraint_key);
+    canonicalize(filter.domain, constraint_key);
+    canonicalize(filter.title, constraint_key);
+    canonicalize(filter.size, [](const SizeConstrant& sc) { return std::tie(sc.size, sc.greater); });
+}
+
+/**
+ * @brief 128 bit fingerprint of a canonicalized filter
+ */
+std::string filterFingerprint(const SearchFilter& filter)
+{
+    // Values can't contain spaces. So they can't be confused with the separators
+    std::string str;
+    auto append = [&str](std::string_view name, const std::vector<FilterConstrant>& constraints) {
+        for(const auto& fc : constraints)
+            str += fmt::format("{} {} {}\n", name, fc.negate ? '-' : '+', fc.value);
+    };
+    append("content_type", filter.content_type);
+    append("domain", filter.domain);
+    append("intitle", filter.title);
+    for(const auto& sc : filter.size)
+        str += fmt::format("size {} {}\n", sc.greater ? '>' : '<', sc.size);
+    return tlgs::xxHash128(str);
 }
 
 std::optional<size_t> parseSizeUnits(std::string unit)
@@ -243,177 +528,334 @@ std::pair<std::string, SearchFilter> parseSearchQuery(const std::string& query)
     return {search_query, filter};
 }
 
+// Filter constraints a search may have. Each is bound as one SQL parameter
+constexpr size_t max_filter_params = 15;
+// Parameters a root set query binds before the filters
+constexpr size_t max_base_params = 2;
+// Most pages ranked for a query
+constexpr size_t root_set_limit = 50000;
+// Pages ranked for the first pages of results. Most people never look further. Paging past them ranks a root set
+// root_set_growth times larger
+constexpr size_t initial_root_set = 1000;
+constexpr size_t root_set_growth = 8;
+// Part of the search time budget kept for searching titles only. When the full text search runs out of time
+constexpr double title_only_budget_share = 0.25;
+// How long results of searches that ran out of time are cached
+constexpr std::chrono::seconds degraded_result_ttl{60};
+
 /**
- * @brief Rnaks the network nodes using the HITS algorithm.
- * 
- * @param in_neighbous vector of vector where in_neighbous[i] is all inbound links of node i 
- * @param out_neighbous ector of vector where out_neighbous[i] is all outbound links of node i
- * @return std::vector<double> The score of each node
+ * @brief Execute SQL with the base parameters and filters of a query
  */
-std::vector<double> hitsRank(const std::vector<std::vector<size_t>>& in_neighbous, const std::vector<std::vector<size_t>>& out_neighbous)
-{
-    // The HITS algorithm
-    size_t node_count = in_neighbous.size();
-    assert(node_count == out_neighbous.size());
-    float score_delta = std::numeric_limits<float>::max_digits10;
-    constexpr float epsilon = 0.005;
-    constexpr size_t max_iter = 300;
-    std::vector<double> auth_score;
-    std::vector<double> hub_score;
-    std::vector<double> new_auth_score;
-    std::vector<double> new_hub_score;
-    auth_score.resize(node_count, 1.0/node_count);
-    hub_score.resize(node_count, 1.0/node_count);
-    new_auth_score.resize(node_count);
-    new_hub_score.resize(node_count);
-    size_t hits_iter = 0;
-    for(hits_iter=0;hits_iter<max_iter && score_delta > epsilon;hits_iter++) {
-        for(size_t i=0;i<node_count;i++) {
-            new_auth_score[i] = auth_score[i];
-            new_hub_score[i] = hub_score[i];
-            float calc_auth_score = 0; 
-            float calc_hub_score = 0;
-            for(auto neighbour_idx : in_neighbous[i])
-                calc_auth_score += hub_score[neighbour_idx];
-            for(auto neighbour_idx : out_neighbous[i])
-                calc_hub_score += auth_score[neighbour_idx];
-
-            if(calc_auth_score != 0)
-                new_auth_score[i] = calc_auth_score;
-            if(calc_hub_score != 0)
-                new_hub_score[i] = calc_hub_score;
-        }
+static auto execSqlWithParams(SearchSession& session, const std::string& sql, const std::vector<std::string>& params)
+{
+    return tlgs::execSqlWithParams<max_filter_params + max_base_params>(&session, sql, params);
+}
 
-        float auth_sum = std::max(std::accumulate(new_auth_score.begin(), new_auth_score.end(), 0.0), 1.0);
-        float hub_sum = std::max(std::accumulate(new_hub_score.begin(), new_hub_score.end(), 0.0), 1.0);
-
-        score_delta = 0;
-        for(size_t i=0;i<node_count;i++) {
-            score_delta += std::abs(auth_score[i] - new_auth_score[i] / auth_sum);
-            score_delta += std::abs(hub_score[i] - new_hub_score[i] / hub_sum);
-            auth_score[i] = new_auth_score[i] / auth_sum;
-            hub_score[i] = new_hub_score[i] / hub_sum;
-
-            // avoid denormals
-            if(auth_score[i] < std::numeric_limits<float>::epsilon())
-                auth_score[i] = 0;
-            if(hub_score[i] < std::numeric_limits<float>::epsilon())
-                hub_score[i] = 0;
+/**
+ * @brief A search filter as SQL condition on the pages table
+ */
+struct SqlFilter
+{
+    // Empty if nothing is filtered
+    std::string condition;
+    std::vector<std::string> params;
+};
+
+/**
+ * @brief Compile filters into SQL. Constraints of the same kind are ORed and different kinds are ANDed. The same as
+ * evalFilter() does. Values are bound as parameters starting from $FirstParam. After the base parameters of the query
+ */
+template <size_t FirstParam>
+static SqlFilter compileFilter(const SearchFilter& filter)
+{
+    // So max_filter_params filters still fit into what execSqlWithParams() binds
+    static_assert(FirstParam - 1 <= max_base_params);
+    SqlFilter result;
+    auto param = [&](std::string value) {
+        result.params.push_back(std::move(value));
+        return "$" + std::to_string(FirstParam + result.params.size() - 1);
+    };
+    auto add = [&](const std::vector<std::string>& alternatives) {
+        if(alternatives.empty())
+            return;
+        std::string condition;
+        for(const auto& alternative : alternatives)
+            condition += (condition.empty() ? "" : " OR ") + alternative;
+        result.condition += " AND (" + condition + ")";
+    };
+    auto escapeLike = [](const std::string& str) {
+        std::string escaped;
+        for(char ch : str) {
+            if(ch == '%' || ch == '_' || ch == '\\')
+                escaped += '\\';
+            escaped += ch;
         }
+        return escaped;
+    };
+
+    std::vector<std::string> alternatives;
+    for(const auto& dc : filter.domain)
+        alternatives.push_back("pages.domain_name " + std::string(dc.negate ? "<>" : "=") + " " + param(dc.value));
+    add(alternatives);
+
+    // Served by the text_pattern_ops index on content_type
+    alternatives.clear();
+    for(const auto& cc : filter.content_type) {
+        auto pattern = param(escapeLike(cc.value) + "%");
+        if(cc.negate)
+            alternatives.push_back("COALESCE(pages.content_type, '') NOT LIKE " + pattern);
+        else
+            alternatives.push_back("pages.content_type LIKE " + pattern);
+    }
+    add(alternatives);
+
+    alternatives.clear();
+    for(const auto& sc : filter.size)
+        alternatives.push_back("pages.size " + std::string(sc.greater ? ">" : "<") + " " + param(std::to_string(sc.size)) + "::bigint");
+    add(alternatives);
+    if(!filter.size.empty())
+        result.condition += " AND pages.size <> 0";
+
+    alternatives.clear();
+    for(const auto& tc : filter.title) {
+        auto match = "pages.title_vector @@ plainto_tsquery(" + param(tc.value) + ")";
+        alternatives.push_back(tc.negate ? "NOT " + match : match);
     }
-    LOG_DEBUG << "HITS finished in " << hits_iter << " iterations";
-    return auth_score;
+    add(alternatives);
+    return result;
 }
 
 /**
- * @brief Rnaks the network nodes using the SALSA algorithm.
- * 
- * @param in_neighbous vector of vector where in_neighbous[i] is all inbound links of node i 
- * @param out_neighbous ector of vector where out_neighbous[i] is all outbound links of node i
- * @return std::vector<double> The score of each node
- * @note in_neighbous and out_neighbous will be modified to become a biparte graph
+ * @brief Look up the details of the root set. Ordered by rank
  */
-std::vector<double> salsaRank(std::vector<std::vector<size_t>>& in_neighbous, std::vector<std::vector<size_t>>& out_neighbous)
-{
-    size_t node_count = in_neighbous.size();
-    assert(node_count == out_neighbous.size());
-    std::vector<unsigned char> is_auth(node_count);
-    size_t num_hubs = 0;
-    size_t num_auths = 0;
-    // Find the hubs and auths in the network. According to the SALSA paper, hubs are noes with more outbound links than inbound links.
-    for(size_t i = 0; i < node_count; ++i) {
-        is_auth[i] = in_neighbous[i].size() > out_neighbous[i].size();
-        num_hubs += !is_auth[i];
-        num_auths += is_auth[i];
-    }
-    // Turn the network into a biparte graph. For performance, we swap the link to be removed with the last link in the vector.
-    // Then resize the vector at the very end.
-    for(size_t i = 0; i < node_count; ++i) {
-        size_t size = in_neighbous[i].size();
-        for(size_t j = 0; j < size ; ++j) {
-            auto idx = in_neighbous[i][j];
-            if(is_auth[idx] == is_auth[i]) {
-                if(j != size-1)
-                    std::swap(in_neighbous[i][j], in_neighbous[i][size-1]);
-                size--;
-                j--;
-            }
+static Task<orm::Result> fetchRootSet(SearchSession& session, const tlgs::PgArrayBuilder& urls,
+    const tlgs::PgArrayBuilder& ranks)
+{
+    co_return co_await session.execSqlCoro("SELECT pages.url AS source_url, cross_site_links, content_type, size, "
+        "domain_name, indexed_content_hash AS content_hash, r.rank "
+        "FROM unnest($1::text[], $2::real[]) AS r(url, rank) JOIN pages ON pages.url = r.url "
+        "ORDER BY r.rank DESC;", urls.str(), ranks.str());
+}
+
+/**
+ * @brief Pages with the query in their title. Scored with ts_rank_cd. Much cheaper than searching the whole text of
+ * pages when the terms are common
+ */
+static Task<orm::Result> titleRootSet(SearchSession& session, const std::string& query_str, const SearchFilter& filter,
+    size_t limit)
+{
+    auto sql_filter = compileFilter<2>(filter);
+    std::vector<std::string> params = {query_str};
+    params.insert(params.end(), sql_filter.params.begin(), sql_filter.params.end());
+    // Zero means "not in the root set" later on
+    co_return co_await execSqlWithParams(session, "SELECT url as source_url, cross_site_links, content_type, size, "
+        "domain_name, indexed_content_hash AS content_hash, "
+        "GREATEST(ts_rank_cd(pages.title_vector, plainto_tsquery($1)), 1e-6) AS rank "
+        "FROM pages WHERE pages.title_vector @@ plainto_tsquery($1)" + sql_filter.condition + " "
+        "ORDER BY rank DESC LIMIT " + std::to_string(limit) + ";", params);
+}
+
+/**
+ * @brief Postgres finds and scores matches with ts_rank_cd
+ */
+struct TsRankBackend : public RetrievalBackend
+{
+    Task<orm::Result> rootSet(SearchSession& session, const std::string& query_str, const SearchFilter& filter,
+        size_t limit) override
+    {
+        auto sql_filter = compileFilter<2>(filter);
+        std::vector<std::string> params = {query_str};
+        params.insert(params.end(), sql_filter.params.begin(), sql_filter.params.end());
+        co_return co_await execSqlWithParams(session, "SELECT url as source_url, cross_site_links, content_type, size, "
+            "domain_name, indexed_content_hash AS content_hash, ts_rank_cd(pages.title_vector, "
+            "plainto_tsquery($1))*50+ts_rank_cd(pages.search_vector, plainto_tsquery($1)) AS rank "
+            "FROM pages WHERE pages.search_vector @@ plainto_tsquery($1)" + sql_filter.condition + " "
+            "ORDER BY rank DESC LIMIT " + std::to_string(limit) + ";", params);
+    }
+};
+
+/**
+ * @brief Postgres finds matches and their term frequencies. They are scored here with BM25. Falls back to
+ * ts_rank_cd until the text statistics are computed
+ */
+struct Bm25Backend : public RetrievalBackend
+{
+    Task<orm::Result> rootSet(SearchSession& session, const std::string& query_str, const SearchFilter& filter,
+        size_t limit) override
+    {
+        // The query terms as the crawler indexed them. With what's needed for their IDF
+        auto terms = co_await session.execSqlCoro(tlgs::bm25TermStatsSql() + ";", query_str);
+        if(terms.size() == 0 || terms[0]["text_stats_ready"].as<bool>() == false)
+            co_return co_await fallback.rootSet(session, query_str, filter, limit);
+
+        const uint64_t doc_count = terms[0]["doc_count"].as<int64_t>();
+        const double docs = std::max<uint64_t>(doc_count, 1);
+        tlgs::PgArrayBuilder term_array;
+        std::vector<float> idf;
+        for(const auto& term : terms) {
+            term_array.append(term["term"].as<std::string_view>());
+            idf.push_back(tlgs::bm25Idf(doc_count, term["doc_freq"].as<int64_t>()));
         }
-        in_neighbous[i].resize(size);
-        size = out_neighbous[i].size();
-        for(size_t j = 0; j < size ; ++j) {
-            auto idx = out_neighbous[i][j];
-            if(is_auth[idx] == is_auth[i]) {
-                if(j != size-1)
-                    std::swap(out_neighbous[i][j], out_neighbous[i][size-1]);
-                size--;
-                j--;
-            }
+        const tlgs::Bm25Scorer title_scorer(idf, terms[0]["title_length_sum"].as<int64_t>() / docs);
+        const tlgs::Bm25Scorer body_scorer(idf, terms[0]["body_length_sum"].as<int64_t>() / docs);
+
+        auto sql_filter = compileFilter<3>(filter);
+        std::vector<std::string> params = {query_str, term_array.str()};
+        params.insert(params.end(), sql_filter.params.begin(), sql_filter.params.end());
+        auto matches = co_await execSqlWithParams(session, tlgs::bm25MatchesSql(sql_filter.condition) + ";", params);
+
+        auto scoring_start = std::chrono::high_resolution_clock::now();
+        tlgs::Bm25Matches scored(idf.size(), matches.size());
+        for(const auto& row : matches) {
+            scored.add(row["title_tf"].as<std::string_view>(), row["body_tf"].as<std::string_view>(),
+                row["title_length"].as<int>(), row["body_length"].as<int>());
         }
-        out_neighbous[i].resize(size);
-    }
-
-    float score_delta = std::numeric_limits<float>::max_digits10;
-    constexpr float epsilon = 0.005*2;
-    constexpr size_t max_iter = 300;
-    std::vector<double> score;
-    std::vector<double> new_score;
-    score.resize(node_count);
-    new_score.resize(node_count);
-    for(size_t i=0;i<node_count;i++)
-        score[i] = 1.0 / (is_auth[i] ? num_auths : num_hubs);
-
-    // The SALSA ranking algorithm
-    // Reference implementation: https://docs.oracle.com/cd/E56133_01/latest/reference/analytics/algorithms/salsa.html
-    size_t salsa_iter = 0;
-    std::vector<float> local_in_score(node_count);
-    std::vector<float> local_out_score(node_count);
-    for(salsa_iter=0;salsa_iter<max_iter && score_delta > epsilon;salsa_iter++) {
-        for(size_t i=0;i<node_count;i++) {
-            local_in_score[i] = -1;
-            local_out_score[i] = -1;
+        // Zero means "not in the root set" later on. Every match has a score
+        auto score = scored.score(title_scorer, body_scorer);
+        auto order = tlgs::topScores(score, limit);
+        tlgs::PgArrayBuilder urls;
+        tlgs::PgArrayBuilder ranks;
+        for(auto i : order) {
+            urls.append(matches[i]["url"].as<std::string_view>());
+            ranks.append(score[i]);
         }
-        for(size_t i=0;i<node_count;i++) {
-            if(is_auth[i]) {
-                new_score[i] = std::accumulate(in_neighbous[i].begin(), in_neighbous[i].end(), 0.0, [&](double sum, size_t idx) {
-                    double neibour_score = local_out_score[idx];
-                    if(neibour_score == -1) {
-                        neibour_score = std::accumulate(out_neighbous[idx].begin(), out_neighbous[idx].end(), 0.0, [&](double sum, size_t idx2) {
-                            return sum + score[idx2] / std::max(in_neighbous[idx2].size(), size_t{1});
-                        }) / std::max(out_neighbous[idx].size(), size_t{1});
-                        local_out_score[idx] = neibour_score;
-                    }
-                    return sum + neibour_score;
-                });
-            }
-            else {
-                new_score[i] = std::accumulate(out_neighbous[i].begin(), out_neighbous[i].end(), 0.0, [&](double sum, size_t idx) {
-                    double neibour_score = local_in_score[idx];
-                    if(neibour_score == -1) {
-                        neibour_score = std::accumulate(in_neighbous[idx].begin(), in_neighbous[idx].end(), 0.0, [&](double sum, size_t idx2) {
-                            return sum + score[idx2] / std::max(out_neighbous[idx2].size(), size_t{1});
-                        }) / std::max(in_neighbous[idx].size(), size_t{1});
-                        local_in_score[idx] = neibour_score;
-                    }
-                    return sum + neibour_score;
-                });
-            }
+        auto scoring_end = std::chrono::high_resolution_clock::now();
+        LOG_DEBUG << "BM25 scored " << matches.size() << " matches in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(scoring_end - scoring_start).count() << "ms";
+
+        co_return co_await fetchRootSet(session, urls, ranks);
+    }
+
+    TsRankBackend fallback;
+};
+
+/**
+ * @brief Searches the index built by `tlgs_ctl build_index`. Pages are still looked up in Postgres. So pages deleted
+ * since the index was built drop out. Filtered searches go to the fallback as the index doesn't know page metadata
+ */
+class IndexBackend : public RetrievalBackend
+{
+public:
+    IndexBackend(std::string dir, std::unique_ptr<RetrievalBackend> fallback)
+        : dir_(std::move(dir)), fallback_(std::move(fallback))
+    {
+        reload();
+        // tlgs_ctl replaces the manifest when it adds or merges segments
+        app().getLoop()->runEvery(60, [this]() {
+            async_run([this]() -> Task<void> {
+                co_await tlgs::runInArena([this]() { reload(); });
+            });
+        });
+    }
+
+    Task<orm::Result> rootSet(SearchSession& session, const std::string& query_str, const SearchFilter& filter,
+        size_t limit) override
+    {
+        auto index = this->index();
+        if(index == nullptr || !filter.empty())
+            co_return co_await fallback_->rootSet(session, query_str, filter, limit);
+
+        // Same normalization the index was built with
+        auto result = co_await session.execSqlCoro("SELECT tsvector_to_array(to_tsvector($1)) AS terms;", query_str);
+        auto terms = tlgs::parsePgArray(result[0]["terms"].as<std::string_view>());
+        auto matches = co_await tlgs::runInArena([&]() {
+            return index->search(terms, limit, tlgs::bm25_title_weight);
+        });
+
+        tlgs::PgArrayBuilder urls;
+        tlgs::PgArrayBuilder ranks;
+        for(const auto& match : matches) {
+            urls.append(match.url);
+            // Zero means "not in the root set" later on
+            ranks.append(std::max(match.score, std::numeric_limits<float>::min()));
         }
-        double sum = std::max(std::accumulate(score.begin(), score.end(), 0.0), 1.0);
+        co_return co_await fetchRootSet(session, urls, ranks);
+    }
 
-        score_delta = 0.0;
-        for(size_t i=0;i<node_count;i++) {
-            score_delta += std::abs(new_score[i]/sum - score[i]);
-            score[i] = new_score[i]/sum;
+    /**
+     * @brief Open the index again if the manifest changed
+     */
+    void reload()
+    {
+        std::error_code ec;
+        auto manifest_time = std::filesystem::last_write_time(std::filesystem::path(dir_) / "manifest", ec);
+        if(ec) {
+            if(!missing_reported_.exchange(true))
+                LOG_WARN << "No search index in " << dir_ << ". Searching the DB until there is one";
+            return;
+        }
+        {
+            std::lock_guard lock(mtx_);
+            if(index_ != nullptr && manifest_time == manifest_time_)
+                return;
+        }
+        try {
+            auto index = tlgs::SearchIndex::open(dir_);
+            LOG_INFO << "Loaded search index of " << index->docCount() << " pages in " << index->segments().size() << " segments";
+            std::lock_guard lock(mtx_);
+            index_ = std::move(index);
+            manifest_time_ = manifest_time;
+        }
+        catch(std::exception& e) {
+            LOG_ERROR << "Failed to load search index from " << dir_ << ": " << e.what();
         }
     }
-    LOG_DEBUG << "SALSA finished in " << salsa_iter << " iterations";
-    return score;
-}
+
+protected:
+    std::shared_ptr<const tlgs::SearchIndex> index() const
+    {
+        std::lock_guard lock(mtx_);
+        return index_;
+    }
+
+    std::string dir_;
+    std::unique_ptr<RetrievalBackend> fallback_;
+    mutable std::mutex mtx_;
+    std::shared_ptr<const tlgs::SearchIndex> index_;
+    std::filesystem::file_time_type manifest_time_;
+    std::atomic<bool> missing_reported_ = false;
+};
 
 SearchController::SearchController()
 {
+    using namespace std::chrono_literals;
     auto tlgs = app().getCustomConfig()["tlgs"];
+    const size_t cache_size_mb = tlgs.get("search_cache_size", 256).asUInt64();
+    // Keys change with the index epoch. The TTL only bounds how long results live without the crawler running
+    result_cache = std::make_unique<ResultCache>(cache_size_mb * 1024 * 1024, 24h * 7);
+    app().getLoop()->runEvery(3600, [this]() {
+        auto stats = result_cache->stats();
+        LOG_INFO << "Search cache: " << stats.entries << " entries, " << stats.cost / (1024 * 1024) << "MB, "
+            << stats.hitRate() * 100 << "% hit rate, " << stats.evictions << " evictions, "
+            << search_flights.joined() << " searches coalesced";
+    });
+
+    // BM25 has yet to be shown as fast as ts_rank_cd on common terms. It sends every match to the server
+    auto text_scoring = tlgs.get("text_scoring", "ts_rank_cd").asString();
+    if(text_scoring == "bm25")
+        retrieval = std::make_unique<Bm25Backend>();
+    else {
+        if(text_scoring != "ts_rank_cd")
+            LOG_WARN << "Unknown text scoring: " << text_scoring << ", defaulting to ts_rank_cd instead";
+        retrieval = std::make_unique<TsRankBackend>();
+    }
+    search_time_budget = tlgs.get("search_time_budget", 2.0).asDouble();
+    search_deadline = tlgs.get("search_deadline", 10.0).asDouble();
+    cancel_db_client = tlgs.get("cancel_db_client", "").asString();
+    auto index_path = tlgs.get("search_index", "").asString();
+    if(!index_path.empty())
+        retrieval = std::make_unique<IndexBackend>(index_path, std::move(retrieval));
+
+    query_log = std::make_unique<QueryLog>(app().getLoop());
+    const size_t warmup_queries = tlgs.get("warmup_queries", 50).asUInt64();
+    if(warmup_queries != 0) {
+        // Give the framework a moment to bring up the DB clients
+        app().getLoop()->runAfter(1.0, [this, warmup_queries]() {
+            async_run([this, warmup_queries]() -> Task<void> {
+                co_await warmup(warmup_queries);
+            });
+        });
+    }
     if(tlgs.isNull())
         return;
 
@@ -431,25 +873,94 @@ SearchController::SearchController()
     }
 }
 
-Task<std::vector<RankedResult>> SearchController::pageSearch(const std::string& query_str)
+Task<RankedResults> SearchController::pageSearch(const std::string& query_str, const SearchFilter& filter, size_t root_limit,
+    std::shared_ptr<tlgs::CancellationToken> cancel)
 {
+    using Clock = std::chrono::steady_clock;
     auto sql_start = std::chrono::high_resolution_clock::now();
+    const bool budgeted = search_time_budget > 0;
+    auto after = [start = Clock::now()](double seconds) {
+        return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    };
+    const auto deadline = after(search_time_budget);
+    // The end of the budget is kept for searching titles. In case the full text search doesn't make it
+    const auto full_text_deadline = after(search_time_budget * (1 - title_only_budget_share));
+    auto budgetUntil = [&](Clock::time_point time) -> std::optional<Clock::time_point> {
+        if(!budgeted)
+            return std::nullopt;
+        return time;
+    };
+
     auto db = app().getDbClient();
-    auto nodes_of_intrest = co_await db->execSqlCoro("SELECT url as source_url, cross_site_links, content_type, size, "
-        "indexed_content_hash AS content_hash, ts_rank_cd(pages.title_vector, "
-        "plainto_tsquery($1))*50+ts_rank_cd(pages.search_vector, plainto_tsquery($1)) AS rank "
-        "FROM pages WHERE pages.search_vector @@ plainto_tsquery($1) "
-        "ORDER BY rank DESC LIMIT 50000;", query_str);
-    auto links_to_node = co_await db->execSqlCoro("SELECT links.to_url AS dest_url, links.url AS source_url, content_type, size, "
-        "indexed_content_hash AS content_hash, 0 AS rank FROM pages JOIN links ON pages.url=links.to_url "
-        "WHERE links.is_cross_site = TRUE AND pages.search_vector @@ plainto_tsquery($1)"
-        , query_str);
+    auto cancel_db = cancel_db_client.empty() ? nullptr : app().getDbClient(cancel_db_client);
+    std::optional<orm::Result> root_result;
+    std::optional<orm::Result> base_result;
+    {
+        auto session = co_await SearchSession::begin(db, cancel_db, budgetUntil(full_text_deadline), *cancel);
+        try {
+            root_result = co_await retrieval->rootSet(session, query_str, filter, root_limit);
+            // No need to leave time for titles anymore
+            co_await session.setDeadline(budgetUntil(deadline));
+            // Only links into the root set become edges. Matches outside of it don't matter. Pages of the base set
+            // are never shown, their details aren't needed
+            if(root_result->size() != 0 && !session.outOfTime() && !cancel->cancelled()) {
+                tlgs::PgArrayBuilder root_urls;
+                for(const auto& page : *root_result)
+                    root_urls.append(page["source_url"].as<std::string_view>());
+                base_result = co_await session.execSqlCoro("SELECT to_url AS dest_url, url AS source_url, '' AS content_type, "
+                    "0 AS size, host AS domain_name, '' AS content_hash, 0 AS rank FROM links "
+                    "WHERE is_cross_site = TRUE AND to_url = ANY($1::text[]);", root_urls.str());
+            }
+        }
+        catch(const orm::DrogonDbException&) {
+            // Timed out and cancelled statements fail like any other. Except the budget is spent or we did cancel
+            if(!session.outOfTime() && !cancel->cancelled())
+                throw;
+        }
+    }
+    SearchTier tier = SearchTier::Full;
+    if(cancel->cancelled()) {
+        LOG_DEBUG << "Search for `" << query_str << "` was cancelled";
+        tier = SearchTier::Partial;
+        if(!root_result.has_value())
+            co_return RankedResults{.tier = tier};
+    }
+    else if(!root_result.has_value()) {
+        LOG_DEBUG << "Full text search for `" << query_str << "` ran out of time. Searching titles only";
+        tier = SearchTier::TitleOnly;
+        // The slice saved for it. Starting now as the full text search may have overrun a bit
+        auto title_deadline = Clock::now() + (deadline - full_text_deadline);
+        auto session = co_await SearchSession::begin(db, cancel_db, budgetUntil(title_deadline), *cancel);
+        try {
+            root_result = co_await titleRootSet(session, query_str, filter, root_limit);
+        }
+        catch(const orm::DrogonDbException&) {
+            if(cancel->cancelled())
+                co_return RankedResults{.tier = SearchTier::Partial};
+            if(!session.outOfTime())
+                throw;
+            LOG_DEBUG << "Title search for `" << query_str << "` ran out of time too";
+            co_return RankedResults{.tier = tier};
+        }
+    }
+    const orm::Result& nodes_of_intrest = *root_result;
     if(nodes_of_intrest.size() == 0) {
         LOG_DEBUG << "DB returned no root set";
         co_return {};
     }
     auto sql_end = std::chrono::high_resolution_clock::now();
 
+    // Link analysis over the base set has to fit into what's left of the budget. Otherwise only the root set is ranked
+    if(base_result.has_value() && budgeted) {
+        const double elements = nodes_of_intrest.size() + 2.0 * base_result->size();
+        const auto expected = std::chrono::nanoseconds(int64_t(elements * ranking_ns_per_element.load()));
+        if(Clock::now() + expected > deadline)
+            base_result.reset();
+    }
+    if(!base_result.has_value() && tier == SearchTier::Full)
+        tier = SearchTier::RootSet;
+    auto ranking_start = Clock::now();
+
     std::unordered_map<std::string, size_t> node_table;
     std::vector<RankedResult> nodes;
     std::vector<double> text_rank;
@@ -461,8 +972,11 @@ Task<std::vector<RankedResult>> SearchController::pageSearch(const std::string&
     // Add all nodes to our graph
     // TODO: Graph construction seems to be the slow part then a common term is being search. "Gemini", "capsule" are good examples.
     // Optimize it
-    for(const auto& links : {nodes_of_intrest, links_to_node}) {
-        for(const auto& link : links) {
+    std::vector<const orm::Result*> node_sources = {&nodes_of_intrest};
+    if(base_result.has_value())
+        node_sources.push_back(&*base_result);
+    for(const auto* links : node_sources) {
+        for(const auto& link : *links) {
             auto source_url = link["source_url"].as<std::string>();
             if(node_table.count(source_url) == 0) {
                 std::string content_hash = link["content_hash"].as<std::string>();
@@ -474,6 +988,7 @@ Task<std::vector<RankedResult>> SearchController::pageSearch(const std::string&
                 node.size = link["size"].as<int64_t>();
                 node.content_type = link["content_type"].as<std::string>();
                 node.content_hash = std::stoull(content_hash, nullptr, 16);
+                node.host_id = host_table.intern(link["domain_name"].as<std::string_view>());
                 text_rank.emplace_back(rank);
                 is_root.push_back(bool(rank != 0)); // Since the only reason for rank == 0 is it's in the base but not root
                 nodes.emplace_back(std::move(node));
@@ -486,8 +1001,8 @@ Task<std::vector<RankedResult>> SearchController::pageSearch(const std::string&
     LOG_DEBUG << "Root set: " << nodes_of_intrest.size() << " pages";
     LOG_DEBUG << "Base set: " << nodes.size() - nodes_of_intrest.size() << " pages";
 
-    std::vector<std::vector<size_t>> out_neighbous(nodes.size());
-    std::vector<std::vector<size_t>> in_neighbous(nodes.size());
+    std::vector<std::pair<tlgs::NodeIndex, tlgs::NodeIndex>> edges;
+    edges.reserve(base_result.has_value() ? base_result->size() : 0);
 
     // populate links between nodes
     auto getIfExists = [&](const std::string& name) -> size_t {
@@ -500,46 +1015,57 @@ Task<std::vector<RankedResult>> SearchController::pageSearch(const std::string&
         auto source_url = page["source_url"].as<std::string>();
         if(page["cross_site_links"].isNull())
             continue;
-        auto links_str = page["cross_site_links"].as<std::string>();
-        auto links = nlohmann::json::parse(std::move(links_str)).get<std::vector<std::string>>();
+        auto links = tlgs::parsePgArray(page["cross_site_links"].as<std::string_view>());
         auto source_node_idx = getIfExists(source_url);
         if(source_node_idx == -1) // Should not ever happen
             continue;
-        out_neighbous[source_node_idx].reserve(links.size());
         for(const auto& link : links) {
             const auto& dest_url = link;
             auto dest_node_idx = getIfExists(dest_url);
 
             if(dest_node_idx == -1 || source_url == dest_url)
                 continue;
-            out_neighbous[source_node_idx].push_back(dest_node_idx);
-            in_neighbous[dest_node_idx].push_back(source_node_idx);
+            edges.emplace_back(source_node_idx, dest_node_idx);
         }
     }
-    for(const auto& link : links_to_node) {
-        const auto& source_url = link["source_url"].as<std::string>();
-        const auto& dest_url = link["dest_url"].as<std::string>();
-        if(source_url == dest_url)
-            continue;
+    if(base_result.has_value()) {
+        for(const auto& link : *base_result) {
+            const auto& source_url = link["source_url"].as<std::string>();
+            const auto& dest_url = link["dest_url"].as<std::string>();
+            if(source_url == dest_url)
+                continue;
 
-        auto source_node_idx = getIfExists(source_url);
-        auto dest_node_idx = getIfExists(dest_url);
-        if(dest_node_idx == -1 || source_node_idx == -1)
-            continue;
-        out_neighbous[source_node_idx].push_back(dest_node_idx);
-        in_neighbous[dest_node_idx].push_back(source_node_idx);
+            auto source_node_idx = getIfExists(source_url);
+            auto dest_node_idx = getIfExists(dest_url);
+            if(dest_node_idx == -1 || source_node_idx == -1)
+                continue;
+            edges.emplace_back(source_node_idx, dest_node_idx);
+        }
     }
 
-    std::vector<double> score;
+    auto graph = tlgs::LinkGraph::fromEdges(nodes.size(), edges);
+    // Scratch buffers are kept per thread so we don't allocate them on every search
+    thread_local tlgs::RankingWorkspace ranking_workspace;
+    std::span<const double> score;
     if(ranking_algorithm == RankingAlgorithm::HITS)
-        score = hitsRank(in_neighbous, out_neighbous);
+        score = tlgs::hitsRank(graph, ranking_workspace, cancel.get());
     else
-        score = salsaRank(in_neighbous, out_neighbous);
+        score = tlgs::salsaRank(graph, ranking_workspace, cancel.get());
+    if(cancel->cancelled()) {
+        tier = SearchTier::Partial;
+    }
+    else {
+        // Learn how long ranking takes. To predict whether the next one fits its budget
+        const double ranking_ns = std::chrono::duration<double, std::nano>(Clock::now() - ranking_start).count()
+            / std::max<size_t>(nodes.size() + edges.size(), 1);
+        const double average_ns = ranking_ns_per_element.load();
+        ranking_ns_per_element = average_ns == 0 ? ranking_ns : 0.9 * average_ns + 0.1 * ranking_ns;
+    }
 
     float max_score = *std::max_element(score.begin(), score.end());
     if(max_score == 0)
         max_score = 1;
-    // Combine the text score and the rank score. Really want to use BM25 as text score
+    // Combine the text score and the rank score
     // XXX: This scoring function works. But it kinda sucks
     for(size_t i=0;i<nodes.size();i++) {
         auto& node = nodes[i];
@@ -629,19 +1155,120 @@ Task<std::vector<RankedResult>> SearchController::pageSearch(const std::string&
     LOG_DEBUG << "Deduplication removed " << num_root - result_map.size() << " results for search term `" << query_str <<"`";
     LOG_DEBUG << "SQL query time: " << sql_time.count() << "ms, Deduplication time: " << dedup_time.count() << "ms";;
 
-    std::vector<RankedResult> search_result;
-    search_result.reserve(result_map.size());
+    RankedResults search_result;
+    search_result.truncated = nodes_of_intrest.size() == root_limit;
+    search_result.root_limit = root_limit;
+    search_result.tier = tier;
+    search_result.items.reserve(result_map.size());
     for(auto& [_, item] : result_map)
-        search_result.emplace_back(std::move(*item));
+        search_result.items.emplace_back(std::move(*item));
 
-    std::sort(search_result.begin(), search_result.end(), [](const auto& a, const auto& b) {
+    std::sort(search_result.items.begin(), search_result.items.end(), [](const auto& a, const auto& b) {
         return a.score > b.score;
     });
     co_return search_result;
 }
 
-bool evalFilter(const std::string_view host, const std::string_view content_type, size_t size, const SearchFilter& filter)
+/**
+ * @brief Root set size needed to show `num_results` results. Grows in steps so paging reuses the same results for a
+ * while
+ */
+static size_t rootLimitFor(size_t num_results)
+{
+    size_t limit = initial_root_set;
+    // Deduplication drops some of the root set. Leave room for that
+    while(limit < num_results * 2 && limit < root_set_limit)
+        limit *= root_set_growth;
+    return std::min(limit, root_set_limit);
+}
+
+/**
+ * @brief Whether results hold everything ranking a root set of `root_limit` pages would find
+ */
+static bool covers(const RankedResults& results, size_t root_limit)
+{
+    return results.truncated == false || results.root_limit >= root_limit;
+}
+
+/**
+ * @brief Key of the unfiltered results of a canonicalized query
+ */
+static std::string rawCacheKey(const std::string& query_str)
+{
+    return withIndexEpoch(tlgs::xxHash128(query_str));
+}
+
+Task<void> SearchController::warmup(size_t num_queries)
 {
+    std::vector<std::string> queries;
+    try {
+        // Otherwise we'd warm up results for a stale epoch
+        co_await refreshIndexEpoch();
+        queries = co_await query_log->topQueries(num_queries);
+    }
+    catch(std::exception& e) {
+        LOG_WARN << "Failed to read query log. Skipping cache warmup: " << e.what();
+        co_return;
+    }
+
+    // One at a time. Warming up shouldn't starve users searching in the mean time
+    auto start = std::chrono::steady_clock::now();
+    size_t warmed = 0;
+    for(const auto& query_str : queries) {
+        try {
+            bool cached;
+            co_await cachedPageSearch(query_str, {}, rawCacheKey(query_str), initial_root_set,
+                std::make_shared<tlgs::CancellationToken>(), cached);
+            warmed++;
+        }
+        catch(std::exception& e) {
+            LOG_WARN << "Failed to warm up search for `" << query_str << "`: " << e.what();
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start);
+    LOG_INFO << "Warmed up " << warmed << " popular searches in " << elapsed.count() << "s";
+}
+
+Task<std::shared_ptr<RankedResults>> SearchController::cachedPageSearch(const std::string& query_str,
+    const SearchFilter& filter, const std::string& cache_key, size_t root_limit,
+    std::shared_ptr<tlgs::CancellationToken> cancel, bool& cached)
+{
+    if(auto results = result_cache->get(cache_key); results.has_value() && covers(**results, root_limit)) {
+        cached = true;
+        co_return *results;
+    }
+    cached = false;
+    const auto flight_key = cache_key + "#" + std::to_string(root_limit);
+    co_return co_await search_flights.run(flight_key, [this, query_str, filter, cache_key, root_limit, cancel]()
+        -> Task<std::shared_ptr<RankedResults>> {
+        // Someone may have just finished the same search
+        if(auto results = result_cache->get(cache_key); results.has_value() && covers(**results, root_limit))
+            co_return *results;
+        auto results = std::make_shared<RankedResults>(co_await pageSearch(query_str, filter, root_limit, cancel));
+        // Degraded results are only kept long enough to ride out the load that caused them. Cancelled searches are
+        // still shared with everyone waiting for them
+        if(results->tier == SearchTier::Full)
+            result_cache->insert(cache_key, results, memoryUsage(*results));
+        else if(!results->items.empty())
+            result_cache->insert(cache_key, results, memoryUsage(*results), degraded_result_ttl);
+        co_return results;
+    });
+}
+
+/**
+ * @brief Host IDs of the domain filters. In the same order. std::nullopt for hosts never seen in any result
+ */
+static std::vector<std::optional<uint32_t>> domainIds(const SearchFilter& filter)
+{
+    return tlgs::map(filter.domain, [](const FilterConstrant& dc) { return host_table.find(dc.value); });
+}
+
+/**
+ * @brief Check a result against the filters. Title filters can't be checked here. Those are only applied in SQL
+ */
+bool evalFilter(const RankedResult& item, const SearchFilter& filter, const std::vector<std::optional<uint32_t>>& domain_ids)
+{
+    const size_t size = item.size;
     if(size == 0 && filter.size.size() != 0)
         return false;
     
@@ -654,23 +1281,18 @@ bool evalFilter(const std::string_view host, const std::string_view content_type
     if(!filter.size.empty() && size_it == filter.size.end())
         return false;
     
-    auto domain_it = std::find_if(filter.domain.begin(), filter.domain.end(), [host](const auto& domain_constrant){
-        return domain_constrant.negate ^ (host == domain_constrant.value);
-    });
-    if(!filter.domain.empty() && domain_it == filter.domain.end())
+    bool domain_match = filter.domain.empty();
+    for(size_t i=0;i<filter.domain.size() && !domain_match;i++)
+        domain_match = filter.domain[i].negate ^ (domain_ids[i] == item.host_id);
+    if(!domain_match)
         return false;
     
+    std::string_view content_type = item.content_type;
     auto content_it = std::find_if(filter.content_type.begin(), filter.content_type.end(), [content_type](const auto& content_constrant){
         return content_constrant.negate ^ (content_type != "" && content_type.starts_with(content_constrant.value));
     });
     if(!filter.content_type.empty() && content_it == filter.content_type.end())
         return false;
-    
-    auto title_it = std::find_if(filter.title.begin(), filter.title.end(), [content_type](const auto& title_constrant){
-        return title_constrant.negate ^ (content_type != "" && content_type.starts_with(title_constrant.value));
-    });
-    if(!filter.title.empty() && title_it == filter.title.end())
-        return false;
 
     return true;
 }
@@ -678,7 +1300,6 @@ bool evalFilter(const std::string_view host, const std::string_view content_type
 Task<HttpResponsePtr> SearchController::tlgs_search(HttpRequestPtr req)
 {
     using namespace std::chrono;
-    constexpr size_t cache_time = 600;
 
     // Hacky implementation of exponential backoff. We ask each request to wait
     // more and more until we processed something. Since we can't know how sent
@@ -700,6 +1321,7 @@ Task<HttpResponsePtr> SearchController::tlgs_search(HttpRequestPtr req)
     auto input = utils::urlDecode(req->getParameter("query"));
     auto [query_str, filter] = parseSearchQuery(input);
     std::transform(query_str.begin(), query_str.end(), query_str.begin(), ::tolower);
+    canonicalizeQuery(query_str, filter);
 
     if(query_str.empty()) {
         auto resp = HttpResponse::newHttpResponse();
@@ -707,55 +1329,72 @@ Task<HttpResponsePtr> SearchController::tlgs_search(HttpRequestPtr req)
         resp->setStatusCode((HttpStatusCode)10);
         co_return resp;
     }
+    if(filter.constraints() > max_filter_params) {
+        auto resp = HttpResponse::newHttpResponse();
+        resp->addHeader("meta", "Too many filters. Use at most " + std::to_string(max_filter_params));
+        resp->setStatusCode((HttpStatusCode)10);
+        co_return resp;
+    }
 
-    using RankedResults = std::vector<RankedResult>;
-
-    static CacheMap<std::string, std::shared_ptr<RankedResults>> result_cache(app().getLoop(), 60);
     auto page = tlgs::try_strtoull(std::filesystem::path(req->path()).filename().generic_string()).value_or(1);
     const size_t current_page_idx = page - 1;
+    const size_t item_per_page = 10;
+    const size_t root_limit = rootLimitFor(item_per_page * page);
+
+    // Only count new searches. Not flipping through pages
+    if(current_page_idx == 0)
+        query_log->record(query_str);
 
-    static const size_t fixed_random = std::random_device()();
-    const auto hasher = std::hash<std::string>();
-    const auto filter_hasher = std::hash<SearchFilter>();
-    const auto query_hash = hasher(query_str)^fixed_random;
-    const auto filter_hash = filter_hasher(filter)^fixed_random;
-    const auto raw_result_cache_key = query_str + "|" + std::to_string(query_hash);
-    const auto filtered_result_cache_key = raw_result_cache_key + "|" + std::to_string(filter_hash);
+    const auto raw_result_cache_key = rawCacheKey(query_str);
+    const auto filtered_result_cache_key = raw_result_cache_key + "|" + filterFingerprint(filter);
     std::string cache_status = "(fully cached)";
 
+    // Gemini clients give up after a while. Don't keep a DB connection busy for someone no longer waiting
+    auto cancel = std::make_shared<tlgs::CancellationToken>();
+    auto loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+    auto deadline_timer = loop->runAfter(search_deadline, [weak_cancel = std::weak_ptr(cancel)]() {
+        if(auto cancel = weak_cancel.lock())
+            cancel->cancel();
+    });
+
     std::shared_ptr<RankedResults> filtered_result;
-    if(result_cache.findAndFetch(filtered_result_cache_key, filtered_result) == false) {
-        std::shared_ptr<RankedResults> ranked_result;
-        if(result_cache.findAndFetch(raw_result_cache_key, ranked_result) == false) {
-            ranked_result = std::make_shared<RankedResults>(co_await pageSearch(query_str));
-            result_cache.insert(raw_result_cache_key, ranked_result, cache_time);
-            cache_status = "";
-        }
-        else {
-            cache_status = "(raw cached)";
-        }
-        // should not happen
-        if(ranked_result == nullptr)
-            throw std::runtime_error("search result is nullptr");
-        if(filter.empty() == false) {
+    bool cached = false;
+    if(filter.empty()) {
+        filtered_result = co_await cachedPageSearch(query_str, filter, raw_result_cache_key, root_limit, cancel, cached);
+    }
+    else if(auto cached_filtered_result = result_cache->get(filtered_result_cache_key); cached_filtered_result.has_value()
+        && covers(**cached_filtered_result, root_limit)) {
+        filtered_result = std::move(*cached_filtered_result);
+        cached = true;
+    }
+    else {
+        // Filtering cached raw results is cheapest. But only when the raw results hold every match. Otherwise let
+        // the DB apply the filters while searching. Which also makes selective filters fast
+        auto raw_result = filter.title.empty() ? result_cache->get(raw_result_cache_key) : std::nullopt;
+        if(raw_result.has_value() && (*raw_result)->truncated == false && (*raw_result)->tier == SearchTier::Full) {
+            auto domain_ids = domainIds(filter);
             filtered_result = std::make_shared<RankedResults>();
-            for(const auto& item : *ranked_result) {
-                if(evalFilter(tlgs::Url(item.url).host(), item.content_type, item.size, filter))
-                    filtered_result->push_back(item);
+            for(const auto& item : (*raw_result)->items) {
+                if(evalFilter(item, filter, domain_ids))
+                    filtered_result->items.push_back(item);
             }
+            result_cache->insert(filtered_result_cache_key, filtered_result, memoryUsage(*filtered_result));
+            cache_status = "(raw cached)";
         }
         else {
-            filtered_result = ranked_result;
+            filtered_result = co_await cachedPageSearch(query_str, filter, filtered_result_cache_key, root_limit, cancel, cached);
         }
-        result_cache.insert(filtered_result_cache_key, filtered_result, cache_time);
     }
+    loop->invalidateTimer(deadline_timer);
+    if(!cached && cache_status != "(raw cached)")
+        cache_status = "";
 
     if(filtered_result == nullptr)
         throw std::runtime_error("filtered search result is nullptr");
 
-    const size_t item_per_page = 10;
-    auto begin = filtered_result->begin()+item_per_page*current_page_idx;
-    auto end = filtered_result->begin()+std::min(size_t{item_per_page*(current_page_idx+1)}, filtered_result->size());
+    const auto& items = filtered_result->items;
+    auto begin = items.begin()+std::min(item_per_page*current_page_idx, items.size());
+    auto end = items.begin()+std::min(size_t{item_per_page*(current_page_idx+1)}, items.size());
     if(begin > end)
         begin = end;
     // XXX: Drogon's raw SQL querys does not support arrays/sets 
@@ -814,7 +1453,10 @@ Task<HttpResponsePtr> SearchController::tlgs_search(HttpRequestPtr req)
     data["title"] = sanitizeGemini(input) + " - TLGS Search";
     data["verbose"] = req->path().starts_with("/v/search");
     data["encoded_search_term"] = encoded_search_term;
-    data["total_results"] = filtered_result->size();
+    data["total_results"] = filtered_result->items.size();
+    // Ranking a larger root set finds more
+    data["more_results"] = filtered_result->truncated && filtered_result->root_limit < root_set_limit;
+    data["search_tier"] = std::string(tierName(filtered_result->tier));
     data["current_page_idx"] = current_page_idx;
     data["item_per_page"] = item_per_page;
     data["search_query"] = input; 
@@ -3,12 +3,14 @@
 #include <drogon/HttpAppFramework.h>
 #include <tlgsutils/url_parser.hpp>
 #include "search_result.hpp"
+#include "index_epoch.hpp"
 
 using namespace drogon;
 
 struct ToolsController : public HttpController<ToolsController>
 {
 public:
+	ToolsController();
 	Task<HttpResponsePtr> statistics(HttpRequestPtr req);
 	Task<HttpResponsePtr> known_hosts(HttpRequestPtr req);
 	Task<HttpResponsePtr> add_seed(HttpRequestPtr req);
@@ -20,11 +22,12 @@ public:
     METHOD_LIST_END
 };
 
-Task<HttpResponsePtr> ToolsController::statistics(HttpRequestPtr req)
+static Task<std::shared_ptr<ServerStatistics>> serverStatistics()
 {
     static CacheMap<std::string, std::shared_ptr<ServerStatistics>> cache(app().getLoop(), 600);
     std::shared_ptr<ServerStatistics> server_stat;
-    if(cache.findAndFetch("server_stat", server_stat) == false) {
+    const auto key = withIndexEpoch("server_stat");
+    if(cache.findAndFetch(key, server_stat) == false) {
         auto db = app().getDbClient();
         auto domain_pages = co_await db->execSqlCoro("SELECT COUNT(DISTINCT LOWER(domain_name)) as domain_count, COUNT(*) AS count "
             "FROM pages WHERE content_body IS NOT NULL");
@@ -49,22 +52,17 @@ Task<HttpResponsePtr> ToolsController::statistics(HttpRequestPtr req)
         server_stat->domain_count = domain_count;
         server_stat->content_type_count = std::move(content_type_count);
         server_stat->update_time = trantor::Date::now().toCustomedFormattedString("%Y-%m-%d %H:%M:%S", false);
-        cache.insert("server_stat", server_stat, 3600*6);
+        cache.insert(key, server_stat, 3600*24);
     }
-
-    HttpViewData data;
-    data["title"] = std::string("TLGS Statistics");
-    data["server_stat"] = server_stat;
-    auto resp = HttpResponse::newHttpViewResponse("statistics", data);
-    resp->setContentTypeCodeAndCustomString(CT_CUSTOM, "text/gemini");
-    co_return resp;
+    co_return server_stat;
 }
 
-Task<HttpResponsePtr> ToolsController::known_hosts(HttpRequestPtr req)
+static Task<std::shared_ptr<std::vector<std::string>>> knownHosts()
 {
     static CacheMap<std::string, std::shared_ptr<std::vector<std::string>>> cache(app().getLoop(), 600);
     std::shared_ptr<std::vector<std::string>> hosts;
-    if(cache.findAndFetch("hosts", hosts) == false ) {
+    const auto key = withIndexEpoch("hosts");
+    if(cache.findAndFetch(key, hosts) == false ) {
         auto db = app().getDbClient();
         auto known_hosts = co_await db->execSqlCoro("SELECT DISTINCT LOWER(domain_name) AS domain_name, port FROM pages");
         hosts = std::make_shared<std::vector<std::string>>();
@@ -77,8 +75,42 @@ Task<HttpResponsePtr> ToolsController::known_hosts(HttpRequestPtr req)
                 continue;
             hosts->push_back(url.str());
         }
-        cache.insert("hosts", hosts, 3600*8);
+        cache.insert(key, hosts, 3600*24);
     }
+    co_return hosts;
+}
+
+ToolsController::ToolsController()
+{
+    // Both are full table scans. Get them cached before anyone asks
+    app().getLoop()->runAfter(1.0, []() {
+        async_run([]() -> Task<void> {
+            try {
+                co_await refreshIndexEpoch();
+                co_await serverStatistics();
+                co_await knownHosts();
+            }
+            catch(std::exception& e) {
+                LOG_WARN << "Failed to warm up statistics: " << e.what();
+            }
+        });
+    });
+}
+
+Task<HttpResponsePtr> ToolsController::statistics(HttpRequestPtr req)
+{
+    auto server_stat = co_await serverStatistics();
+    HttpViewData data;
+    data["title"] = std::string("TLGS Statistics");
+    data["server_stat"] = server_stat;
+    auto resp = HttpResponse::newHttpViewResponse("statistics", data);
+    resp->setContentTypeCodeAndCustomString(CT_CUSTOM, "text/gemini");
+    co_return resp;
+}
+
+Task<HttpResponsePtr> ToolsController::known_hosts(HttpRequestPtr req)
+{
+    auto hosts = co_await knownHosts();
     HttpViewData data;
     data["title"] = std::string("Hosts known to TLGS");
     data["hosts"] = std::move(hosts);
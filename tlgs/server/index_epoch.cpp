@@ -0,0 +1,42 @@
+#include "index_epoch.hpp"
+
+#include <atomic>
+
+#include <drogon/HttpAppFramework.h>
+#include <trantor/utils/Logger.h>
+
+using namespace drogon;
+
+static std::atomic<uint64_t> current_epoch = 0;
+
+uint64_t indexEpoch()
+{
+    return current_epoch.load(std::memory_order_relaxed);
+}
+
+Task<uint64_t> refreshIndexEpoch()
+{
+    try {
+        auto db = app().getDbClient();
+        auto result = co_await db->execSqlCoro("SELECT epoch FROM index_state WHERE id = 1;");
+        if(result.size() != 0) {
+            uint64_t epoch = result[0]["epoch"].as<int64_t>();
+            uint64_t old = current_epoch.exchange(epoch, std::memory_order_relaxed);
+            if(old != epoch)
+                LOG_INFO << "Index epoch changed from " << old << " to " << epoch << ". Cached results are dropped";
+        }
+    }
+    catch(std::exception& e) {
+        LOG_WARN << "Failed to read index epoch: " << e.what();
+    }
+    co_return indexEpoch();
+}
+
+void startIndexEpochPolling(double interval)
+{
+    app().getLoop()->runEvery(interval, []() {
+        async_run([]() -> Task<void> {
+            co_await refreshIndexEpoch();
+        });
+    });
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <drogon/utils/coroutine.h>
+
+/**
+ * @brief The index epoch last seen in the `index_state` table. The crawler bumps it whenever the index changes.
+ * Caches include it in their keys so results are kept until the index actually changes.
+ */
+uint64_t indexEpoch();
+
+/**
+ * @brief Read the epoch from the DB now. Keeps the last known epoch if that fails
+ */
+drogon::Task<uint64_t> refreshIndexEpoch();
+
+/**
+ * @brief Poll the epoch every `interval` seconds
+ */
+void startIndexEpochPolling(double interval);
+
+/**
+ * @brief `key` tagged with the current epoch
+ */
+inline std::string withIndexEpoch(const std::string& key)
+{
+    return std::to_string(indexEpoch()) + "@" + key;
+}
@@ -9,6 +9,7 @@
 #endif
 
 #include "search_result.hpp"
+#include "index_epoch.hpp"
 
 #include "CLI/App.hpp"
 #include "CLI/Formatter.hpp"
@@ -127,5 +128,10 @@ int main(int argc, char** argv)
     LOG_INFO << "Loading config from " << config_file;
     app().loadConfigFile(config_file);
 
+    // Cached results are kept until the crawler changes the index
+    app().registerBeginningAdvice([]() {
+        startIndexEpochPolling(30);
+    });
+
     app().run();
 }
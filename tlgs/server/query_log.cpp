@@ -0,0 +1,70 @@
+#include "query_log.hpp"
+
+#include <drogon/HttpAppFramework.h>
+#include <trantor/utils/Logger.h>
+
+#include <tlgsutils/pg_array.hpp>
+
+using namespace drogon;
+
+QueryLog::QueryLog(trantor::EventLoop* loop, double flush_interval)
+    : loop_(loop)
+{
+    timer_ = loop_->runEvery(flush_interval, [this]() { flush(); });
+}
+
+QueryLog::~QueryLog()
+{
+    loop_->invalidateTimer(timer_);
+}
+
+void QueryLog::record(const std::string& query)
+{
+    if(query.empty() || query.size() > max_query_length)
+        return;
+    std::lock_guard lock(mtx_);
+    counts_[query]++;
+}
+
+void QueryLog::flush()
+{
+    std::unordered_map<std::string, size_t> batch;
+    {
+        std::lock_guard lock(mtx_);
+        if(counts_.empty())
+            return;
+        batch.swap(counts_);
+    }
+
+    tlgs::PgArrayBuilder queries, counts;
+    for(const auto& [query, count] : batch) {
+        queries.append(query);
+        counts.append(count);
+    }
+    async_run([queries = queries.str(), counts = counts.str(), size = batch.size()]() -> Task<void> {
+        try {
+            auto db = app().getDbClient();
+            co_await db->execSqlCoro("INSERT INTO query_log(query, count, last_searched_at) "
+                "SELECT q.query, q.count, CURRENT_TIMESTAMP FROM unnest($1::text[], $2::bigint[]) AS q(query, count) "
+                "ON CONFLICT (query) DO UPDATE SET count = query_log.count + EXCLUDED.count, "
+                "last_searched_at = CURRENT_TIMESTAMP;"
+                , queries, counts);
+        }
+        catch(std::exception& e) {
+            // Only used for warming up caches. Not worth retrying
+            LOG_WARN << "Failed to write " << size << " queries to query log: " << e.what();
+        }
+    });
+}
+
+Task<std::vector<std::string>> QueryLog::topQueries(size_t n)
+{
+    auto db = app().getDbClient();
+    auto rows = co_await db->execSqlCoro("SELECT query FROM query_log WHERE last_searched_at > CURRENT_TIMESTAMP - INTERVAL '30' DAY "
+        "ORDER BY count DESC LIMIT $1;", (int64_t)n);
+    std::vector<std::string> queries;
+    queries.reserve(rows.size());
+    for(const auto& row : rows)
+        queries.push_back(row["query"].as<std::string>());
+    co_return queries;
+}
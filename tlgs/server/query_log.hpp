@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+
+/**
+ * @brief Counts how often each query is searched. Counts are buffered in memory and added to the `query_log` table
+ * periodically. So we know which queries are worth having in cache after a restart.
+ */
+class QueryLog : public trantor::NonCopyable
+{
+public:
+    /**
+     * @param loop the loop running the flush timer
+     * @param flush_interval seconds between flushes
+     */
+    QueryLog(trantor::EventLoop* loop, double flush_interval = 60.0);
+    ~QueryLog();
+
+    void record(const std::string& query);
+
+    /**
+     * @brief The most searched queries in the past 30 days. Most popular first
+     */
+    drogon::Task<std::vector<std::string>> topQueries(size_t n);
+
+    /**
+     * @brief Queries longer than this are not logged. They are unlikely to be repeated
+     */
+    static constexpr size_t max_query_length = 256;
+
+protected:
+    void flush();
+
+    trantor::EventLoop* loop_;
+    trantor::TimerId timer_;
+    std::mutex mtx_;
+    std::unordered_map<std::string, size_t> counts_;
+};
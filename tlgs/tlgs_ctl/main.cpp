@@ -1,11 +1,195 @@
 #include <drogon/drogon.h>
 #include <drogon/utils/coroutine.h>
+#include <tlgsutils/bm25.hpp>
+#include <tlgsutils/pg_array.hpp>
+#include <tlgsutils/search_index.hpp>
+#include <tlgsutils/utils.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 using namespace drogon;
 
 #include "CLI/App.hpp"
 #include "CLI/Formatter.hpp"
 #include "CLI/Config.hpp"
 
+// Link lists used to be stored as JSON. Which needs a JSON parser for every page on every search
+Task<> migrateLinkColumns()
+{
+	auto db = app().getDbClient();
+	for(const std::string column : {"cross_site_links", "internal_links"}) {
+		auto type = co_await db->execSqlCoro("SELECT data_type FROM information_schema.columns "
+			"WHERE table_schema = 'public' AND table_name = 'pages' AND column_name = $1", column);
+		if(type.size() == 0 || type[0]["data_type"].as<std::string>() != "json")
+			continue;
+
+		std::cout << "Converting pages." << column << " from json to text[]. This may take a while" << std::endl;
+		// Subqueries are not allowed in ALTER COLUMN ... USING. Go through a temporary column instead
+		auto t = co_await db->newTransactionCoro();
+		co_await t->execSqlCoro("ALTER TABLE pages ADD COLUMN " + column + "_new text[];");
+		co_await t->execSqlCoro("UPDATE pages SET " + column + "_new = ARRAY(SELECT json_array_elements_text(" + column + ")) "
+			"WHERE json_typeof(" + column + ") = 'array';");
+		co_await t->execSqlCoro("ALTER TABLE pages DROP COLUMN " + column + ";");
+		co_await t->execSqlCoro("ALTER TABLE pages RENAME COLUMN " + column + "_new TO " + column + ";");
+	}
+}
+
+// Functions called by the crawler. Replaced on every run so upgrades pick up the new definitions
+Task<> createFunctions()
+{
+	auto db = app().getDbClient();
+	// CREATE OR REPLACE adds an overload when the parameters change. Drop older versions first
+	co_await db->execSqlCoro(R"(
+		DO $$
+		DECLARE f regprocedure;
+		BEGIN
+			FOR f IN SELECT oid::regprocedure FROM pg_proc WHERE proname = 'tlgs_commit_page' LOOP
+				EXECUTE 'DROP FUNCTION ' || f;
+			END LOOP;
+		END
+		$$;
+	)");
+
+	// Number of words in a document. Positions are capped per lexeme. Good enough for length normalization
+	co_await db->execSqlCoro(R"(
+		CREATE OR REPLACE FUNCTION public.tlgs_vector_length(v tsvector) RETURNS integer
+		LANGUAGE sql IMMUTABLE AS $$
+			SELECT COALESCE(sum(COALESCE(array_length(u.positions, 1), 1)), 0)::integer FROM unnest(v) AS u;
+		$$;
+	)");
+
+	// Keeps the BM25 statistics up to date with every change to the indexed text. Changes are only appended to the
+	// delta tables here. Updating term_stats directly would make every commit fight over the rows of common terms.
+	// The crawler folds the deltas into term_stats and index_state periodically. The trigger itself is only installed
+	// by enableTextStats(). It costs every commit, which is wasted unless the server scores with BM25
+	co_await db->execSqlCoro(R"(
+		CREATE OR REPLACE FUNCTION public.tlgs_track_text_stats() RETURNS trigger LANGUAGE plpgsql AS $$
+		DECLARE
+			old_vector tsvector;
+			new_vector tsvector;
+			old_title_length integer := 0;
+			old_body_length integer := 0;
+			new_title_length integer := 0;
+			new_body_length integer := 0;
+		BEGIN
+			IF TG_OP = 'UPDATE' AND NEW.search_vector IS NOT DISTINCT FROM OLD.search_vector
+				AND NEW.title_vector IS NOT DISTINCT FROM OLD.title_vector THEN
+				RETURN NEW;
+			END IF;
+			IF TG_OP <> 'INSERT' THEN
+				old_vector := OLD.search_vector;
+				old_title_length := OLD.title_length;
+				old_body_length := OLD.body_length;
+			END IF;
+			IF TG_OP <> 'DELETE' THEN
+				new_vector := NEW.search_vector;
+				new_title_length := tlgs_vector_length(NEW.title_vector);
+				new_body_length := tlgs_vector_length(NEW.search_vector);
+				NEW.title_length := new_title_length;
+				NEW.body_length := new_body_length;
+			END IF;
+			IF old_vector IS NULL AND new_vector IS NULL THEN
+				RETURN CASE WHEN TG_OP = 'DELETE' THEN OLD ELSE NEW END;
+			END IF;
+
+			INSERT INTO term_stat_deltas (term, delta)
+				SELECT t.term, sum(t.delta) FROM (
+					SELECT unnest(tsvector_to_array(new_vector)) AS term, 1 AS delta
+					UNION ALL
+					SELECT unnest(tsvector_to_array(old_vector)), -1
+				) AS t GROUP BY t.term HAVING sum(t.delta) <> 0;
+			INSERT INTO corpus_stat_deltas (docs, title_length, body_length)
+				VALUES ((new_vector IS NOT NULL)::integer - (old_vector IS NOT NULL)::integer,
+					new_title_length - old_title_length, new_body_length - old_body_length);
+			RETURN CASE WHEN TG_OP = 'DELETE' THEN OLD ELSE NEW END;
+		END;
+		$$;
+	)");
+
+	// Everything the crawler writes after successfully indexing a page. In one round trip and atomically
+	co_await db->execSqlCoro(R"(
+		CREATE OR REPLACE FUNCTION public.tlgs_commit_page(
+			p_url text, p_host text, p_port integer,
+			p_content_body text, p_size bigint, p_charset text, p_lang text,
+			p_status integer, p_meta text, p_content_type text, p_title text,
+			p_cross_site_links text[], p_internal_links text[],
+			p_indexed_content_hash text, p_raw_content_hash text, p_feed_type text,
+			p_index_friendly_url text,
+			p_link_urls text[], p_link_is_cross_site boolean[], p_link_hosts text[], p_link_ports integer[],
+			p_new_urls text[], p_new_hosts text[], p_new_ports integer[],
+			p_truncated boolean
+		) RETURNS void LANGUAGE plpgsql AS $$
+		BEGIN
+			INSERT INTO pages (url, domain_name, port, first_seen_at) VALUES (p_url, p_host, p_port, CURRENT_TIMESTAMP)
+				ON CONFLICT (url) DO NOTHING;
+
+			UPDATE pages SET content_body = p_content_body, size = p_size, charset = p_charset, lang = p_lang,
+				last_crawled_at = CURRENT_TIMESTAMP, last_crawl_success_at = CURRENT_TIMESTAMP, last_status = p_status,
+				last_meta = p_meta, content_type = p_content_type, title = p_title,
+				cross_site_links = p_cross_site_links, internal_links = p_internal_links,
+				indexed_content_hash = p_indexed_content_hash, raw_content_hash = p_raw_content_hash, feed_type = p_feed_type,
+				truncated = p_truncated,
+				search_vector = to_tsvector(REPLACE(p_title, '.', ' ') || ' ' || p_index_friendly_url || ' ' || p_content_body),
+				title_vector = to_tsvector(REPLACE(p_title, '.', ' ') || ' ' || p_index_friendly_url),
+				last_indexed_at = CURRENT_TIMESTAMP
+				WHERE url = p_url;
+
+			-- Only touch links that changed. Most of them survive a page update
+			DELETE FROM links WHERE url = p_url AND to_url <> ALL(p_link_urls);
+			INSERT INTO links (url, host, port, to_url, is_cross_site, to_host, to_port)
+				SELECT p_url, p_host, p_port, n.to_url, n.is_cross_site, n.to_host, n.to_port
+				FROM unnest(p_link_urls, p_link_is_cross_site, p_link_hosts, p_link_ports) AS n(to_url, is_cross_site, to_host, to_port)
+				WHERE NOT EXISTS (SELECT 1 FROM links l WHERE l.url = p_url AND l.to_url = n.to_url);
+
+			INSERT INTO pages (url, domain_name, port, first_seen_at)
+				SELECT n.url, n.domain_name, n.port, CURRENT_TIMESTAMP
+				FROM unnest(p_new_urls, p_new_hosts, p_new_ports) AS n(url, domain_name, port)
+				ON CONFLICT DO NOTHING;
+		END;
+		$$;
+	)");
+}
+
+// Install the trigger maintaining the BM25 statistics and compute them from scratch. Also repairs drift
+Task<> enableTextStats()
+{
+	std::cout << "Computing text statistics. This may take a while" << std::endl;
+	auto db = app().getDbClient();
+	auto t = co_await db->newTransactionCoro();
+	// Keep the crawler from changing pages while we count. Nothing changes between counting and the trigger taking
+	// over then
+	co_await t->execSqlCoro("LOCK TABLE pages IN SHARE ROW EXCLUSIVE MODE;");
+	co_await t->execSqlCoro("DROP TRIGGER IF EXISTS tlgs_track_text_stats ON public.pages;");
+	co_await t->execSqlCoro("CREATE TRIGGER tlgs_track_text_stats BEFORE INSERT OR DELETE OR UPDATE OF search_vector, title_vector "
+		"ON public.pages FOR EACH ROW EXECUTE FUNCTION tlgs_track_text_stats();");
+	co_await t->execSqlCoro("UPDATE pages SET title_length = tlgs_vector_length(title_vector), "
+		"body_length = tlgs_vector_length(search_vector) WHERE search_vector IS NOT NULL OR title_vector IS NOT NULL;");
+	co_await t->execSqlCoro("DELETE FROM term_stat_deltas;");
+	co_await t->execSqlCoro("DELETE FROM corpus_stat_deltas;");
+	co_await t->execSqlCoro("DELETE FROM term_stats;");
+	co_await t->execSqlCoro("INSERT INTO term_stats (term, doc_freq) "
+		"SELECT term, count(*) FROM pages, unnest(tsvector_to_array(search_vector)) AS term GROUP BY term;");
+	auto stats = co_await t->execSqlCoro("UPDATE index_state SET "
+		"doc_count = (SELECT count(*) FROM pages WHERE search_vector IS NOT NULL), "
+		"title_length_sum = (SELECT COALESCE(sum(title_length), 0) FROM pages), "
+		"body_length_sum = (SELECT COALESCE(sum(body_length), 0) FROM pages), "
+		"text_stats_ready = TRUE, epoch = epoch + 1, updated_at = CURRENT_TIMESTAMP RETURNING doc_count;");
+	if(stats.size() != 0)
+		std::cout << "Text statistics of " << stats[0]["doc_count"].as<int64_t>() << " documents computed" << std::endl;
+}
+
+// Stop maintaining the BM25 statistics. The server falls back to ts_rank_cd until they are enabled again
+Task<> disableTextStats()
+{
+	auto db = app().getDbClient();
+	auto t = co_await db->newTransactionCoro();
+	co_await t->execSqlCoro("DROP TRIGGER IF EXISTS tlgs_track_text_stats ON public.pages;");
+	co_await t->execSqlCoro("UPDATE index_state SET text_stats_ready = FALSE;");
+	co_await t->execSqlCoro("DELETE FROM term_stat_deltas;");
+	co_await t->execSqlCoro("DELETE FROM corpus_stat_deltas;");
+	std::cout << "Text statistics disabled" << std::endl;
+}
+
 Task<> createDb()
 {
 	auto db = app().getDbClient();
@@ -28,17 +212,28 @@ Task<> createDb()
 			last_meta text,
 			first_seen_at timestamp without time zone NOT NULL,
 			search_vector tsvector,
-			cross_site_links json,
-			internal_links json,
+			cross_site_links text[],
+			internal_links text[],
 			title_vector tsvector,
 			last_queued_at timestamp without time zone,
 			indexed_content_hash text NOT NULL default '',
 			raw_content_hash text NOT NULL default '',
+			truncated boolean NOT NULL default false,
+			title_length integer NOT NULL default 0,
+			body_length integer NOT NULL default 0,
 			PRIMARY KEY (url)
 		);
 	)");
+	co_await db->execSqlCoro("ALTER TABLE pages ADD COLUMN IF NOT EXISTS truncated boolean NOT NULL default false;");
+	co_await db->execSqlCoro("ALTER TABLE pages ADD COLUMN IF NOT EXISTS title_length integer NOT NULL default 0;");
+	co_await db->execSqlCoro("ALTER TABLE pages ADD COLUMN IF NOT EXISTS body_length integer NOT NULL default 0;");
 	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS last_crawled_index ON public.pages USING btree (last_crawled_at DESC);");
 	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS search_vector_index ON public.pages USING gin (search_vector);");
+	// Serve search filters pushed into the root set query
+	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS domain_name_index ON public.pages USING btree (domain_name);");
+	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS content_type_pattern_index ON public.pages USING btree (content_type text_pattern_ops);");
+	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS size_index ON public.pages USING btree (size);");
+	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS title_vector_index ON public.pages USING gin (title_vector);");
 
 	co_await db->execSqlCoro(R"(
 		CREATE TABLE IF NOT EXISTS public.links (
@@ -52,8 +247,8 @@ Task<> createDb()
 		);
 	)");
 	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS is_cross_site_index ON public.links USING btree (is_cross_site);");
-	co_await db->execSqlCoro("CREATE INDEX source_url_index ON public.links USING btree (url);");
-	co_await db->execSqlCoro("CREATE INDEX to_url_index ON public.links USING btree (to_url);");
+	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS source_url_index ON public.links USING btree (url);");
+	co_await db->execSqlCoro("CREATE INDEX IF NOT EXISTS to_url_index ON public.links USING btree (to_url);");
 
 	co_await db->execSqlCoro(R"(
 		CREATE TABLE IF NOT EXISTS public.robot_policies (
@@ -81,6 +276,67 @@ Task<> createDb()
 			PRIMARY KEY (from_url)
 		);
 	)");
+
+	co_await db->execSqlCoro(R"(
+		CREATE TABLE IF NOT EXISTS public.hosts (
+			host text NOT NULL,
+			port integer NOT NULL,
+			consecutive_failures integer NOT NULL DEFAULT 0,
+			next_retry_at timestamp without time zone,
+			last_success_at timestamp without time zone,
+			last_failure_at timestamp without time zone,
+			PRIMARY KEY (host, port)
+		);
+	)");
+
+	co_await db->execSqlCoro(R"(
+		CREATE TABLE IF NOT EXISTS public.query_log (
+			query text NOT NULL,
+			count bigint NOT NULL DEFAULT 0,
+			last_searched_at timestamp without time zone NOT NULL,
+			PRIMARY KEY (query)
+		);
+	)");
+
+	// Bumped by the crawler whenever the index changes. Servers cache results until it does
+	co_await db->execSqlCoro(R"(
+		CREATE TABLE IF NOT EXISTS public.index_state (
+			id integer NOT NULL DEFAULT 1 CHECK (id = 1),
+			epoch bigint NOT NULL DEFAULT 0,
+			updated_at timestamp without time zone NOT NULL DEFAULT CURRENT_TIMESTAMP,
+			PRIMARY KEY (id)
+		);
+	)");
+	co_await db->execSqlCoro("INSERT INTO index_state (id) VALUES (1) ON CONFLICT DO NOTHING;");
+
+	// Corpus statistics for BM25. Maintained by the tlgs_track_text_stats trigger and the crawler once enabled
+	co_await db->execSqlCoro("ALTER TABLE index_state ADD COLUMN IF NOT EXISTS doc_count bigint NOT NULL DEFAULT 0;");
+	co_await db->execSqlCoro("ALTER TABLE index_state ADD COLUMN IF NOT EXISTS title_length_sum bigint NOT NULL DEFAULT 0;");
+	co_await db->execSqlCoro("ALTER TABLE index_state ADD COLUMN IF NOT EXISTS body_length_sum bigint NOT NULL DEFAULT 0;");
+	co_await db->execSqlCoro("ALTER TABLE index_state ADD COLUMN IF NOT EXISTS text_stats_ready boolean NOT NULL DEFAULT false;");
+	co_await db->execSqlCoro(R"(
+		CREATE TABLE IF NOT EXISTS public.term_stats (
+			term text NOT NULL,
+			doc_freq bigint NOT NULL,
+			PRIMARY KEY (term)
+		);
+	)");
+	co_await db->execSqlCoro(R"(
+		CREATE TABLE IF NOT EXISTS public.term_stat_deltas (
+			term text NOT NULL,
+			delta integer NOT NULL
+		);
+	)");
+	co_await db->execSqlCoro(R"(
+		CREATE TABLE IF NOT EXISTS public.corpus_stat_deltas (
+			docs integer NOT NULL,
+			title_length bigint NOT NULL,
+			body_length bigint NOT NULL
+		);
+	)");
+
+	co_await migrateLinkColumns();
+	co_await createFunctions();
 	app().quit();
 }
 
@@ -107,6 +363,156 @@ Task<> indexStatus()
 	app().quit();
 }
 
+// Add pages indexed since the last build to the search index in `dir` as new segments. Segments are merged into
+// one when there are too many or on a full rebuild. Which also drops pages replaced by newer versions
+Task<> buildIndex(std::string dir, bool full)
+{
+	constexpr size_t pages_per_batch = 5000;
+	constexpr size_t pages_per_segment = 200000;
+	constexpr size_t max_segments = 8;
+
+	std::filesystem::create_directories(dir);
+	auto manifest = tlgs::IndexManifest::load(dir);
+	if(full)
+		manifest.segments.clear();
+	auto db = app().getDbClient();
+	auto now = co_await db->execSqlCoro("SELECT CURRENT_TIMESTAMP::timestamp::text AS now;");
+	// Only pages indexed since the last build. Or everything. last_indexed_at is when the crawler's transaction
+	// started. So a page committed after the last build read the time may carry an earlier timestamp. The scan looks
+	// back 10 minutes further to catch those. Pages added twice are harmless, the copy in the later segment replaces
+	// the earlier one
+	const std::string since = manifest.segments.empty() ? "-infinity" : manifest.built_at;
+	std::string last_url;
+	size_t pages = 0;
+	tlgs::SegmentBuilder builder;
+	auto flush = [&]() {
+		if(builder.docCount() == 0)
+			return;
+		auto name = manifest.newSegmentName();
+		builder.write((std::filesystem::path(dir) / name).string());
+		manifest.segments.push_back(name);
+		builder = tlgs::SegmentBuilder();
+	};
+	auto terms = [](const orm::Row& row, const std::string& column) {
+		auto lexemes = tlgs::parsePgArray(row[column + "_terms"].as<std::string_view>());
+		auto freqs = tlgs::parsePgArray(row[column + "_freqs"].as<std::string_view>());
+		std::vector<std::pair<std::string, uint32_t>> result;
+		result.reserve(lexemes.size());
+		for(size_t i=0;i<std::min(lexemes.size(), freqs.size());i++)
+			result.emplace_back(std::move(lexemes[i]), tlgs::try_strtoull(freqs[i]).value_or(1));
+		return result;
+	};
+
+	while(true) {
+		// unnest() lists lexemes in the same order as tsvector_to_array()
+		// Lengths are computed here. The columns are only kept up to date while the BM25 statistics are enabled
+		auto rows = co_await db->execSqlCoro("SELECT url, tlgs_vector_length(title_vector) AS title_length, "
+			"tlgs_vector_length(search_vector) AS body_length, "
+			"COALESCE(tsvector_to_array(title_vector), '{}') AS title_terms, "
+			"ARRAY(SELECT COALESCE(array_length(v.positions, 1), 1) FROM unnest(title_vector) AS v) AS title_freqs, "
+			"COALESCE(tsvector_to_array(search_vector), '{}') AS body_terms, "
+			"ARRAY(SELECT COALESCE(array_length(v.positions, 1), 1) FROM unnest(search_vector) AS v) AS body_freqs "
+			"FROM pages WHERE search_vector IS NOT NULL AND url > $1 AND last_indexed_at >= $2::timestamp - INTERVAL '10 minutes' "
+			"ORDER BY url LIMIT $3;", last_url, since, pages_per_batch);
+		for(const auto& row : rows) {
+			tlgs::SegmentBuilder::Document doc;
+			doc.url = row["url"].as<std::string>();
+			doc.lengths[size_t(tlgs::IndexField::Title)] = row["title_length"].as<int>();
+			doc.lengths[size_t(tlgs::IndexField::Body)] = row["body_length"].as<int>();
+			doc.terms[size_t(tlgs::IndexField::Title)] = terms(row, "title");
+			doc.terms[size_t(tlgs::IndexField::Body)] = terms(row, "body");
+			builder.add(doc);
+			if(builder.docCount() == pages_per_segment)
+				flush();
+		}
+		pages += rows.size();
+		if(rows.size() < pages_per_batch)
+			break;
+		last_url = rows[rows.size()-1]["url"].as<std::string>();
+		std::cout << "\r" << pages << " pages indexed" << std::flush;
+	}
+	flush();
+	std::cout << "\r" << pages << " pages indexed" << std::endl;
+
+	if(manifest.segments.size() > max_segments || (full && manifest.segments.size() > 1)) {
+		std::cout << "Merging " << manifest.segments.size() << " segments" << std::endl;
+		std::vector<std::shared_ptr<const tlgs::Segment>> segments;
+		for(const auto& name : manifest.segments)
+			segments.push_back(tlgs::Segment::open((std::filesystem::path(dir) / name).string()));
+		auto name = manifest.newSegmentName();
+		tlgs::SearchIndex(std::move(segments)).merge((std::filesystem::path(dir) / name).string());
+		manifest.segments = {name};
+	}
+	manifest.built_at = now[0]["now"].as<std::string>();
+	manifest.save(dir);
+
+	// Servers keep segments they have mapped until they reload. Removing the files doesn't affect them
+	for(const auto& entry : std::filesystem::directory_iterator(dir)) {
+		auto name = entry.path().filename().string();
+		if(name.ends_with(".idx") && std::find(manifest.segments.begin(), manifest.segments.end(), name) == manifest.segments.end())
+			std::filesystem::remove(entry.path());
+	}
+	std::cout << "Index has " << manifest.segments.size() << " segments" << std::endl;
+	app().quit();
+}
+
+// Time finding the 50000 best matches of each query. With ts_rank_cd in the DB versus BM25 in C++ as the server
+// does it. Only the scoring part. Fetching the details of the root set costs the same for both
+Task<> benchmarkTextScoring(std::vector<std::string> queries, size_t runs)
+{
+	using clock = std::chrono::steady_clock;
+	auto ms = [](clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	auto db = app().getDbClient();
+	for(const auto& query : queries) {
+		double ts_rank_time = 0;
+		double bm25_sql_time = 0;
+		double bm25_scoring_time = 0;
+		size_t matches_count = 0;
+		for(size_t run=0;run<runs;run++) {
+			auto start = clock::now();
+			co_await db->execSqlCoro("SELECT url, ts_rank_cd(pages.title_vector, plainto_tsquery($1))*50"
+				"+ts_rank_cd(pages.search_vector, plainto_tsquery($1)) AS rank FROM pages "
+				"WHERE pages.search_vector @@ plainto_tsquery($1) ORDER BY rank DESC LIMIT 50000;", query);
+			auto ts_rank_end = clock::now();
+
+			auto terms = co_await db->execSqlCoro(tlgs::bm25TermStatsSql() + ";", query);
+			if(terms.size() == 0)
+				break;
+			tlgs::PgArrayBuilder term_array;
+			std::vector<float> idf;
+			const uint64_t doc_count = terms[0]["doc_count"].as<int64_t>();
+			const double docs = std::max<uint64_t>(doc_count, 1);
+			for(const auto& term : terms) {
+				term_array.append(term["term"].as<std::string_view>());
+				idf.push_back(tlgs::bm25Idf(doc_count, term["doc_freq"].as<int64_t>()));
+			}
+			auto matches = co_await db->execSqlCoro(tlgs::bm25MatchesSql() + ";", query, term_array.str());
+			auto bm25_sql_end = clock::now();
+
+			const tlgs::Bm25Scorer title_scorer(idf, terms[0]["title_length_sum"].as<int64_t>() / docs);
+			const tlgs::Bm25Scorer body_scorer(idf, terms[0]["body_length_sum"].as<int64_t>() / docs);
+			tlgs::Bm25Matches scored(idf.size(), matches.size());
+			for(const auto& row : matches) {
+				scored.add(row["title_tf"].as<std::string_view>(), row["body_tf"].as<std::string_view>(),
+					row["title_length"].as<int>(), row["body_length"].as<int>());
+			}
+			auto score = scored.score(title_scorer, body_scorer);
+			auto top = tlgs::topScores(score, 50000);
+			auto bm25_end = clock::now();
+
+			ts_rank_time += ms(ts_rank_end - start);
+			bm25_sql_time += ms(bm25_sql_end - ts_rank_end);
+			bm25_scoring_time += ms(bm25_end - bm25_sql_end);
+			matches_count = matches.size();
+		}
+		std::cout << "`" << query << "`: " << matches_count << " matches\n"
+			<< "  ts_rank_cd: " << ts_rank_time / runs << "ms\n"
+			<< "  BM25:       " << (bm25_sql_time + bm25_scoring_time) / runs << "ms ("
+			<< bm25_sql_time / runs << "ms SQL, " << bm25_scoring_time / runs << "ms scoring)" << std::endl;
+	}
+	app().quit();
+}
+
 int main(int argc, char** argv)
 {
 	std::string config_file = "/etc/tlgs/config.json";
@@ -120,6 +526,21 @@ int main(int argc, char** argv)
 
 	CLI::App& index_status = *cli.add_subcommand("indexstatus", "Show status of the index");
 
+	CLI::App& rebuild_text_stats = *cli.add_subcommand("rebuild_text_stats", "Enable the BM25 text statistics and recompute them");
+	CLI::App& disable_text_stats = *cli.add_subcommand("disable_text_stats", "Stop maintaining the BM25 text statistics");
+
+	CLI::App& build_index = *cli.add_subcommand("build_index", "Build or update the search index");
+	std::string index_dir = "/var/lib/tlgs/index";
+	bool full_rebuild = false;
+	build_index.add_option("index_dir", index_dir, "Directory of the index");
+	build_index.add_flag("--full", full_rebuild, "Rebuild the index from scratch");
+
+	CLI::App& benchmark_scoring = *cli.add_subcommand("benchmark_scoring", "Compare ts_rank_cd and BM25 scoring latency");
+	std::vector<std::string> benchmark_queries = {"gemini", "capsule", "linux", "gemini protocol"};
+	size_t benchmark_runs = 5;
+	benchmark_scoring.add_option("queries", benchmark_queries, "Queries to search");
+	benchmark_scoring.add_option("-r,--runs", benchmark_runs, "Runs per query");
+
 	cli.add_option("config_file", config_file, "Path to TLGS config file");
 	CLI11_PARSE(cli, argc, argv);
 
@@ -134,6 +555,24 @@ int main(int argc, char** argv)
 	else if(index_status) {
 		app().getLoop()->queueInLoop(async_func(indexStatus));
 	}
+	else if(rebuild_text_stats) {
+		app().getLoop()->queueInLoop(async_func([]() -> Task<> {
+			co_await enableTextStats();
+			app().quit();
+		}));
+	}
+	else if(disable_text_stats) {
+		app().getLoop()->queueInLoop(async_func([]() -> Task<> {
+			co_await disableTextStats();
+			app().quit();
+		}));
+	}
+	else if(build_index) {
+		app().getLoop()->queueInLoop(async_func(std::bind(buildIndex, index_dir, full_rebuild)));
+	}
+	else if(benchmark_scoring) {
+		app().getLoop()->queueInLoop(async_func(std::bind(benchmarkTextScoring, benchmark_queries, std::max<size_t>(benchmark_runs, 1))));
+	}
 	else {
 		std::cout << cli.help();
 		return 0;
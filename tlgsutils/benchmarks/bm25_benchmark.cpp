@@ -0,0 +1,65 @@
+#include <tlgsutils/bm25.hpp>
+#include <benchmark/benchmark.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Scoring every match of a common two term query. Which is what the server does before picking the root set
+static void BM_Bm25ScoreBatch(benchmark::State& state)
+{
+    const size_t num_docs = state.range(0);
+    const size_t num_terms = 2;
+    std::mt19937 rng(num_docs);
+    std::geometric_distribution<uint32_t> tf_dist(0.3);
+    std::lognormal_distribution<double> length_dist(6, 1);
+    std::vector<uint32_t> term_freqs(num_docs * num_terms);
+    std::vector<uint32_t> lengths(num_docs);
+    for(auto& tf : term_freqs)
+        tf = tf_dist(rng) + 1;
+    for(auto& length : lengths)
+        length = uint32_t(length_dist(rng)) + 1;
+
+    const std::vector<float> idf = {tlgs::bm25Idf(500000, 80000), tlgs::bm25Idf(500000, 3000)};
+    tlgs::Bm25Scorer scorer(idf, 600);
+    std::vector<float> scores(num_docs);
+    for(auto _ : state) {
+        scorer.scoreBatch(term_freqs, lengths, scores);
+        benchmark::DoNotOptimize(scores.data());
+    }
+    state.SetItemsProcessed(state.iterations() * num_docs);
+}
+
+BENCHMARK(BM_Bm25ScoreBatch)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+
+// Everything the server does with the matches of a two term query after fetching them. Parsing the term
+// frequency arrays, scoring title and body and picking the root set
+static void BM_Bm25Matches(benchmark::State& state)
+{
+    const size_t num_docs = state.range(0);
+    std::mt19937 rng(num_docs);
+    std::geometric_distribution<uint32_t> tf_dist(0.3);
+    std::lognormal_distribution<double> length_dist(6, 1);
+    std::vector<std::string> title_tf(num_docs);
+    std::vector<std::string> body_tf(num_docs);
+    std::vector<uint32_t> lengths(num_docs);
+    for(size_t i=0;i<num_docs;i++) {
+        title_tf[i] = "{" + std::to_string(tf_dist(rng) % 2) + ",0}";
+        body_tf[i] = "{" + std::to_string(tf_dist(rng) + 1) + "," + std::to_string(tf_dist(rng)) + "}";
+        lengths[i] = uint32_t(length_dist(rng)) + 1;
+    }
+
+    const std::vector<float> idf = {tlgs::bm25Idf(500000, 80000), tlgs::bm25Idf(500000, 3000)};
+    const tlgs::Bm25Scorer title_scorer(idf, 6);
+    const tlgs::Bm25Scorer body_scorer(idf, 600);
+    for(auto _ : state) {
+        tlgs::Bm25Matches matches(idf.size(), num_docs);
+        for(size_t i=0;i<num_docs;i++)
+            matches.add(title_tf[i], body_tf[i], 6, lengths[i]);
+        auto scores = matches.score(title_scorer, body_scorer);
+        auto top = tlgs::topScores(scores, 50000);
+        benchmark::DoNotOptimize(top.data());
+    }
+    state.SetItemsProcessed(state.iterations() * num_docs);
+}
+
+BENCHMARK(BM_Bm25Matches)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,108 @@
+#include <tlgsutils/gemini_parser.hpp>
+#include <tlgsutils/utils.hpp>
+#include <benchmark/benchmark.h>
+#include <malloc.h>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+
+// Heap bytes allocated through operator new. Counted for the whole benchmark binary. Peak RSS would be the peak of
+// whichever benchmark ran before
+static std::atomic<size_t> heap_in_use{0};
+static std::atomic<size_t> heap_peak{0};
+
+void* operator new(size_t size)
+{
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr)
+        throw std::bad_alloc();
+    const size_t allocated = malloc_usable_size(ptr);
+    const size_t in_use = heap_in_use.fetch_add(allocated, std::memory_order_relaxed) + allocated;
+    size_t peak = heap_peak.load(std::memory_order_relaxed);
+    while(in_use > peak && !heap_peak.compare_exchange_weak(peak, in_use, std::memory_order_relaxed));
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if(ptr == nullptr)
+        return;
+    heap_in_use.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+// Gemtext page with a mix of headings, paragraphs and links. Like a large capsule index or a book mirror
+static std::string makeGemtext(size_t size)
+{
+    std::mt19937 rng(size);
+    std::string doc = "# A very long page\n";
+    doc.reserve(size + 256);
+    size_t line = 0;
+    while(doc.size() < size) {
+        switch(rng() % 8) {
+        case 0:
+            doc += "=> gemini://example.com/posts/" + std::to_string(line) + ".gmi 2022-01-01 Post number " + std::to_string(line) + "\n";
+            break;
+        case 1:
+            doc += "## Section " + std::to_string(line) + "\n";
+            break;
+        default:
+            doc += "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore "
+                "et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris.\n";
+        }
+        line++;
+    }
+    return doc;
+}
+
+// Built once and shared by all threads. So nothing but processing allocates once the threads run
+static const std::string& sharedGemtext(size_t size)
+{
+    static const std::map<size_t, std::string> docs = {
+        {64*1024, makeGemtext(64*1024)},
+        {0x2625a0, makeGemtext(0x2625a0)}
+    };
+    return docs.at(size);
+}
+
+// What the crawler does to every gemtext page it indexes. With 64 threads it's like `tlgs_crawler -c 64` processing
+// a page on every connection at once
+static void BM_ProcessGemtext(benchmark::State& state)
+{
+    const auto& doc = sharedGemtext(state.range(0));
+    // Threads wait for each other at the start of the loop. Thread 0 is done resetting by the time any of them runs
+    const size_t baseline = heap_in_use.load();
+    if(state.thread_index() == 0)
+        heap_peak = baseline;
+    for(auto _ : state) {
+        bool valid = tlgs::isValidUtf8(doc);
+        auto nodes = dremini::parseGemini(doc);
+        auto extracted = tlgs::extractGeminiConcise(nodes);
+        benchmark::DoNotOptimize(valid);
+        benchmark::DoNotOptimize(extracted.text.data());
+    }
+    state.SetBytesProcessed(state.iterations() * doc.size());
+    // And done processing once the loop ends in thread 0
+    if(state.thread_index() == 0)
+        state.counters["peak_heap_MiB"] = (heap_peak.load() - baseline) / (1024.0 * 1024.0);
+}
+
+static void BM_IsValidUtf8(benchmark::State& state)
+{
+    const auto doc = makeGemtext(state.range(0));
+    for(auto _ : state)
+        benchmark::DoNotOptimize(tlgs::isValidUtf8(doc));
+    state.SetBytesProcessed(state.iterations() * doc.size());
+}
+
+BENCHMARK(BM_ProcessGemtext)->Arg(64*1024)->Arg(0x2625a0)->Threads(1)->Threads(64)->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IsValidUtf8)->Arg(64*1024)->Arg(0x2625a0)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,57 @@
+#include <tlgsutils/ranking.hpp>
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <random>
+
+// Synthetic web-like graph. Link targets are skewed so a few pages receive most of the links, like popular
+// capsules do
+static tlgs::LinkGraph makeGraph(size_t node_count, size_t avg_degree)
+{
+    std::mt19937 rng(node_count);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<std::pair<tlgs::NodeIndex, tlgs::NodeIndex>> edges;
+    edges.reserve(node_count * avg_degree);
+    for(size_t i=0;i<node_count*avg_degree;i++) {
+        auto src = tlgs::NodeIndex(rng() % node_count);
+        auto dst = tlgs::NodeIndex(node_count * std::pow(uniform(rng), 3));
+        if(src != dst)
+            edges.emplace_back(src, dst);
+    }
+    return tlgs::LinkGraph::fromEdges(node_count, edges);
+}
+
+static void BM_SalsaRank(benchmark::State& state)
+{
+    auto graph = makeGraph(state.range(0), 8);
+    tlgs::RankingWorkspace workspace;
+    for(auto _ : state)
+        benchmark::DoNotOptimize(tlgs::salsaRank(graph, workspace).data());
+    state.SetItemsProcessed(state.iterations() * graph.out.edgeCount());
+}
+
+static void BM_HitsRank(benchmark::State& state)
+{
+    auto graph = makeGraph(state.range(0), 8);
+    tlgs::RankingWorkspace workspace;
+    for(auto _ : state)
+        benchmark::DoNotOptimize(tlgs::hitsRank(graph, workspace).data());
+    state.SetItemsProcessed(state.iterations() * graph.out.edgeCount());
+}
+
+static void BM_GraphConstruction(benchmark::State& state)
+{
+    const size_t node_count = state.range(0);
+    std::mt19937 rng(node_count);
+    std::vector<std::pair<tlgs::NodeIndex, tlgs::NodeIndex>> edges(node_count * 8);
+    for(auto& [src, dst] : edges) {
+        src = rng() % node_count;
+        dst = rng() % node_count;
+    }
+    for(auto _ : state)
+        benchmark::DoNotOptimize(tlgs::LinkGraph::fromEdges(node_count, edges).out.offsets.data());
+    state.SetItemsProcessed(state.iterations() * edges.size());
+}
+
+BENCHMARK(BM_SalsaRank)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_HitsRank)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GraphConstruction)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,118 @@
+#include "bloom_filter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <xxhash.h>
+
+static constexpr char bloom_file_magic[8] = {'T', 'L', 'G', 'S', 'B', 'L', 'M', '1'};
+
+tlgs::BloomFilter::BloomFilter(size_t expected_items, double false_positive_rate, uint64_t seed)
+    : seed_(seed), created_at_(std::time(nullptr))
+{
+    if(false_positive_rate <= 0 || false_positive_rate >= 1)
+        throw std::invalid_argument("False positive rate must be between 0 and 1");
+    const double n = std::max<size_t>(expected_items, 1);
+    const double ln2 = std::log(2.0);
+    const double bits = std::ceil(-n * std::log(false_positive_rate) / (ln2 * ln2));
+    bit_count_ = std::max<size_t>(64, static_cast<size_t>(bits));
+    hash_count_ = std::max<uint32_t>(1, static_cast<uint32_t>(std::round(bits / n * ln2)));
+    words_.resize((bit_count_ + 63) / 64);
+}
+
+// Double hashing. The two halves of a 128 bit hash generate all the probe positions
+template <typename Func>
+static void forEachBit(std::string_view item, uint64_t seed, size_t bit_count, uint32_t hash_count, Func&& func)
+{
+    auto hash = XXH3_128bits_withSeed(item.data(), item.size(), seed);
+    uint64_t h1 = hash.low64;
+    // Odd so every probe is different even when bit_count is a power of 2
+    uint64_t h2 = hash.high64 | 1;
+    for(uint32_t i=0;i<hash_count;i++) {
+        if(!func((h1 + i * h2) % bit_count))
+            return;
+    }
+}
+
+void tlgs::BloomFilter::add(std::string_view item)
+{
+    forEachBit(item, seed_, bit_count_, hash_count_, [this](size_t bit) {
+        std::atomic_ref<uint64_t> word(words_[bit / 64]);
+        word.fetch_or(uint64_t{1} << (bit % 64), std::memory_order_relaxed);
+        return true;
+    });
+}
+
+bool tlgs::BloomFilter::mayContain(std::string_view item) const
+{
+    bool found = true;
+    forEachBit(item, seed_, bit_count_, hash_count_, [this, &found](size_t bit) {
+        std::atomic_ref<const uint64_t> word(words_[bit / 64]);
+        found = (word.load(std::memory_order_relaxed) >> (bit % 64)) & 1;
+        return found;
+    });
+    return found;
+}
+
+void tlgs::BloomFilter::save(const std::string& path) const
+{
+    // Write to a temporary file first. So other processes never see a half written filter. One per writer, or
+    // concurrent saves write into the same file and one of them moves a mix of both in place
+    static std::atomic<uint64_t> saves = 0;
+    const std::string tmp_path = path + "." + std::to_string(getpid()) + "." + std::to_string(saves++) + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if(!out)
+        throw std::runtime_error("Cannot open " + tmp_path + " for writing");
+    const uint64_t bit_count = bit_count_;
+    const uint64_t created_at = created_at_;
+    out.write(bloom_file_magic, sizeof(bloom_file_magic));
+    out.write(reinterpret_cast<const char*>(&bit_count), sizeof(bit_count));
+    out.write(reinterpret_cast<const char*>(&hash_count_), sizeof(hash_count_));
+    out.write(reinterpret_cast<const char*>(&seed_), sizeof(seed_));
+    out.write(reinterpret_cast<const char*>(&created_at), sizeof(created_at));
+    out.write(reinterpret_cast<const char*>(words_.data()), words_.size() * sizeof(uint64_t));
+    out.close();
+    if(!out) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Failed to write " + tmp_path);
+    }
+    if(std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Failed to move " + tmp_path + " to " + path);
+    }
+}
+
+tlgs::BloomFilter tlgs::BloomFilter::load(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        throw std::runtime_error("Cannot open " + path);
+
+    char magic[sizeof(bloom_file_magic)];
+    uint64_t bit_count = 0;
+    uint64_t created_at = 0;
+    BloomFilter filter;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&bit_count), sizeof(bit_count));
+    in.read(reinterpret_cast<char*>(&filter.hash_count_), sizeof(filter.hash_count_));
+    in.read(reinterpret_cast<char*>(&filter.seed_), sizeof(filter.seed_));
+    in.read(reinterpret_cast<char*>(&created_at), sizeof(created_at));
+    if(!in || std::memcmp(magic, bloom_file_magic, sizeof(magic)) != 0)
+        throw std::runtime_error(path + " is not a Bloom filter");
+    if(bit_count == 0 || filter.hash_count_ == 0)
+        throw std::runtime_error(path + " has a malformed header");
+
+    filter.bit_count_ = bit_count;
+    filter.created_at_ = created_at;
+    filter.words_.resize((bit_count + 63) / 64);
+    in.read(reinterpret_cast<char*>(filter.words_.data()), filter.words_.size() * sizeof(uint64_t));
+    if(!in)
+        throw std::runtime_error(path + " is truncated");
+    return filter;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tlgs
+{
+
+/**
+ * @brief A Bloom filter of strings. Never gives false negatives. False positives happen at about the rate it is
+ * created with as long as no more than the expected number of items are added. Adding and querying are lock free
+ * and can happen from multiple threads at the same time.
+ */
+class BloomFilter
+{
+public:
+    /**
+     * @param expected_items how many items will be added
+     * @param false_positive_rate target false positive rate when expected_items are added
+     * @param seed hash seed. Filters with different seeds are not compatible
+     */
+    BloomFilter(size_t expected_items, double false_positive_rate, uint64_t seed = 0);
+
+    void add(std::string_view item);
+    bool mayContain(std::string_view item) const;
+
+    size_t bitCount() const
+    {
+        return bit_count_;
+    }
+
+    size_t hashCount() const
+    {
+        return hash_count_;
+    }
+
+    uint64_t seed() const
+    {
+        return seed_;
+    }
+
+    /**
+     * @brief When the filter was created. Kept across save() and load()
+     */
+    std::time_t createdAt() const
+    {
+        return created_at_;
+    }
+
+    /**
+     * @brief Save the filter to a file. Throws std::runtime_error on failure
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Load a filter written by save(). Throws std::runtime_error if the file can't be read or is malformed
+     */
+    static BloomFilter load(const std::string& path);
+
+protected:
+    BloomFilter() = default;
+
+    std::vector<uint64_t> words_;
+    size_t bit_count_ = 0;
+    uint32_t hash_count_ = 0;
+    uint64_t seed_ = 0;
+    std::time_t created_at_ = 0;
+};
+
+}
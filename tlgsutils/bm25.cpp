@@ -0,0 +1,140 @@
+#include "bm25.hpp"
+#include "pg_array.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+float tlgs::bm25Idf(uint64_t doc_count, uint64_t doc_freq)
+{
+    // Statistics are updated lazily. A term may briefly appear in more documents than we know of
+    const double n = std::max(doc_count, doc_freq);
+    return std::log(1.0 + (n - doc_freq + 0.5) / (doc_freq + 0.5));
+}
+
+tlgs::Bm25Scorer::Bm25Scorer(std::span<const float> idf, float avg_doc_length, Bm25Params params)
+{
+    weights_.reserve(idf.size());
+    for(auto value : idf)
+        weights_.push_back(value * (params.k1 + 1));
+    if(avg_doc_length > 0) {
+        norm_base_ = params.k1 * (1 - params.b);
+        norm_per_length_ = params.k1 * params.b / avg_doc_length;
+    }
+    else {
+        // An empty corpus has no meaningful average. Don't normalize then
+        norm_base_ = params.k1;
+        norm_per_length_ = 0;
+    }
+}
+
+float tlgs::Bm25Scorer::score(std::span<const uint32_t> term_freqs, uint32_t doc_length) const
+{
+    if(term_freqs.size() != weights_.size())
+        throw std::invalid_argument("Term frequencies don't match the number of query terms");
+    const float norm = norm_base_ + doc_length * norm_per_length_;
+    float score = 0;
+    for(size_t i=0;i<weights_.size();i++) {
+        const float tf = term_freqs[i];
+        score += weights_[i] * tf / (tf + norm);
+    }
+    return score;
+}
+
+void tlgs::Bm25Scorer::scoreBatch(std::span<const uint32_t> term_freqs, std::span<const uint32_t> doc_lengths,
+    std::span<float> scores) const
+{
+    const size_t num_terms = weights_.size();
+    if(term_freqs.size() != doc_lengths.size() * num_terms || scores.size() < doc_lengths.size())
+        throw std::invalid_argument("Term frequencies don't match the number of documents");
+    for(size_t doc=0;doc<doc_lengths.size();doc++) {
+        const float norm = norm_base_ + doc_lengths[doc] * norm_per_length_;
+        const uint32_t* tfs = term_freqs.data() + doc * num_terms;
+        float score = 0;
+        for(size_t i=0;i<num_terms;i++) {
+            const float tf = tfs[i];
+            score += weights_[i] * tf / (tf + norm);
+        }
+        scores[doc] = score;
+    }
+}
+
+std::string tlgs::bm25TermStatsSql()
+{
+    return "SELECT q.term, COALESCE(t.doc_freq, 0) AS doc_freq, s.doc_count, s.title_length_sum, s.body_length_sum, "
+        "s.text_stats_ready FROM unnest(tsvector_to_array(to_tsvector($1))) AS q(term) "
+        "LEFT JOIN term_stats t ON t.term = q.term CROSS JOIN index_state s";
+}
+
+// How often each term in $2 appears in a tsvector column. Filtering the vector down to the query terms first keeps
+// this cheap on long pages
+static std::string termFreqSql(std::string_view column)
+{
+    const std::string vector = "pages." + std::string(column);
+    return "ARRAY(SELECT COALESCE(array_length(v.positions, 1), 0) "
+        "FROM unnest($2::text[]) WITH ORDINALITY AS q(term, i) "
+        "LEFT JOIN unnest(ts_filter(setweight(" + vector + ", 'A', $2::text[]), '{a}')) AS v ON v.lexeme = q.term "
+        "ORDER BY q.i)";
+}
+
+std::string tlgs::bm25MatchesSql(std::string_view condition)
+{
+    return "SELECT url, title_length, body_length, " + termFreqSql("title_vector") + " AS title_tf, "
+        + termFreqSql("search_vector") + " AS body_tf FROM pages WHERE pages.search_vector @@ plainto_tsquery($1)"
+        + std::string(condition);
+}
+
+tlgs::Bm25Matches::Bm25Matches(size_t num_terms, size_t expected_matches)
+    : num_terms_(num_terms)
+{
+    title_tf_.reserve(expected_matches * num_terms);
+    body_tf_.reserve(expected_matches * num_terms);
+    title_length_.reserve(expected_matches);
+    body_length_.reserve(expected_matches);
+}
+
+static void appendTermFreqs(std::string_view literal, size_t num_terms, std::vector<uint32_t>& term_freqs)
+{
+    const size_t begin = term_freqs.size();
+    term_freqs.resize(begin + num_terms, 0);
+    auto values = tlgs::parsePgArray(literal);
+    for(size_t i=0;i<std::min(values.size(), num_terms);i++) {
+        const auto& value = values[i];
+        std::from_chars(value.data(), value.data() + value.size(), term_freqs[begin + i]);
+    }
+}
+
+void tlgs::Bm25Matches::add(std::string_view title_tf, std::string_view body_tf, uint32_t title_length,
+    uint32_t body_length)
+{
+    appendTermFreqs(title_tf, num_terms_, title_tf_);
+    appendTermFreqs(body_tf, num_terms_, body_tf_);
+    title_length_.push_back(title_length);
+    body_length_.push_back(body_length);
+}
+
+std::vector<float> tlgs::Bm25Matches::score(const Bm25Scorer& title, const Bm25Scorer& body, float title_weight) const
+{
+    std::vector<float> title_score(size());
+    std::vector<float> score(size());
+    title.scoreBatch(title_tf_, title_length_, title_score);
+    body.scoreBatch(body_tf_, body_length_, score);
+    for(size_t i=0;i<score.size();i++)
+        score[i] = std::max(score[i] + title_weight * title_score[i], std::numeric_limits<float>::min());
+    return score;
+}
+
+std::vector<uint32_t> tlgs::topScores(std::span<const float> scores, size_t limit)
+{
+    std::vector<uint32_t> order(scores.size());
+    std::iota(order.begin(), order.end(), 0);
+    const size_t top = std::min(order.size(), limit);
+    std::partial_sort(order.begin(), order.begin() + top, order.end(), [&scores](uint32_t a, uint32_t b) {
+        return scores[a] > scores[b];
+    });
+    order.resize(top);
+    return order;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tlgs
+{
+
+// Matches in the title are worth this many matches in the body
+constexpr float bm25_title_weight = 2.0f;
+
+struct Bm25Params
+{
+    // Term frequency saturation
+    float k1 = 1.2f;
+    // How much the document length normalizes the score. 0 disables it
+    float b = 0.75f;
+};
+
+/**
+ * @brief Inverse document frequency of a term. Uses the variant Lucene uses, which is never negative even for terms
+ * in most documents
+ *
+ * @param doc_count number of documents in the corpus
+ * @param doc_freq number of documents containing the term
+ */
+float bm25Idf(uint64_t doc_count, uint64_t doc_freq);
+
+/**
+ * @brief Scores documents of one field against a query with BM25. Multiple fields are scored by separate scorers
+ * and combined with weights.
+ *
+ * @begincode
+ *  tlgs::Bm25Scorer scorer(idf, avg_doc_length);
+ *  float score = scorer.score(term_freqs, doc_length);
+ * @endcode
+ */
+class Bm25Scorer
+{
+public:
+    /**
+     * @param idf IDF of each query term
+     * @param avg_doc_length average length of the field over the corpus
+     */
+    Bm25Scorer(std::span<const float> idf, float avg_doc_length, Bm25Params params = {});
+
+    /**
+     * @brief Score one document
+     *
+     * @param term_freqs how often each query term appears in the document. In the order of the IDFs
+     * @param doc_length length of the field in the document
+     */
+    float score(std::span<const uint32_t> term_freqs, uint32_t doc_length) const;
+
+    /**
+     * @brief Score many documents at once
+     *
+     * @param term_freqs term frequencies of all documents. The frequency of term j in document i is at
+     * term_freqs[i*termCount()+j]
+     * @param doc_lengths length of each document
+     * @param scores receives the score of each document. Must be as large as doc_lengths
+     */
+    void scoreBatch(std::span<const uint32_t> term_freqs, std::span<const uint32_t> doc_lengths,
+        std::span<float> scores) const;
+
+    /**
+     * @brief Score of a single query term. Grows with the frequency and shrinks with the length. So the largest
+     * frequency and shortest length among some documents give an upper bound of the term's score in them
+     */
+    float termScore(size_t term, uint32_t term_freq, uint32_t doc_length) const
+    {
+        const float norm = norm_base_ + doc_length * norm_per_length_;
+        const float tf = term_freq;
+        return weights_[term] * tf / (tf + norm);
+    }
+
+    size_t termCount() const
+    {
+        return weights_.size();
+    }
+
+protected:
+    // IDF * (k1+1). Constant over the documents
+    std::vector<float> weights_;
+    // Length normalization is k1*(1-b) + length*k1*b/avg_doc_length
+    float norm_base_;
+    float norm_per_length_;
+};
+
+/**
+ * @brief SQL looking up the terms of the query in $1 as PostgreSQL normalizes them. With their document frequency
+ * (`doc_freq`) and the corpus statistics (`doc_count`, `title_length_sum`, `body_length_sum`, `text_stats_ready`)
+ */
+std::string bm25TermStatsSql();
+
+/**
+ * @brief SQL finding the pages matching the query in $1. With how often each term in $2 (a text[] of the terms from
+ * bm25TermStatsSql()) appears in the title and body. As array literals in `title_tf` and `body_tf`, in the order of
+ * $2. Along with `url`, `title_length` and `body_length`
+ *
+ * @param condition appended to the WHERE clause. Ex: " AND pages.size < $3"
+ */
+std::string bm25MatchesSql(std::string_view condition = "");
+
+/**
+ * @brief Term frequencies and lengths of the rows of bm25MatchesSql(). Scored over the title and body
+ *
+ * @begincode
+ *  tlgs::Bm25Matches matches(idf.size());
+ *  for(const auto& row : result)
+ *      matches.add(row["title_tf"].as<std::string_view>(), ...);
+ *  auto scores = matches.score(title_scorer, body_scorer);
+ *  auto best = tlgs::topScores(scores, 1000);
+ * @endcode
+ */
+class Bm25Matches
+{
+public:
+    explicit Bm25Matches(size_t num_terms, size_t expected_matches = 0);
+
+    /**
+     * @param title_tf title term frequencies as a PostgreSQL array literal. Missing values count as 0
+     */
+    void add(std::string_view title_tf, std::string_view body_tf, uint32_t title_length, uint32_t body_length);
+
+    /**
+     * @brief Body score plus the title score weighted by `title_weight`. Always positive. So every match can be told
+     * apart from pages without a text score
+     */
+    std::vector<float> score(const Bm25Scorer& title, const Bm25Scorer& body, float title_weight = bm25_title_weight) const;
+
+    size_t size() const
+    {
+        return title_length_.size();
+    }
+
+protected:
+    size_t num_terms_;
+    std::vector<uint32_t> title_tf_;
+    std::vector<uint32_t> body_tf_;
+    std::vector<uint32_t> title_length_;
+    std::vector<uint32_t> body_length_;
+};
+
+/**
+ * @brief Indices of the `limit` highest scores. Highest first
+ */
+std::vector<uint32_t> topScores(std::span<const float> scores, size_t limit);
+
+}
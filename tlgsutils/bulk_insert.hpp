@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <drogon/orm/DbClient.h>
+#include <drogon/utils/coroutine.h>
+
+#include "pg_array.hpp"
+
+namespace tlgs
+{
+
+/**
+ * @brief Inserts many rows with a single statement. Each column is sent as one array parameter and expanded
+ * with unnest() on the server. So the statement stays small and values are never pasted into the SQL.
+ *
+ * @begincode
+ *  tlgs::BulkInsert<2> insert("robot_policies", {"host text", "disallowed text"});
+ *  insert.add("example.com", "/cgi-bin");
+ *  co_await insert.execute(db);
+ * @endcode
+ * @tparam N number of columns filled by each row
+ */
+template <size_t N>
+class BulkInsert
+{
+public:
+    /**
+     * @param table the table to insert into
+     * @param columns column names followed by their PostgreSQL type. ex: "port integer"
+     */
+    BulkInsert(std::string table, const std::array<std::string, N>& columns)
+        : table_(std::move(table))
+    {
+        for(size_t i=0;i<N;i++) {
+            auto space = columns[i].find(' ');
+            if(space == std::string::npos)
+                throw std::invalid_argument("Column must be specified as \"name type\": " + columns[i]);
+            names_[i] = columns[i].substr(0, space);
+            types_[i] = columns[i].substr(space + 1);
+        }
+    }
+
+    /**
+     * @brief Fill a column with the same SQL expression for every row. ex: CURRENT_TIMESTAMP
+     */
+    BulkInsert& withConstant(std::string column, std::string expression)
+    {
+        constants_.emplace_back(std::move(column), std::move(expression));
+        return *this;
+    }
+
+    /**
+     * @brief Text appended to the statement. ex: ON CONFLICT DO NOTHING
+     */
+    BulkInsert& withSuffix(std::string suffix)
+    {
+        suffix_ = std::move(suffix);
+        return *this;
+    }
+
+    template <typename... Args>
+    void add(const Args&... values)
+    {
+        static_assert(sizeof...(Args) == N, "Number of values must match number of columns");
+        size_t idx = 0;
+        (columns_[idx++].append(values), ...);
+        rows_++;
+    }
+
+    size_t size() const
+    {
+        return rows_;
+    }
+
+    bool empty() const
+    {
+        return rows_ == 0;
+    }
+
+    void clear()
+    {
+        for(auto& column : columns_)
+            column.clear();
+        rows_ = 0;
+    }
+
+    std::string sql() const
+    {
+        std::string targets;
+        std::string select;
+        std::string arrays;
+        std::string alias;
+        for(size_t i=0;i<N;i++) {
+            std::string sep = i == 0 ? "" : ", ";
+            targets += sep + names_[i];
+            select += sep + "t." + names_[i];
+            arrays += sep + "$" + std::to_string(i+1) + "::" + types_[i] + "[]";
+            alias += sep + names_[i];
+        }
+        for(const auto& [column, expression] : constants_) {
+            targets += ", " + column;
+            select += ", " + expression;
+        }
+        std::string sql = "INSERT INTO " + table_ + " (" + targets + ") SELECT " + select
+            + " FROM unnest(" + arrays + ") AS t(" + alias + ")";
+        if(!suffix_.empty())
+            sql += " " + suffix_;
+        return sql;
+    }
+
+    /**
+     * @brief Run the insert. Works with both DB clients and transactions
+     */
+    drogon::Task<drogon::orm::Result> execute(drogon::orm::DbClientPtr db) const
+    {
+        auto sql_str = sql();
+        co_return co_await [&]<size_t... I>(std::index_sequence<I...>) {
+            return db->execSqlCoro(sql_str, columns_[I].str()...);
+        }(std::make_index_sequence<N>{});
+    }
+
+protected:
+    std::string table_;
+    std::array<std::string, N> names_;
+    std::array<std::string, N> types_;
+    std::array<PgArrayBuilder, N> columns_;
+    std::vector<std::pair<std::string, std::string>> constants_;
+    std::string suffix_;
+    size_t rows_ = 0;
+};
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace tlgs
+{
+
+/**
+ * @brief Asks work running elsewhere to stop. Work polls cancelled() where it's convenient to stop. Or registers
+ * a callback interrupting what it's waiting on. Thread safe.
+ *
+ * @begincode
+ *  auto cancel = std::make_shared<tlgs::CancellationToken>();
+ *  auto registration = cancel->onCancel([pid]() { cancelBackend(pid); });
+ *  co_await db->execSqlCoro(...);
+ * @endcode
+ */
+class CancellationToken
+{
+    using Callbacks = std::list<std::function<void()>>;
+
+public:
+    /**
+     * @brief Keeps a callback registered. Unregisters it when destroyed. Once that returns the callback won't be
+     * called anymore. Must not outlive the token
+     */
+    class Registration
+    {
+    public:
+        Registration() = default;
+        Registration(CancellationToken* token, Callbacks::iterator it)
+            : token_(token), it_(it)
+        {
+        }
+
+        Registration(Registration&& other) noexcept
+            : token_(std::exchange(other.token_, nullptr)), it_(other.it_)
+        {
+        }
+
+        Registration& operator=(Registration&& other) noexcept
+        {
+            if(this != &other) {
+                reset();
+                token_ = std::exchange(other.token_, nullptr);
+                it_ = other.it_;
+            }
+            return *this;
+        }
+
+        ~Registration()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            if(token_ != nullptr)
+                token_->unregister(it_);
+            token_ = nullptr;
+        }
+
+    protected:
+        CancellationToken* token_ = nullptr;
+        Callbacks::iterator it_;
+    };
+
+    CancellationToken() = default;
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    bool cancelled() const
+    {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Cancel and run the registered callbacks on this thread. Only the first call does anything
+     */
+    void cancel()
+    {
+        std::unique_lock lock(mtx_);
+        if(cancelled_.exchange(true, std::memory_order_acq_rel))
+            return;
+        running_ = true;
+        running_thread_ = std::this_thread::get_id();
+        // Nothing is erased from the list once cancelled. So it's safe to walk without holding the lock
+        for(auto it = callbacks_.begin(); it != callbacks_.end(); ++it) {
+            auto callback = *it;
+            if(!callback)
+                continue;
+            lock.unlock();
+            callback();
+            lock.lock();
+        }
+        running_ = false;
+        callbacks_.clear();
+        done_.notify_all();
+    }
+
+    /**
+     * @brief Call `callback` when cancelled. Immediately if already cancelled. Keep the registration alive for as long
+     * as the callback may run
+     */
+    [[nodiscard]] Registration onCancel(std::function<void()> callback)
+    {
+        {
+            std::lock_guard lock(mtx_);
+            if(!cancelled_) {
+                callbacks_.push_back(std::move(callback));
+                return Registration(this, std::prev(callbacks_.end()));
+            }
+        }
+        callback();
+        return {};
+    }
+
+protected:
+    void unregister(Callbacks::iterator it)
+    {
+        std::unique_lock lock(mtx_);
+        if(!cancelled_)
+            callbacks_.erase(it);
+        else if(running_ && running_thread_ == std::this_thread::get_id())
+            // A callback unregistering another. The list is being walked, only disarm it
+            *it = nullptr;
+        else if(running_)
+            // Wait for the callback to finish. It may still be running
+            done_.wait(lock, [this]() { return !running_; });
+    }
+
+    std::atomic<bool> cancelled_ = false;
+    std::mutex mtx_;
+    std::condition_variable done_;
+    bool running_ = false;
+    std::thread::id running_thread_;
+    Callbacks callbacks_;
+};
+
+}
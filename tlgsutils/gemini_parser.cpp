@@ -8,6 +8,14 @@
 
 namespace tlgs
 {
+static size_t textSize(const std::vector<dremini::GeminiASTNode>& nodes)
+{
+    size_t size = 0;
+    for(const auto& node : nodes)
+        size += node.text.size() + 1;
+    return size;
+}
+
 GeminiDocument extractGemini(const std::string_view sv)
 {
     return extractGemini(dremini::parseGemini(sv));
@@ -16,9 +24,10 @@ GeminiDocument extractGemini(const std::string_view sv)
 GeminiDocument extractGemini(const std::vector<dremini::GeminiASTNode>& nodes)
 {
     GeminiDocument doc;
-    doc.text.reserve(1024);
+    doc.text.reserve(textSize(nodes));
     for(const auto& node : nodes) {
-        doc.text += node.text + "\n";
+        doc.text += node.text;
+        doc.text += '\n';
         if(node.type == "link")
             doc.links.push_back(node.meta);
         else if(node.type == "heading1" && doc.title.empty())
@@ -37,6 +46,8 @@ GeminiDocument extractGeminiConcise(const std::vector<dremini::GeminiASTNode>& n
 {
     // TODO: Optimize the function
     GeminiDocument doc;
+    // Upper bound. Avoids reallocating the text over and over on large documents
+    doc.text.reserve(textSize(nodes));
     bool first_content = true;
     for(const auto& node : nodes) {
         // Avoid indexing ASCII art. This may remove code blocks. But it shoudn't matter
@@ -87,7 +98,8 @@ GeminiDocument extractGeminiConcise(const std::vector<dremini::GeminiASTNode>& n
             if(node.text.find("│") < 3)
                 continue;
         }
-        doc.text += node.text + "\n";
+        doc.text += node.text;
+        doc.text += '\n';
         if(node.type == "link") {
             doc.links.push_back(node.meta);
         }
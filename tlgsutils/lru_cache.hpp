@@ -0,0 +1,157 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace tlgs
+{
+
+/**
+ * @brief Bounded LRU cache where entries also expire after a TTL. Each entry has a cost (1 by default) and the
+ * total cost never exceeds the capacity. The least recently used entries are evicted to make room. Thread safe.
+ *
+ * @tparam Clock clock used for expiry. Replaceable for testing
+ */
+template <typename Key, typename Value, typename Clock = std::chrono::steady_clock>
+class LruCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t cost = 0;
+
+        double hitRate() const
+        {
+            const auto total = hits + misses;
+            return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+        }
+    };
+
+    /**
+     * @param capacity maximum total cost of all entries
+     * @param ttl how long entries stay valid after insertion
+     */
+    LruCache(size_t capacity, typename Clock::duration ttl)
+        : capacity_(capacity), ttl_(ttl)
+    {
+    }
+
+    /**
+     * @brief Get the value of a key. Expired entries are treated as missing and removed
+     */
+    std::optional<Value> get(const Key& key)
+    {
+        std::lock_guard lock(mtx_);
+        auto it = map_.find(key);
+        if(it == map_.end()) {
+            stats_.misses++;
+            return std::nullopt;
+        }
+        if(it->second->expires <= Clock::now()) {
+            eraseLocked(it->second);
+            stats_.misses++;
+            return std::nullopt;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second);
+        stats_.hits++;
+        return it->second->value;
+    }
+
+    /**
+     * @brief Insert or replace a value. Values costing more than the capacity are not cached
+     */
+    void insert(const Key& key, Value value, size_t cost = 1)
+    {
+        insert(key, std::move(value), cost, ttl_);
+    }
+
+    /**
+     * @brief Insert or replace a value with its own TTL
+     */
+    void insert(const Key& key, Value value, size_t cost, typename Clock::duration ttl)
+    {
+        std::lock_guard lock(mtx_);
+        auto it = map_.find(key);
+        if(it != map_.end())
+            eraseLocked(it->second);
+        if(cost > capacity_)
+            return;
+
+        while(cost_ + cost > capacity_) {
+            eraseLocked(std::prev(lru_.end()));
+            stats_.evictions++;
+        }
+        lru_.push_front(Entry{key, std::move(value), cost, Clock::now() + ttl});
+        map_.emplace(key, lru_.begin());
+        cost_ += cost;
+    }
+
+    void erase(const Key& key)
+    {
+        std::lock_guard lock(mtx_);
+        auto it = map_.find(key);
+        if(it != map_.end())
+            eraseLocked(it->second);
+    }
+
+    void clear()
+    {
+        std::lock_guard lock(mtx_);
+        map_.clear();
+        lru_.clear();
+        cost_ = 0;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard lock(mtx_);
+        return map_.size();
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard lock(mtx_);
+        Stats stats = stats_;
+        stats.entries = map_.size();
+        stats.cost = cost_;
+        return stats;
+    }
+
+protected:
+    struct Entry
+    {
+        Key key;
+        Value value;
+        size_t cost;
+        typename Clock::time_point expires;
+    };
+    using Iterator = typename std::list<Entry>::iterator;
+
+    // Caller must hold the lock
+    void eraseLocked(Iterator it)
+    {
+        cost_ -= it->cost;
+        map_.erase(it->key);
+        lru_.erase(it);
+    }
+
+    mutable std::mutex mtx_;
+    // Most recently used first
+    std::list<Entry> lru_;
+    std::unordered_map<Key, Iterator> map_;
+    size_t capacity_;
+    typename Clock::duration ttl_;
+    size_t cost_ = 0;
+    Stats stats_;
+};
+
+}
@@ -0,0 +1,146 @@
+#include "pg_array.hpp"
+
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+
+void tlgs::PgArrayBuilder::appendRaw(std::string_view value)
+{
+    if(size_ != 0)
+        buffer_ += ',';
+    buffer_ += value;
+    size_++;
+}
+
+void tlgs::PgArrayBuilder::append(std::string_view str)
+{
+    // Always quote. Then only backslash and double quotes need escaping
+    if(size_ != 0)
+        buffer_ += ',';
+    buffer_.reserve(buffer_.size() + str.size() + 2);
+    buffer_ += '"';
+    for(auto ch : str) {
+        if(ch == '"' || ch == '\\')
+            buffer_ += '\\';
+        buffer_ += ch;
+    }
+    buffer_ += '"';
+    size_++;
+}
+
+void tlgs::PgArrayBuilder::append(bool value)
+{
+    appendRaw(value ? "t" : "f");
+}
+
+void tlgs::PgArrayBuilder::append(double value)
+{
+    char buf[32];
+    auto [end, _] = std::to_chars(buf, buf + sizeof(buf), value);
+    appendRaw(std::string_view(buf, end - buf));
+}
+
+void tlgs::PgArrayBuilder::appendNull()
+{
+    appendRaw("NULL");
+}
+
+std::string tlgs::PgArrayBuilder::str() const
+{
+    std::string result;
+    result.reserve(buffer_.size() + 2);
+    result += '{';
+    result += buffer_;
+    result += '}';
+    return result;
+}
+
+std::string tlgs::toPgArray(const std::vector<std::string>& values)
+{
+    PgArrayBuilder builder;
+    for(const auto& value : values)
+        builder.append(value);
+    return builder.str();
+}
+
+static bool isArraySpace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+static bool isNullToken(std::string_view token)
+{
+    constexpr std::string_view null_str = "null";
+    if(token.size() != null_str.size())
+        return false;
+    for(size_t i=0;i<token.size();i++) {
+        if(std::tolower(static_cast<unsigned char>(token[i])) != null_str[i])
+            return false;
+    }
+    return true;
+}
+
+std::vector<std::string> tlgs::parsePgArray(std::string_view literal)
+{
+    while(!literal.empty() && isArraySpace(literal.front()))
+        literal.remove_prefix(1);
+    while(!literal.empty() && isArraySpace(literal.back()))
+        literal.remove_suffix(1);
+    if(literal.size() < 2 || literal.front() != '{' || literal.back() != '}')
+        throw std::invalid_argument("Not a PostgreSQL array literal");
+    literal = literal.substr(1, literal.size() - 2);
+
+    std::vector<std::string> result;
+    size_t idx = 0;
+    auto skipSpace = [&]() {
+        while(idx < literal.size() && isArraySpace(literal[idx]))
+            idx++;
+    };
+    skipSpace();
+    if(idx == literal.size())
+        return result;
+
+    while(true) {
+        skipSpace();
+        if(idx < literal.size() && literal[idx] == '{')
+            throw std::invalid_argument("Multi-dimensional arrays are not supported");
+
+        if(idx < literal.size() && literal[idx] == '"') {
+            std::string value;
+            idx++;
+            while(idx < literal.size() && literal[idx] != '"') {
+                if(literal[idx] == '\\' && idx + 1 < literal.size())
+                    idx++;
+                value += literal[idx++];
+            }
+            if(idx == literal.size())
+                throw std::invalid_argument("Unterminated quoted array element");
+            idx++;
+            result.emplace_back(std::move(value));
+        }
+        else {
+            // PostgreSQL quotes every element containing delimiters, quotes or backslashes. So unquoted
+            // elements can be copied as is
+            size_t begin = idx;
+            while(idx < literal.size() && literal[idx] != ',')
+                idx++;
+            size_t end = idx;
+            while(end > begin && isArraySpace(literal[end-1]))
+                end--;
+            auto token = literal.substr(begin, end - begin);
+            if(token.empty())
+                throw std::invalid_argument("Empty unquoted array element");
+            // NULLs are dropped
+            if(!isNullToken(token))
+                result.emplace_back(token);
+        }
+
+        skipSpace();
+        if(idx == literal.size())
+            break;
+        if(literal[idx] != ',')
+            throw std::invalid_argument("Expected ',' between array elements");
+        idx++;
+    }
+    return result;
+}
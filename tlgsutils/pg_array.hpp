@@ -0,0 +1,83 @@
+#pragma once
+
+#include <concepts>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tlgs
+{
+
+/**
+ * @brief Builds a PostgreSQL array literal (ex: {"a","b"}) element by element. The result can be passed as a
+ * bind parameter and casted to an array type (ex: $1::text[]) as Drogon can't bind arrays directly.
+ */
+class PgArrayBuilder
+{
+public:
+    void append(std::string_view str);
+    void append(const char* str)
+    {
+        append(std::string_view(str));
+    }
+    void append(bool value);
+    // Shortest representation that reads back as the same value
+    void append(double value);
+    template <std::integral T>
+    void append(T value)
+    {
+        appendRaw(std::to_string(value));
+    }
+    template <typename T>
+    void append(const std::optional<T>& value)
+    {
+        if(value.has_value())
+            append(value.value());
+        else
+            appendNull();
+    }
+    void appendNull();
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    void clear()
+    {
+        buffer_.clear();
+        size_ = 0;
+    }
+
+    /**
+     * @brief The array literal
+     */
+    std::string str() const;
+
+protected:
+    void appendRaw(std::string_view value);
+
+    std::string buffer_;
+    size_t size_ = 0;
+};
+
+/**
+ * @brief Convert a list of strings into a PostgreSQL array literal
+ */
+std::string toPgArray(const std::vector<std::string>& values);
+
+/**
+ * @brief Parse a one dimensional PostgreSQL array literal as returned by the DB (ex: {a,"b c",NULL})
+ *
+ * @param literal the array literal
+ * @return std::vector<std::string> the elements. NULL elements are dropped
+ * @note Throws std::invalid_argument if the literal is malformed or multi-dimensional
+ */
+std::vector<std::string> parsePgArray(std::string_view literal);
+}
@@ -0,0 +1,223 @@
+#include "ranking.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <trantor/utils/Logger.h>
+
+// Nodes are processed in chunks this big. Small graphs (most search results) then run on the calling thread
+// without paying for task scheduling
+static constexpr size_t grain_size = 2048;
+
+using Range = tbb::blocked_range<size_t>;
+
+static bool cancelled(const tlgs::CancellationToken* cancel)
+{
+    return cancel != nullptr && cancel->cancelled();
+}
+
+/**
+ * @brief Sum over [0, size) using independent partial sums so the compiler can vectorize the loop
+ */
+template <typename Func>
+static double parallelSum(size_t size, Func&& func)
+{
+    return tbb::parallel_reduce(Range(0, size, grain_size), 0.0, [&](const Range& r, double sum) {
+        double partial[4] = {0, 0, 0, 0};
+        size_t i = r.begin();
+        for(;i+4<=r.end();i+=4) {
+            partial[0] += func(i);
+            partial[1] += func(i+1);
+            partial[2] += func(i+2);
+            partial[3] += func(i+3);
+        }
+        for(;i<r.end();i++)
+            partial[0] += func(i);
+        return sum + (partial[0] + partial[1]) + (partial[2] + partial[3]);
+    }, std::plus<double>());
+}
+
+tlgs::LinkGraph tlgs::LinkGraph::fromEdges(size_t node_count, std::span<const std::pair<NodeIndex, NodeIndex>> edges)
+{
+    if(edges.size() >= std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Too many edges for a 32bit CSR graph");
+
+    LinkGraph graph;
+    auto build = [&](CsrGraph& csr, bool transpose) {
+        csr.offsets.assign(node_count+1, 0);
+        for(const auto& [src, dst] : edges) {
+            assert(src < node_count && dst < node_count);
+            csr.offsets[(transpose ? dst : src)+1]++;
+        }
+        for(size_t i=0;i<node_count;i++)
+            csr.offsets[i+1] += csr.offsets[i];
+
+        // Reuse the offset array as insertion cursors, then shift it back
+        csr.neighbours.resize(edges.size());
+        for(const auto& [src, dst] : edges) {
+            auto row = transpose ? dst : src;
+            csr.neighbours[csr.offsets[row]++] = transpose ? src : dst;
+        }
+        for(size_t i=node_count;i>0;i--)
+            csr.offsets[i] = csr.offsets[i-1];
+        csr.offsets[0] = 0;
+    };
+    build(graph.out, false);
+    build(graph.in, true);
+    return graph;
+}
+
+std::span<const double> tlgs::hitsRank(const LinkGraph& graph, RankingWorkspace& ws, const CancellationToken* cancel)
+{
+    const size_t node_count = graph.nodeCount();
+    assert(node_count == graph.in.nodeCount());
+    if(node_count == 0)
+        return {};
+
+    constexpr double epsilon = 0.005;
+    constexpr size_t max_iter = 300;
+    auto& auth_score = ws.score;
+    auto& hub_score = ws.hub_score;
+    auto& new_auth_score = ws.new_score;
+    auto& new_hub_score = ws.new_hub_score;
+    auth_score.assign(node_count, 1.0/node_count);
+    hub_score.assign(node_count, 1.0/node_count);
+    new_auth_score.resize(node_count);
+    new_hub_score.resize(node_count);
+
+    double score_delta = std::numeric_limits<double>::max();
+    size_t hits_iter = 0;
+    for(hits_iter=0;hits_iter<max_iter && score_delta > epsilon && !cancelled(cancel);hits_iter++) {
+        tbb::parallel_for(Range(0, node_count, grain_size), [&](const Range& r) {
+            for(size_t i=r.begin();i<r.end();i++) {
+                double calc_auth_score = 0;
+                double calc_hub_score = 0;
+                for(auto neighbour_idx : graph.in.neighboursOf(i))
+                    calc_auth_score += hub_score[neighbour_idx];
+                for(auto neighbour_idx : graph.out.neighboursOf(i))
+                    calc_hub_score += auth_score[neighbour_idx];
+                // Nodes without links keep their score
+                new_auth_score[i] = calc_auth_score != 0 ? calc_auth_score : auth_score[i];
+                new_hub_score[i] = calc_hub_score != 0 ? calc_hub_score : hub_score[i];
+            }
+        });
+
+        const double inv_auth_sum = 1.0 / std::max(parallelSum(node_count, [&](size_t i) { return new_auth_score[i]; }), 1.0);
+        const double inv_hub_sum = 1.0 / std::max(parallelSum(node_count, [&](size_t i) { return new_hub_score[i]; }), 1.0);
+        score_delta = parallelSum(node_count, [&](size_t i) {
+            double auth = new_auth_score[i] * inv_auth_sum;
+            double hub = new_hub_score[i] * inv_hub_sum;
+            double delta = std::abs(auth_score[i] - auth) + std::abs(hub_score[i] - hub);
+            // avoid denormals
+            auth_score[i] = auth < std::numeric_limits<float>::epsilon() ? 0 : auth;
+            hub_score[i] = hub < std::numeric_limits<float>::epsilon() ? 0 : hub;
+            return delta;
+        });
+    }
+    LOG_DEBUG << "HITS finished in " << hits_iter << " iterations";
+    return auth_score;
+}
+
+std::span<const double> tlgs::salsaRank(const LinkGraph& graph, RankingWorkspace& ws, const CancellationToken* cancel)
+{
+    const size_t node_count = graph.nodeCount();
+    assert(node_count == graph.in.nodeCount());
+    if(node_count == 0)
+        return {};
+
+    // Find the hubs and auths in the network. According to the SALSA paper, hubs are noes with more outbound
+    // links than inbound links.
+    auto& is_auth = ws.is_auth;
+    is_auth.resize(node_count);
+    for(size_t i=0;i<node_count;i++)
+        is_auth[i] = graph.in.degree(i) > graph.out.degree(i);
+    const size_t num_auths = std::count(is_auth.begin(), is_auth.end(), 1);
+    const size_t num_hubs = node_count - num_auths;
+
+    // Only links from a hub to an auth matter to SALSA. Store them as an undirected bipartite graph where an
+    // auth links to the hubs pointing to it and a hub links to the auths it points to. Then both halves of a
+    // SALSA step are the same sparse mat-vec over this graph.
+    auto& bipartite = ws.bipartite;
+    bipartite.offsets.resize(node_count+1);
+    bipartite.offsets[0] = 0;
+    auto crossNeighbours = [&](size_t i) {
+        return is_auth[i] ? graph.in.neighboursOf(i) : graph.out.neighboursOf(i);
+    };
+    tbb::parallel_for(Range(0, node_count, grain_size), [&](const Range& r) {
+        for(size_t i=r.begin();i<r.end();i++) {
+            auto neighbours = crossNeighbours(i);
+            bipartite.offsets[i+1] = std::count_if(neighbours.begin(), neighbours.end(), [&](NodeIndex idx) {
+                return is_auth[idx] != is_auth[i];
+            });
+        }
+    });
+    for(size_t i=0;i<node_count;i++)
+        bipartite.offsets[i+1] += bipartite.offsets[i];
+    bipartite.neighbours.resize(bipartite.offsets[node_count]);
+    tbb::parallel_for(Range(0, node_count, grain_size), [&](const Range& r) {
+        for(size_t i=r.begin();i<r.end();i++) {
+            auto neighbours = crossNeighbours(i);
+            std::copy_if(neighbours.begin(), neighbours.end(), bipartite.neighbours.begin() + bipartite.offsets[i]
+                , [&](NodeIndex idx) { return is_auth[idx] != is_auth[i]; });
+        }
+    });
+
+    auto& score = ws.score;
+    auto& new_score = ws.new_score;
+    auto& inv_degree = ws.inv_degree;
+    auto& weighted = ws.weighted;
+    auto& half_step = ws.hub_score;
+    score.resize(node_count);
+    new_score.resize(node_count);
+    inv_degree.resize(node_count);
+    weighted.resize(node_count);
+    half_step.resize(node_count);
+    for(size_t i=0;i<node_count;i++) {
+        score[i] = 1.0 / (is_auth[i] ? num_auths : num_hubs);
+        inv_degree[i] = 1.0 / std::max(bipartite.degree(i), uint32_t{1});
+    }
+
+    // The SALSA ranking algorithm
+    // Reference implementation: https://docs.oracle.com/cd/E56133_01/latest/reference/analytics/algorithms/salsa.html
+    constexpr double epsilon = 0.005*2;
+    constexpr size_t max_iter = 300;
+    double score_delta = std::numeric_limits<double>::max();
+    double score_sum = parallelSum(node_count, [&](size_t i) { return score[i]; });
+    size_t salsa_iter = 0;
+    for(salsa_iter=0;salsa_iter<max_iter && score_delta > epsilon && !cancelled(cancel);salsa_iter++) {
+        for(size_t i=0;i<node_count;i++)
+            weighted[i] = score[i] * inv_degree[i];
+        tbb::parallel_for(Range(0, node_count, grain_size), [&](const Range& r) {
+            for(size_t i=r.begin();i<r.end();i++) {
+                double sum = 0;
+                for(auto idx : bipartite.neighboursOf(i))
+                    sum += weighted[idx];
+                half_step[i] = sum * inv_degree[i];
+            }
+        });
+        tbb::parallel_for(Range(0, node_count, grain_size), [&](const Range& r) {
+            for(size_t i=r.begin();i<r.end();i++) {
+                double sum = 0;
+                for(auto idx : bipartite.neighboursOf(i))
+                    sum += half_step[idx];
+                new_score[i] = sum;
+            }
+        });
+
+        const double inv_sum = 1.0 / std::max(score_sum, 1.0);
+        score_delta = parallelSum(node_count, [&](size_t i) {
+            return std::abs(new_score[i]*inv_sum - score[i]);
+        });
+        for(size_t i=0;i<node_count;i++)
+            score[i] = new_score[i]*inv_sum;
+        score_sum = parallelSum(node_count, [&](size_t i) { return score[i]; });
+    }
+    LOG_DEBUG << "SALSA finished in " << salsa_iter << " iterations";
+    return score;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <tlgsutils/cancellation.hpp>
+
+namespace tlgs
+{
+
+using NodeIndex = uint32_t;
+
+/**
+ * @brief Adjacency of a graph in compressed sparse row (CSR) format. The neighbours of node i are stored in
+ * neighbours[offsets[i]] to neighbours[offsets[i+1]]
+ */
+struct CsrGraph
+{
+    std::vector<uint32_t> offsets;
+    std::vector<NodeIndex> neighbours;
+
+    size_t nodeCount() const
+    {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    size_t edgeCount() const
+    {
+        return neighbours.size();
+    }
+
+    uint32_t degree(NodeIndex node) const
+    {
+        return offsets[node+1] - offsets[node];
+    }
+
+    std::span<const NodeIndex> neighboursOf(NodeIndex node) const
+    {
+        return {neighbours.data() + offsets[node], neighbours.data() + offsets[node+1]};
+    }
+};
+
+/**
+ * @brief A directed graph stored both as outbound and inbound adjacency
+ */
+struct LinkGraph
+{
+    CsrGraph out;
+    CsrGraph in;
+
+    size_t nodeCount() const
+    {
+        return out.nodeCount();
+    }
+
+    /**
+     * @brief Build the graph from a list of (source, destination) edges
+     *
+     * @param node_count number of nodes in the graph. All indices in edges must be smaller than this
+     * @param edges the edges. Duplicated edges are kept as is
+     */
+    static LinkGraph fromEdges(size_t node_count, std::span<const std::pair<NodeIndex, NodeIndex>> edges);
+};
+
+/**
+ * @brief Scratch buffers used by the ranking algorithms. Keep one around (ex: thread_local) and pass it to
+ * every call to avoid allocating on each search
+ */
+struct RankingWorkspace
+{
+    std::vector<double> score;
+    std::vector<double> hub_score;
+    std::vector<double> new_score;
+    std::vector<double> new_hub_score;
+    std::vector<double> inv_degree;
+    std::vector<double> weighted;
+    std::vector<unsigned char> is_auth;
+    CsrGraph bipartite;
+};
+
+/**
+ * @brief Ranks the network nodes using the HITS algorithm.
+ *
+ * @param graph the link graph
+ * @param workspace scratch buffers. The result lives in the workspace
+ * @param cancel stops iterating once cancelled. The scores are then those of the last finished iteration
+ * @return std::span<const double> The authority score of each node. Valid until the workspace is used again
+ */
+std::span<const double> hitsRank(const LinkGraph& graph, RankingWorkspace& workspace,
+    const CancellationToken* cancel = nullptr);
+
+/**
+ * @brief Ranks the network nodes using the SALSA algorithm.
+ *
+ * @param graph the link graph
+ * @param workspace scratch buffers. The result lives in the workspace
+ * @param cancel stops iterating once cancelled. The scores are then those of the last finished iteration
+ * @return std::span<const double> The score of each node. Valid until the workspace is used again
+ * @note Only links from hubs to authorities contribute to the score. Which are nodes with more outbound than
+ * inbound links and vice versa
+ */
+std::span<const double> salsaRank(const LinkGraph& graph, RankingWorkspace& workspace,
+    const CancellationToken* cancel = nullptr);
+}
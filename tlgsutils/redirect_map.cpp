@@ -0,0 +1,51 @@
+#include "redirect_map.hpp"
+
+#include <xxhash.h>
+
+uint64_t tlgs::RedirectMap::hash(std::string_view url)
+{
+    return XXH64(url.data(), url.size(), 0);
+}
+
+void tlgs::RedirectMap::add(std::string_view from, std::string to)
+{
+    const auto key = hash(from);
+    std::lock_guard lock(mtx_);
+    // Only the single hop is stored. Collapsing the chain here would go stale once a later link of it changes
+    redirects_[key] = std::move(to);
+}
+
+std::optional<std::string> tlgs::RedirectMap::resolve(std::string_view url)
+{
+    std::lock_guard lock(mtx_);
+    return resolveLocked(hash(url));
+}
+
+std::optional<std::string> tlgs::RedirectMap::resolveLocked(uint64_t key)
+{
+    auto it = redirects_.find(key);
+    if(it == redirects_.end())
+        return std::nullopt;
+
+    // Chains are walked on every lookup. They are short and hashing a URL is cheap
+    auto first = it;
+    for(size_t i=1;i<max_hops;i++) {
+        auto next = redirects_.find(hash(it->second));
+        if(next == redirects_.end() || next == first)
+            break;
+        it = next;
+    }
+    return it->second;
+}
+
+size_t tlgs::RedirectMap::size() const
+{
+    std::lock_guard lock(mtx_);
+    return redirects_.size();
+}
+
+void tlgs::RedirectMap::clear()
+{
+    std::lock_guard lock(mtx_);
+    redirects_.clear();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace tlgs
+{
+
+/**
+ * @brief In memory map of permanent redirects. Chains like A -> B -> C are followed so looking up A gives C.
+ * Source URLs are stored as 64 bit hashes to keep the map small. Thread safe.
+ */
+class RedirectMap
+{
+public:
+    /**
+     * @brief Record a redirect from `from` to `to`. Replaces the existing redirect of `from`
+     */
+    void add(std::string_view from, std::string to);
+
+    /**
+     * @brief Find where a URL finally redirects to.
+     *
+     * @return the final target. std::nullopt if the URL doesn't redirect
+     * @note Redirect loops are followed at most max_hops times. A URL on a loop resolves to itself
+     */
+    std::optional<std::string> resolve(std::string_view url);
+
+    size_t size() const;
+
+    void clear();
+
+    static constexpr size_t max_hops = 16;
+
+protected:
+    static uint64_t hash(std::string_view url);
+    // Caller must hold the lock
+    std::optional<std::string> resolveLocked(uint64_t key);
+
+    mutable std::mutex mtx_;
+    std::unordered_map<uint64_t, std::string> redirects_;
+};
+
+}
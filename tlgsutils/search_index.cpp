@@ -0,0 +1,595 @@
+#include "search_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace tlgs;
+using namespace tlgs::detail;
+
+static const char segment_magic[8] = {'T', 'L', 'G', 'S', 'I', 'D', 'X', '1'};
+static constexpr uint32_t segment_version = 2;
+static const char* manifest_name = "manifest";
+
+static void writeVarint(std::string& out, uint32_t value)
+{
+    while(value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+static const uint8_t* readVarint(const uint8_t* ptr, uint32_t& value)
+{
+    value = 0;
+    for(int shift=0;;shift+=7) {
+        const uint8_t byte = *ptr++;
+        value |= uint32_t(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0)
+            return ptr;
+    }
+}
+
+PostingIterator::PostingIterator(const SkipEntry* skips, uint32_t block_count, const uint8_t* blocks, uint32_t doc_freq)
+    : skips_(skips), blocks_(blocks), block_count_(block_count), doc_freq_(doc_freq)
+{
+    if(block_count_ != 0)
+        loadBlock(0);
+}
+
+void PostingIterator::loadBlock(uint32_t block)
+{
+    block_ = block;
+    pos_ = 0;
+    block_postings_ = block + 1 == block_count_ ? doc_freq_ - block * block_size : block_size;
+    uint32_t doc = block == 0 ? 0 : skips_[block - 1].last_doc;
+    const uint8_t* ptr = blocks_ + skips_[block].offset;
+    for(uint32_t i=0;i<block_postings_;i++) {
+        uint32_t delta;
+        ptr = readVarint(ptr, delta);
+        ptr = readVarint(ptr, freqs_[i]);
+        doc += delta;
+        docs_[i] = doc;
+    }
+}
+
+void PostingIterator::next()
+{
+    if(++pos_ < block_postings_)
+        return;
+    if(block_ + 1 < block_count_)
+        loadBlock(block_ + 1);
+    else
+        block_ = block_count_;
+}
+
+void PostingIterator::advance(uint32_t target)
+{
+    if(!valid() || doc() >= target)
+        return;
+    if(skips_[block_].last_doc < target) {
+        auto it = std::lower_bound(skips_ + block_ + 1, skips_ + block_count_, target, [](const SkipEntry& skip, uint32_t doc) {
+            return skip.last_doc < doc;
+        });
+        if(it == skips_ + block_count_) {
+            block_ = block_count_;
+            return;
+        }
+        loadBlock(it - skips_);
+    }
+    // The block ends with a document >= target
+    while(docs_[pos_] < target)
+        pos_++;
+}
+
+namespace
+{
+/**
+ * @brief Streams a segment to disk. Postings first, then the document and term tables once everything is known
+ */
+class SegmentWriter
+{
+public:
+    explicit SegmentWriter(const std::string& path)
+        : path_(path), tmp_path_(path + ".tmp"), out_(tmp_path_, std::ios::binary | std::ios::trunc)
+    {
+        if(!out_)
+            throw std::runtime_error("Cannot open " + tmp_path_ + " for writing");
+        SegmentHeader header{};
+        write(&header, sizeof(header));
+    }
+
+    size_t docCount() const
+    {
+        return docs_.size();
+    }
+
+    void addDocument(std::string_view url, const std::array<uint32_t, index_field_count>& lengths)
+    {
+        DocEntry entry{};
+        entry.url_offset = strings_.size();
+        entry.url_length = url.size();
+        for(size_t i=0;i<index_field_count;i++)
+            entry.lengths[i] = lengths[i];
+        strings_ += url;
+        docs_.push_back(entry);
+    }
+
+    /**
+     * @brief Add the postings of a term. Terms must be added in byte order. After all documents
+     */
+    void addTerm(std::string_view term, const std::array<std::span<const Posting>, index_field_count>& postings)
+    {
+        TermEntry entry{};
+        entry.term_offset = strings_.size();
+        entry.term_length = term.size();
+        strings_ += term;
+        for(size_t field=0;field<index_field_count;field++)
+            entry.fields[field] = writePostings(postings[field], field);
+        terms_.push_back(entry);
+    }
+
+    void finish()
+    {
+        SegmentHeader header{};
+        std::memcpy(header.magic, segment_magic, sizeof(segment_magic));
+        header.version = segment_version;
+        header.doc_count = docs_.size();
+        header.term_count = terms_.size();
+        align(8);
+        header.docs_offset = pos_;
+        write(docs_.data(), docs_.size() * sizeof(DocEntry));
+        align(8);
+        header.terms_offset = pos_;
+        write(terms_.data(), terms_.size() * sizeof(TermEntry));
+        header.strings_offset = pos_;
+        write(strings_.data(), strings_.size());
+        header.file_size = pos_;
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out_.close();
+        if(!out_)
+            throw std::runtime_error("Failed to write " + tmp_path_);
+        if(std::rename(tmp_path_.c_str(), path_.c_str()) != 0)
+            throw std::runtime_error("Failed to move " + tmp_path_ + " to " + path_);
+    }
+
+protected:
+    PostingRef writePostings(std::span<const Posting> postings, size_t field)
+    {
+        PostingRef ref{};
+        if(postings.empty())
+            return ref;
+        const uint32_t block_count = (postings.size() + PostingIterator::block_size - 1) / PostingIterator::block_size;
+        std::vector<SkipEntry> skips(block_count);
+        encoded_.clear();
+        uint32_t prev = 0;
+        for(uint32_t block=0;block<block_count;block++) {
+            skips[block].offset = encoded_.size();
+            skips[block].min_length = std::numeric_limits<uint32_t>::max();
+            const size_t end = std::min<size_t>(postings.size(), (block + 1) * PostingIterator::block_size);
+            for(size_t i=block*PostingIterator::block_size;i<end;i++) {
+                writeVarint(encoded_, postings[i].doc - prev);
+                writeVarint(encoded_, postings[i].freq);
+                prev = postings[i].doc;
+                skips[block].max_freq = std::max(skips[block].max_freq, postings[i].freq);
+                skips[block].min_length = std::min(skips[block].min_length, docs_[prev].lengths[field]);
+            }
+            skips[block].last_doc = prev;
+        }
+        align(alignof(SkipEntry));
+        ref.offset = pos_;
+        ref.doc_freq = postings.size();
+        ref.block_count = block_count;
+        write(skips.data(), skips.size() * sizeof(SkipEntry));
+        write(encoded_.data(), encoded_.size());
+        return ref;
+    }
+
+    void write(const void* data, size_t size)
+    {
+        out_.write(reinterpret_cast<const char*>(data), size);
+        pos_ += size;
+    }
+
+    void align(size_t alignment)
+    {
+        static const char zeros[8] = {};
+        if(pos_ % alignment != 0)
+            write(zeros, alignment - pos_ % alignment);
+    }
+
+    std::string path_;
+    std::string tmp_path_;
+    std::ofstream out_;
+    uint64_t pos_ = 0;
+    std::vector<DocEntry> docs_;
+    std::vector<TermEntry> terms_;
+    std::string strings_;
+    std::string encoded_;
+};
+}
+
+std::shared_ptr<const Segment> Segment::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("Cannot open " + path);
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SegmentHeader)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not an index segment");
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + path);
+
+    std::shared_ptr<Segment> segment(new Segment);
+    segment->data_ = static_cast<const uint8_t*>(data);
+    segment->size_ = st.st_size;
+    segment->header_ = reinterpret_cast<const SegmentHeader*>(data);
+    const auto& header = *segment->header_;
+    if(std::memcmp(header.magic, segment_magic, sizeof(segment_magic)) != 0 || header.version != segment_version)
+        throw std::runtime_error(path + " is not an index segment of this version");
+    if(header.file_size != segment->size_
+        || header.docs_offset + uint64_t(header.doc_count) * sizeof(DocEntry) > header.terms_offset
+        || header.terms_offset + header.term_count * sizeof(TermEntry) > header.strings_offset
+        || header.strings_offset > header.file_size)
+        throw std::runtime_error(path + " is truncated or malformed");
+    segment->docs_ = reinterpret_cast<const DocEntry*>(segment->data_ + header.docs_offset);
+    segment->terms_ = reinterpret_cast<const TermEntry*>(segment->data_ + header.terms_offset);
+    segment->strings_ = reinterpret_cast<const char*>(segment->data_ + header.strings_offset);
+    return segment;
+}
+
+Segment::~Segment()
+{
+    if(data_ != nullptr)
+        munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+std::string_view Segment::url(uint32_t doc) const
+{
+    return {strings_ + docs_[doc].url_offset, docs_[doc].url_length};
+}
+
+uint32_t Segment::length(IndexField field, uint32_t doc) const
+{
+    return docs_[doc].lengths[static_cast<size_t>(field)];
+}
+
+std::string_view Segment::term(size_t idx) const
+{
+    return {strings_ + terms_[idx].term_offset, terms_[idx].term_length};
+}
+
+PostingIterator Segment::postings(IndexField field, std::string_view term) const
+{
+    size_t lo = 0;
+    size_t hi = termCount();
+    while(lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if(this->term(mid) < term)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo == termCount() || this->term(lo) != term)
+        return {};
+    return postings(field, lo);
+}
+
+PostingIterator Segment::postings(IndexField field, size_t term_idx) const
+{
+    const auto& ref = terms_[term_idx].fields[static_cast<size_t>(field)];
+    if(ref.doc_freq == 0)
+        return {};
+    auto skips = reinterpret_cast<const SkipEntry*>(data_ + ref.offset);
+    auto blocks = data_ + ref.offset + ref.block_count * sizeof(SkipEntry);
+    return PostingIterator(skips, ref.block_count, blocks, ref.doc_freq);
+}
+
+uint32_t SegmentBuilder::add(const Document& doc)
+{
+    const uint32_t id = docs_.size();
+    docs_.push_back({doc.url, doc.lengths});
+    for(size_t field=0;field<index_field_count;field++) {
+        for(const auto& [term, freq] : doc.terms[field]) {
+            auto it = postings_.find(term);
+            if(it == postings_.end())
+                it = postings_.emplace(term, std::array<std::vector<Posting>, index_field_count>{}).first;
+            it->second[field].push_back({id, freq});
+        }
+    }
+    return id;
+}
+
+void SegmentBuilder::write(const std::string& path) const
+{
+    SegmentWriter writer(path);
+    for(const auto& doc : docs_)
+        writer.addDocument(doc.url, doc.lengths);
+    for(const auto& [term, postings] : postings_)
+        writer.addTerm(term, {postings[0], postings[1]});
+    writer.finish();
+}
+
+IndexManifest IndexManifest::load(const std::string& dir)
+{
+    IndexManifest manifest;
+    std::ifstream in(std::filesystem::path(dir) / manifest_name);
+    std::string line;
+    while(std::getline(in, line)) {
+        auto space = line.find(' ');
+        if(space == std::string::npos)
+            continue;
+        auto key = line.substr(0, space);
+        auto value = line.substr(space + 1);
+        if(key == "segment")
+            manifest.segments.push_back(value);
+        else if(key == "built_at")
+            manifest.built_at = value;
+        else if(key == "next_segment")
+            manifest.next_segment = std::stoull(value);
+    }
+    return manifest;
+}
+
+void IndexManifest::save(const std::string& dir) const
+{
+    const auto path = std::filesystem::path(dir) / manifest_name;
+    const auto tmp_path = path.string() + ".tmp";
+    std::ofstream out(tmp_path, std::ios::trunc);
+    if(!out)
+        throw std::runtime_error("Cannot open " + tmp_path + " for writing");
+    out << "built_at " << built_at << "\n";
+    out << "next_segment " << next_segment << "\n";
+    for(const auto& segment : segments)
+        out << "segment " << segment << "\n";
+    out.close();
+    if(!out)
+        throw std::runtime_error("Failed to write " + tmp_path);
+    if(std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Failed to move " + tmp_path + " to " + path.string());
+}
+
+std::string IndexManifest::newSegmentName()
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%06llu.idx", (unsigned long long)next_segment++);
+    return name;
+}
+
+SearchIndex::SearchIndex(std::vector<std::shared_ptr<const Segment>> segments)
+    : segments_(std::move(segments))
+{
+    // Newest first. The first time we see a URL is its current version
+    std::unordered_set<std::string_view> seen;
+    std::array<uint64_t, index_field_count> total_length{};
+    live_.resize(segments_.size());
+    for(size_t s=segments_.size();s-->0;) {
+        const auto& segment = *segments_[s];
+        live_[s].resize(segment.docCount());
+        for(uint32_t doc=segment.docCount();doc-->0;) {
+            if(!seen.insert(segment.url(doc)).second)
+                continue;
+            live_[s][doc] = true;
+            live_count_++;
+            for(size_t field=0;field<index_field_count;field++)
+                total_length[field] += segment.length(static_cast<IndexField>(field), doc);
+        }
+    }
+    for(size_t field=0;field<index_field_count;field++)
+        average_length_[field] = live_count_ == 0 ? 0 : double(total_length[field]) / live_count_;
+}
+
+std::shared_ptr<const SearchIndex> SearchIndex::open(const std::string& dir)
+{
+    auto manifest = IndexManifest::load(dir);
+    if(manifest.segments.empty())
+        throw std::runtime_error("No index in " + dir);
+    std::vector<std::shared_ptr<const Segment>> segments;
+    for(const auto& name : manifest.segments)
+        segments.push_back(Segment::open((std::filesystem::path(dir) / name).string()));
+    return std::make_shared<SearchIndex>(std::move(segments));
+}
+
+uint64_t SearchIndex::docFreq(std::string_view term) const
+{
+    uint64_t doc_freq = 0;
+    for(const auto& segment : segments_)
+        doc_freq += segment->postings(IndexField::Body, term).docFreq();
+    return doc_freq;
+}
+
+/**
+ * @brief Upper bound of a term's score in any document of a posting list
+ */
+static float listUpperBound(const PostingIterator& postings, const Bm25Scorer& scorer, size_t term)
+{
+    float bound = 0;
+    for(const auto& block : postings.blocks())
+        bound = std::max(bound, scorer.termScore(term, block.max_freq, block.min_length));
+    return bound;
+}
+
+std::vector<SearchIndex::Match> SearchIndex::search(std::span<const std::string> terms, size_t limit, float title_weight,
+    Bm25Params params) const
+{
+    if(terms.empty() || limit == 0)
+        return {};
+    const size_t num_terms = terms.size();
+    std::vector<float> idf;
+    for(const auto& term : terms)
+        idf.push_back(bm25Idf(live_count_, docFreq(term)));
+    const Bm25Scorer title_scorer(idf, averageLength(IndexField::Title), params);
+    const Bm25Scorer body_scorer(idf, averageLength(IndexField::Body), params);
+
+    // Min heap of the best matches so far. Anything scoring no more than its worst can't get in once it's full
+    std::vector<Match> top;
+    auto worse = [](const Match& a, const Match& b) { return a.score > b.score; };
+    auto threshold = [&]() {
+        return top.size() < limit ? -std::numeric_limits<float>::infinity() : top.front().score;
+    };
+    // Scores are summed the same way bounds are. So a bound is never below the score it bounds due to rounding
+    auto score = [&](const Bm25Scorer& scorer, std::span<const uint32_t> tfs, uint32_t length) {
+        float sum = 0;
+        for(size_t i=0;i<num_terms;i++)
+            sum += scorer.termScore(i, tfs[i], length);
+        return sum;
+    };
+    std::vector<uint32_t> body_tf(num_terms);
+    std::vector<uint32_t> title_tf(num_terms);
+    std::vector<PostingIterator> body(num_terms);
+    std::vector<PostingIterator> title(num_terms);
+    std::vector<size_t> order(num_terms);
+    for(size_t s=0;s<segments_.size();s++) {
+        const auto& segment = *segments_[s];
+        bool all_terms = true;
+        for(size_t i=0;i<num_terms;i++) {
+            body[i] = segment.postings(IndexField::Body, terms[i]);
+            title[i] = segment.postings(IndexField::Title, terms[i]);
+            all_terms &= body[i].valid();
+        }
+        if(!all_terms)
+            continue;
+
+        // The title isn't iterated block by block with the body. Bound it by its whole posting lists
+        float body_bound = 0;
+        float title_bound = 0;
+        for(size_t i=0;i<num_terms;i++) {
+            body_bound += listUpperBound(body[i], body_scorer, i);
+            title_bound += listUpperBound(title[i], title_scorer, i);
+        }
+        title_bound *= title_weight;
+        if(body_bound + title_bound <= threshold())
+            continue;
+
+        // Leapfrog intersection driven by the rarest term
+        for(size_t i=0;i<num_terms;i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&body](size_t a, size_t b) { return body[a].docFreq() < body[b].docFreq(); });
+        auto& lead = body[order[0]];
+        bool exhausted = false;
+        while(lead.valid() && !exhausted) {
+            const uint32_t candidate = lead.doc();
+            bool matched = true;
+            for(size_t k=1;k<num_terms;k++) {
+                auto& it = body[order[k]];
+                it.advance(candidate);
+                if(!it.valid()) {
+                    exhausted = true;
+                    matched = false;
+                    break;
+                }
+                if(it.doc() != candidate) {
+                    lead.advance(it.doc());
+                    matched = false;
+                    break;
+                }
+            }
+            if(!matched)
+                continue;
+
+            // Until one of the current blocks ends, no document can beat the bound of the blocks. Skip them all if
+            // that's not enough
+            if(top.size() == limit) {
+                float bound = 0;
+                uint32_t blocks_end = std::numeric_limits<uint32_t>::max();
+                for(size_t i=0;i<num_terms;i++) {
+                    const auto& block = body[i].block();
+                    bound += body_scorer.termScore(i, block.max_freq, block.min_length);
+                    blocks_end = std::min(blocks_end, block.last_doc);
+                }
+                if(bound + title_bound <= threshold()) {
+                    if(blocks_end == std::numeric_limits<uint32_t>::max())
+                        break;
+                    lead.advance(blocks_end + 1);
+                    continue;
+                }
+            }
+
+            if(live(s, candidate)) {
+                for(size_t i=0;i<num_terms;i++) {
+                    body_tf[i] = body[i].freq();
+                    title[i].advance(candidate);
+                    title_tf[i] = title[i].valid() && title[i].doc() == candidate ? title[i].freq() : 0;
+                }
+                const float doc_score = score(body_scorer, body_tf, segment.length(IndexField::Body, candidate))
+                    + title_weight * score(title_scorer, title_tf, segment.length(IndexField::Title, candidate));
+                if(top.size() < limit) {
+                    top.push_back({segment.url(candidate), doc_score});
+                    std::push_heap(top.begin(), top.end(), worse);
+                }
+                else if(doc_score > top.front().score) {
+                    std::pop_heap(top.begin(), top.end(), worse);
+                    top.back() = {segment.url(candidate), doc_score};
+                    std::push_heap(top.begin(), top.end(), worse);
+                }
+            }
+            lead.next();
+        }
+    }
+    std::sort_heap(top.begin(), top.end(), worse);
+    return top;
+}
+
+void SearchIndex::merge(const std::string& path) const
+{
+    SegmentWriter writer(path);
+    // Live documents are renumbered in segment order. So concatenated postings stay sorted
+    std::vector<std::vector<uint32_t>> new_ids(segments_.size());
+    constexpr uint32_t removed = std::numeric_limits<uint32_t>::max();
+    for(size_t s=0;s<segments_.size();s++) {
+        const auto& segment = *segments_[s];
+        new_ids[s].assign(segment.docCount(), removed);
+        for(uint32_t doc=0;doc<segment.docCount();doc++) {
+            if(!live(s, doc))
+                continue;
+            new_ids[s][doc] = writer.docCount();
+            writer.addDocument(segment.url(doc), {segment.length(IndexField::Title, doc), segment.length(IndexField::Body, doc)});
+        }
+    }
+
+    std::vector<size_t> cursor(segments_.size(), 0);
+    std::array<std::vector<Posting>, index_field_count> postings;
+    while(true) {
+        std::optional<std::string_view> term;
+        for(size_t s=0;s<segments_.size();s++) {
+            if(cursor[s] < segments_[s]->termCount() && (!term || segments_[s]->term(cursor[s]) < *term))
+                term = segments_[s]->term(cursor[s]);
+        }
+        if(!term)
+            break;
+
+        for(auto& list : postings)
+            list.clear();
+        for(size_t s=0;s<segments_.size();s++) {
+            if(cursor[s] == segments_[s]->termCount() || segments_[s]->term(cursor[s]) != *term)
+                continue;
+            for(size_t field=0;field<index_field_count;field++) {
+                for(auto it = segments_[s]->postings(static_cast<IndexField>(field), cursor[s]);it.valid();it.next()) {
+                    if(new_ids[s][it.doc()] != removed)
+                        postings[field].push_back({new_ids[s][it.doc()], it.freq()});
+                }
+            }
+            cursor[s]++;
+        }
+        if(!postings[static_cast<size_t>(IndexField::Body)].empty() || !postings[static_cast<size_t>(IndexField::Title)].empty())
+            writer.addTerm(*term, {postings[0], postings[1]});
+    }
+    writer.finish();
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <tlgsutils/bm25.hpp>
+
+namespace tlgs
+{
+
+/**
+ * @brief Fields of an indexed page. Body also contains the title, like pages.search_vector does
+ */
+enum class IndexField : uint8_t
+{
+    Title = 0,
+    Body = 1,
+};
+constexpr size_t index_field_count = 2;
+
+struct Posting
+{
+    uint32_t doc;
+    uint32_t freq;
+};
+
+namespace detail
+{
+// On disk structures of a segment. Little endian, as written by the machine building the index
+struct SegmentHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t doc_count;
+    uint64_t term_count;
+    uint64_t docs_offset;
+    uint64_t terms_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+};
+
+struct DocEntry
+{
+    uint64_t url_offset;
+    uint32_t url_length;
+    uint32_t lengths[index_field_count];
+    uint32_t reserved;
+};
+
+struct PostingRef
+{
+    // Where the skip table of the list starts. Followed by the encoded blocks
+    uint64_t offset;
+    uint32_t doc_freq;
+    uint32_t block_count;
+};
+
+struct TermEntry
+{
+    uint64_t term_offset;
+    uint32_t term_length;
+    uint32_t reserved;
+    PostingRef fields[index_field_count];
+};
+
+// One per block of postings. Lets iterators skip blocks without decoding them. And searches skip blocks that can't
+// score high enough
+struct SkipEntry
+{
+    uint32_t last_doc;
+    // Offset of the block from the end of the skip table
+    uint32_t offset;
+    // Largest term frequency in the block
+    uint32_t max_freq;
+    // Shortest field of the documents in the block
+    uint32_t min_length;
+};
+}
+
+/**
+ * @brief Iterates the postings of a term in one field of a segment in document order. Postings are stored in blocks of
+ * `block_size` as delta and varint encoded document IDs and frequencies. A block is only decoded when reached.
+ */
+class PostingIterator
+{
+public:
+    static constexpr uint32_t block_size = 128;
+
+    /**
+     * @brief An iterator without postings
+     */
+    PostingIterator() = default;
+    PostingIterator(const detail::SkipEntry* skips, uint32_t block_count, const uint8_t* blocks, uint32_t doc_freq);
+
+    bool valid() const
+    {
+        return block_ < block_count_;
+    }
+
+    uint32_t doc() const
+    {
+        return docs_[pos_];
+    }
+
+    uint32_t freq() const
+    {
+        return freqs_[pos_];
+    }
+
+    /**
+     * @brief Number of documents containing the term
+     */
+    uint32_t docFreq() const
+    {
+        return doc_freq_;
+    }
+
+    void next();
+
+    /**
+     * @brief Move to the first posting of a document >= target. Never moves backwards
+     */
+    void advance(uint32_t target);
+
+    /**
+     * @brief Skip table entry of the current block. Its largest frequency and shortest length bound the BM25 score
+     * of every posting in the block
+     */
+    const detail::SkipEntry& block() const
+    {
+        return skips_[block_];
+    }
+
+    /**
+     * @brief Skip table entries of all blocks
+     */
+    std::span<const detail::SkipEntry> blocks() const
+    {
+        return {skips_, block_count_};
+    }
+
+protected:
+    void loadBlock(uint32_t block);
+
+    const detail::SkipEntry* skips_ = nullptr;
+    const uint8_t* blocks_ = nullptr;
+    uint32_t block_count_ = 0;
+    uint32_t doc_freq_ = 0;
+    uint32_t block_ = 0;
+    uint32_t pos_ = 0;
+    uint32_t block_postings_ = 0;
+    std::array<uint32_t, block_size> docs_;
+    std::array<uint32_t, block_size> freqs_;
+};
+
+/**
+ * @brief An immutable, memory mapped part of the search index
+ */
+class Segment
+{
+public:
+    /**
+     * @brief Map a segment file. Throws std::runtime_error if it can't be read or is malformed
+     */
+    static std::shared_ptr<const Segment> open(const std::string& path);
+    ~Segment();
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    uint32_t docCount() const
+    {
+        return header_->doc_count;
+    }
+
+    size_t termCount() const
+    {
+        return header_->term_count;
+    }
+
+    std::string_view url(uint32_t doc) const;
+    uint32_t length(IndexField field, uint32_t doc) const;
+
+    /**
+     * @brief The i-th term in byte order
+     */
+    std::string_view term(size_t idx) const;
+
+    /**
+     * @brief Postings of a term. Empty if the term isn't in the segment
+     */
+    PostingIterator postings(IndexField field, std::string_view term) const;
+    PostingIterator postings(IndexField field, size_t term_idx) const;
+
+protected:
+    Segment() = default;
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    const detail::SegmentHeader* header_ = nullptr;
+    const detail::DocEntry* docs_ = nullptr;
+    const detail::TermEntry* terms_ = nullptr;
+    const char* strings_ = nullptr;
+};
+
+/**
+ * @brief Collects documents in memory and writes them as a segment
+ */
+class SegmentBuilder
+{
+public:
+    struct Document
+    {
+        std::string url;
+        // Number of words in each field
+        std::array<uint32_t, index_field_count> lengths{};
+        // (term, frequency) of each field
+        std::array<std::vector<std::pair<std::string, uint32_t>>, index_field_count> terms;
+    };
+
+    /**
+     * @brief Add a document. Returns its ID in the segment
+     */
+    uint32_t add(const Document& doc);
+
+    size_t docCount() const
+    {
+        return docs_.size();
+    }
+
+    /**
+     * @brief Write the segment. Throws std::runtime_error on failure
+     */
+    void write(const std::string& path) const;
+
+protected:
+    struct DocInfo
+    {
+        std::string url;
+        std::array<uint32_t, index_field_count> lengths;
+    };
+    std::vector<DocInfo> docs_;
+    std::map<std::string, std::array<std::vector<Posting>, index_field_count>, std::less<>> postings_;
+};
+
+/**
+ * @brief Which segments make up the index. Stored as `manifest` in the index directory
+ */
+struct IndexManifest
+{
+    // Oldest first
+    std::vector<std::string> segments;
+    // When the newest segment was built. In the DB's time. Pages indexed after that are not in the index
+    std::string built_at;
+    uint64_t next_segment = 0;
+
+    /**
+     * @brief Read the manifest of `dir`. An empty manifest if there is none
+     */
+    static IndexManifest load(const std::string& dir);
+    /**
+     * @brief Replace the manifest of `dir` atomically
+     */
+    void save(const std::string& dir) const;
+    /**
+     * @brief Reserve a file name for a new segment
+     */
+    std::string newSegmentName();
+};
+
+/**
+ * @brief An inverted index made of segments. A document in a newer segment replaces documents with the same URL in
+ * older segments. Immutable and safe to search from multiple threads.
+ */
+class SearchIndex
+{
+public:
+    struct Match
+    {
+        // Points into the mapped segment. Valid while the index is alive
+        std::string_view url;
+        float score;
+    };
+
+    /**
+     * @param segments oldest first
+     */
+    explicit SearchIndex(std::vector<std::shared_ptr<const Segment>> segments);
+
+    /**
+     * @brief Open the segments listed in the manifest of `dir`
+     */
+    static std::shared_ptr<const SearchIndex> open(const std::string& dir);
+
+    /**
+     * @brief Number of documents not replaced by newer segments
+     */
+    size_t docCount() const
+    {
+        return live_count_;
+    }
+
+    double averageLength(IndexField field) const
+    {
+        return average_length_[static_cast<size_t>(field)];
+    }
+
+    /**
+     * @brief Number of documents with the term in the body. Replaced documents are counted until merged away
+     */
+    uint64_t docFreq(std::string_view term) const;
+
+    /**
+     * @brief The `limit` best documents containing all terms. Scored with BM25 over the body plus title_weight times
+     * BM25 over the title. Best first. Blocks of postings that can't beat the current top `limit` are skipped without
+     * scoring. So smaller limits are faster
+     */
+    std::vector<Match> search(std::span<const std::string> terms, size_t limit, float title_weight = 1,
+        Bm25Params params = {}) const;
+
+    /**
+     * @brief Write all live documents as a single segment
+     */
+    void merge(const std::string& path) const;
+
+    const std::vector<std::shared_ptr<const Segment>>& segments() const
+    {
+        return segments_;
+    }
+
+protected:
+    bool live(size_t segment, uint32_t doc) const
+    {
+        return live_[segment][doc];
+    }
+
+    std::vector<std::shared_ptr<const Segment>> segments_;
+    std::vector<std::vector<bool>> live_;
+    size_t live_count_ = 0;
+    std::array<double, index_field_count> average_length_{};
+};
+
+}
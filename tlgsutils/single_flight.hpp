@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+
+namespace tlgs
+{
+
+/**
+ * @brief Coalesces concurrent calls with the same key. The first caller runs the work. Everyone else arriving
+ * while it's running waits for and shares its result (or exception) instead of doing the same work again.
+ * Thread safe.
+ *
+ * @begincode
+ *  static tlgs::SingleFlight<std::string, std::shared_ptr<Results>> flights;
+ *  auto results = co_await flights.run(query, [&]() -> Task<std::shared_ptr<Results>> { ... });
+ * @endcode
+ * @note Waiters are resumed on the event loop they were running on
+ */
+template <typename Key, typename T>
+class SingleFlight
+{
+    struct Waiter
+    {
+        std::coroutine_handle<> handle;
+        trantor::EventLoop* loop;
+    };
+
+    struct Flight
+    {
+        std::mutex mtx;
+        bool done = false;
+        std::optional<T> result;
+        std::exception_ptr exception;
+        std::vector<Waiter> waiters;
+    };
+
+    struct FlightAwaiter
+    {
+        // Not owning. The awaiting coroutine keeps the flight alive
+        Flight* flight;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard lock(flight->mtx);
+            if(flight->done)
+                return false;
+            flight->waiters.push_back({handle, trantor::EventLoop::getEventLoopOfCurrentThread()});
+            return true;
+        }
+
+        T await_resume()
+        {
+            if(flight->exception)
+                std::rethrow_exception(flight->exception);
+            return *flight->result;
+        }
+    };
+
+public:
+    /**
+     * @brief Run `func` unless a call with the same key is already running. Then wait for that one instead
+     */
+    drogon::Task<T> run(const Key& key, std::function<drogon::Task<T>()> func)
+    {
+        std::shared_ptr<Flight> flight;
+        bool leader = false;
+        {
+            std::lock_guard lock(mtx_);
+            auto& slot = flights_[key];
+            if(slot == nullptr) {
+                slot = std::make_shared<Flight>();
+                leader = true;
+            }
+            flight = slot;
+        }
+
+        if(!leader) {
+            joined_++;
+            co_return co_await FlightAwaiter{flight.get()};
+        }
+
+        try {
+            flight->result = co_await func();
+        }
+        catch(...) {
+            flight->exception = std::current_exception();
+        }
+        // Later callers start a new flight. The result is cached elsewhere if wanted
+        {
+            std::lock_guard lock(mtx_);
+            flights_.erase(key);
+        }
+        std::vector<Waiter> waiters;
+        {
+            std::lock_guard lock(flight->mtx);
+            flight->done = true;
+            waiters.swap(flight->waiters);
+        }
+        for(const auto& waiter : waiters) {
+            if(waiter.loop != nullptr)
+                waiter.loop->queueInLoop([handle = waiter.handle]() { handle.resume(); });
+            else
+                waiter.handle.resume();
+        }
+
+        if(flight->exception)
+            std::rethrow_exception(flight->exception);
+        co_return *flight->result;
+    }
+
+    /**
+     * @brief Number of keys currently running
+     */
+    size_t inFlight() const
+    {
+        std::lock_guard lock(mtx_);
+        return flights_.size();
+    }
+
+    /**
+     * @brief Number of calls that shared another call's result
+     */
+    size_t joined() const
+    {
+        return joined_;
+    }
+
+protected:
+    mutable std::mutex mtx_;
+    std::unordered_map<Key, std::shared_ptr<Flight>> flights_;
+    std::atomic<size_t> joined_ = 0;
+};
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tlgs
+{
+
+/**
+ * @brief Execute SQL with a number of parameters only known at runtime. Drogon binds parameters at compile time, so
+ * every count up to MaxParams is instantiated
+ *
+ * @param db anything with execSqlCoro(). A DbClientPtr or Transaction
+ * @throw std::invalid_argument more than MaxParams parameters
+ */
+template <size_t MaxParams, size_t N = 0, typename DbClient>
+auto execSqlWithParams(const DbClient& db, const std::string& sql, const std::vector<std::string>& params)
+{
+    auto exec = [&]<size_t... I>(std::index_sequence<I...>) {
+        return db->execSqlCoro(sql, params[I]...);
+    };
+    if constexpr(N == MaxParams) {
+        if(params.size() != N)
+            throw std::invalid_argument("Too many SQL parameters");
+        return exec(std::make_index_sequence<N>{});
+    }
+    else {
+        if(params.size() == N)
+            return exec(std::make_index_sequence<N>{});
+        return execSqlWithParams<MaxParams, N + 1>(db, sql, params);
+    }
+}
+
+}
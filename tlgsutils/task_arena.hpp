@@ -0,0 +1,88 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <tbb/task_arena.h>
+#include <trantor/net/EventLoop.h>
+
+namespace tlgs
+{
+
+/**
+ * @brief The task arena CPU heavy work is sent to. Sized to the number of cores
+ */
+inline tbb::task_arena& cpuArena()
+{
+    static tbb::task_arena arena;
+    return arena;
+}
+
+namespace detail
+{
+template <typename Func>
+struct ArenaAwaiter
+{
+    using Result = std::invoke_result_t<Func&>;
+    using Storage = std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>>;
+
+    tbb::task_arena& arena;
+    Func func;
+    Storage result{};
+    std::exception_ptr exception;
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        // Come back to the loop we left. Code after co_await expects to be there
+        auto loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+        arena.enqueue([this, handle, loop]() {
+            try {
+                if constexpr(std::is_void_v<Result>)
+                    func();
+                else
+                    result = func();
+            }
+            catch(...) {
+                exception = std::current_exception();
+            }
+            if(loop != nullptr)
+                loop->queueInLoop([handle]() { handle.resume(); });
+            else
+                handle.resume();
+        });
+    }
+
+    Result await_resume()
+    {
+        if(exception)
+            std::rethrow_exception(exception);
+        if constexpr(!std::is_void_v<Result>)
+            return std::move(*result);
+    }
+};
+}
+
+/**
+ * @brief Run a function on a TBB task arena and resume the awaiting coroutine on the event loop it was running on.
+ * Keeps CPU heavy work from stalling network IO.
+ *
+ * @begincode
+ *  auto nodes = co_await tlgs::runInArena([&]() { return dremini::parseGemini(body); });
+ * @endcode
+ * @note Exceptions thrown by the function are rethrown to the awaiting coroutine
+ */
+template <typename Func>
+auto runInArena(Func&& func, tbb::task_arena& arena = cpuArena())
+{
+    return detail::ArenaAwaiter<std::decay_t<Func>>{arena, std::forward<Func>(func)};
+}
+
+}
@@ -0,0 +1,88 @@
+#include <tlgsutils/bloom_filter.hpp>
+#include <drogon/drogon_test.h>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+DROGON_TEST(BloomFilterTest)
+{
+    tlgs::BloomFilter filter(1000, 0.01, 42);
+    CHECK(filter.seed() == 42);
+    CHECK(filter.hashCount() > 1);
+    CHECK(filter.mayContain("gemini://example.com/") == false);
+
+    for(int i=0;i<1000;i++)
+        filter.add("gemini://example.com/" + std::to_string(i));
+    // Never false negative
+    bool all_found = true;
+    for(int i=0;i<1000;i++)
+        all_found &= filter.mayContain("gemini://example.com/" + std::to_string(i));
+    CHECK(all_found);
+
+    // False positive rate is close to what we asked for
+    int false_positives = 0;
+    for(int i=0;i<10000;i++)
+        false_positives += filter.mayContain("gemini://example.org/" + std::to_string(i));
+    CHECK(false_positives < 300);
+
+    CHECK_THROWS(tlgs::BloomFilter(10, 0));
+    CHECK_THROWS(tlgs::BloomFilter(10, 1.5));
+}
+
+DROGON_TEST(BloomFilterPersistenceTest)
+{
+    auto path = (std::filesystem::temp_directory_path() / "tlgs_bloom_filter_test.bin").string();
+    tlgs::BloomFilter filter(100, 0.01, 1965);
+    filter.add("gemini://example.com/a");
+    filter.add("gemini://example.com/b");
+    filter.save(path);
+
+    auto loaded = tlgs::BloomFilter::load(path);
+    CHECK(loaded.seed() == filter.seed());
+    CHECK(loaded.bitCount() == filter.bitCount());
+    CHECK(loaded.hashCount() == filter.hashCount());
+    CHECK(loaded.createdAt() == filter.createdAt());
+    CHECK(loaded.mayContain("gemini://example.com/a"));
+    CHECK(loaded.mayContain("gemini://example.com/b"));
+    CHECK(loaded.mayContain("gemini://example.com/c") == filter.mayContain("gemini://example.com/c"));
+    std::filesystem::remove(path);
+
+    CHECK_THROWS(tlgs::BloomFilter::load(path));
+}
+
+DROGON_TEST(BloomFilterConcurrentSaveTest)
+{
+    // Writers saving at the same time each move a complete filter in place
+    auto dir = std::filesystem::temp_directory_path() / "tlgs_bloom_filter_save_test";
+    std::filesystem::create_directories(dir);
+    auto path = (dir / "filter.bin").string();
+    std::vector<tlgs::BloomFilter> filters;
+    for(uint64_t i=0;i<4;i++) {
+        filters.emplace_back(100000, 0.01, i);
+        for(int j=0;j<20000;j++)
+            filters.back().add(std::to_string(i) + "/" + std::to_string(j));
+    }
+    std::vector<std::thread> writers;
+    for(const auto& filter : filters) {
+        writers.emplace_back([&filter, &path]() {
+            for(int i=0;i<10;i++)
+                filter.save(path);
+        });
+    }
+    for(auto& writer : writers)
+        writer.join();
+
+    auto loaded = tlgs::BloomFilter::load(path);
+    REQUIRE(loaded.seed() < filters.size());
+    // All of one filter. Not pieces of several
+    bool all_found = true;
+    for(int j=0;j<20000;j++)
+        all_found &= loaded.mayContain(std::to_string(loaded.seed()) + "/" + std::to_string(j));
+    CHECK(all_found);
+    size_t files = 0;
+    for([[maybe_unused]] const auto& entry : std::filesystem::directory_iterator(dir))
+        files++;
+    CHECK(files == 1);
+    std::filesystem::remove_all(dir);
+}
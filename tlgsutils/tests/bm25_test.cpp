@@ -0,0 +1,85 @@
+#include <tlgsutils/bm25.hpp>
+#include <drogon/drogon_test.h>
+#include <cmath>
+#include <vector>
+
+static bool near(float a, float b)
+{
+    return std::abs(a - b) < 1e-4f;
+}
+
+DROGON_TEST(Bm25IdfTest)
+{
+    CHECK(near(tlgs::bm25Idf(10, 1), std::log(1 + 9.5f / 1.5f)));
+    // Rare terms are worth more
+    CHECK(tlgs::bm25Idf(1000, 1) > tlgs::bm25Idf(1000, 100));
+    // Never negative. Even with stale statistics
+    CHECK(tlgs::bm25Idf(10, 10) > 0);
+    CHECK(tlgs::bm25Idf(10, 20) > 0);
+    CHECK(tlgs::bm25Idf(0, 0) > 0);
+}
+
+DROGON_TEST(Bm25ScoreTest)
+{
+    const std::vector<float> idf = {2.0f, 1.0f};
+    tlgs::Bm25Scorer scorer(idf, 100);
+    REQUIRE(scorer.termCount() == 2);
+
+    // At average length the normalization is k1
+    CHECK(near(scorer.score(std::vector<uint32_t>{1, 0}, 100), 2.0f * 2.2f / (1 + 1.2f)));
+    CHECK(near(scorer.score(std::vector<uint32_t>{2, 0}, 100), 2.0f * 2.2f * 2 / (2 + 1.2f)));
+    CHECK(near(scorer.score(std::vector<uint32_t>{1, 1}, 100), 3.0f));
+    CHECK(scorer.score(std::vector<uint32_t>{0, 0}, 100) == 0);
+    // Longer documents score less for the same matches
+    CHECK(near(scorer.score(std::vector<uint32_t>{1, 0}, 200), 2.0f * 2.2f / (1 + 1.2f * (0.25f + 0.75f * 2))));
+    CHECK(scorer.score(std::vector<uint32_t>{1, 0}, 200) < scorer.score(std::vector<uint32_t>{1, 0}, 50));
+    // Saturates at IDF * (k1+1)
+    CHECK(scorer.score(std::vector<uint32_t>{100000, 0}, 100) < 2.0f * 2.2f);
+
+    CHECK_THROWS(scorer.score(std::vector<uint32_t>{1}, 100));
+}
+
+DROGON_TEST(Bm25BatchTest)
+{
+    const std::vector<float> idf = {1.5f, 0.5f, 3.0f};
+    tlgs::Bm25Scorer scorer(idf, 42, {.k1 = 1.5f, .b = 0.5f});
+    const std::vector<uint32_t> term_freqs = {1, 2, 3, 0, 0, 1, 7, 1, 0};
+    const std::vector<uint32_t> lengths = {10, 42, 300};
+    std::vector<float> scores(lengths.size());
+    scorer.scoreBatch(term_freqs, lengths, scores);
+    for(size_t i=0;i<lengths.size();i++) {
+        auto expected = scorer.score(std::span(term_freqs).subspan(i*3, 3), lengths[i]);
+        CHECK(near(scores[i], expected));
+    }
+
+    std::vector<float> too_small(1);
+    CHECK_THROWS(scorer.scoreBatch(term_freqs, lengths, too_small));
+}
+
+DROGON_TEST(Bm25MatchesTest)
+{
+    const std::vector<float> idf = {1.5f, 0.5f};
+    tlgs::Bm25Scorer title(idf, 5);
+    tlgs::Bm25Scorer body(idf, 100);
+    tlgs::Bm25Matches matches(idf.size());
+    matches.add("{1,0}", "{3,1}", 4, 120);
+    matches.add("{0,0}", "{0,2}", 6, 80);
+    // Missing values count as no match
+    matches.add("{}", "{0,1}", 3, 50);
+    matches.add("{0,0}", "{0,0}", 3, 50);
+    REQUIRE(matches.size() == 4);
+
+    auto scores = matches.score(title, body, 2.0f);
+    REQUIRE(scores.size() == 4);
+    CHECK(near(scores[0], body.score(std::vector<uint32_t>{3, 1}, 120) + 2 * title.score(std::vector<uint32_t>{1, 0}, 4)));
+    CHECK(near(scores[1], body.score(std::vector<uint32_t>{0, 2}, 80)));
+    CHECK(near(scores[2], body.score(std::vector<uint32_t>{0, 1}, 50)));
+    // Never zero
+    CHECK(scores[3] > 0);
+
+    auto top = tlgs::topScores(scores, 2);
+    REQUIRE(top.size() == 2);
+    CHECK(top[0] == 0);
+    CHECK(scores[top[1]] <= scores[top[0]]);
+    CHECK(tlgs::topScores(scores, 10).size() == 4);
+}
@@ -0,0 +1,23 @@
+#include <tlgsutils/bulk_insert.hpp>
+#include <drogon/drogon_test.h>
+
+DROGON_TEST(BulkInsertTest)
+{
+    tlgs::BulkInsert<3> insert("robot_policies", {"host text", "port integer", "disallowed text"});
+    CHECK(insert.empty());
+    CHECK(insert.sql() == "INSERT INTO robot_policies (host, port, disallowed) SELECT t.host, t.port, t.disallowed "
+        "FROM unnest($1::text[], $2::integer[], $3::text[]) AS t(host, port, disallowed)");
+
+    insert.add("example.com", 1965, "/cgi-bin");
+    insert.add(std::string("example.org"), 1966, "/");
+    CHECK(insert.size() == 2);
+    insert.clear();
+    CHECK(insert.empty());
+
+    tlgs::BulkInsert<2> pages("pages", {"url text", "port integer"});
+    pages.withConstant("first_seen_at", "CURRENT_TIMESTAMP").withSuffix("ON CONFLICT DO NOTHING");
+    CHECK(pages.sql() == "INSERT INTO pages (url, port, first_seen_at) SELECT t.url, t.port, CURRENT_TIMESTAMP "
+        "FROM unnest($1::text[], $2::integer[]) AS t(url, port) ON CONFLICT DO NOTHING");
+
+    CHECK_THROWS(tlgs::BulkInsert<1>("pages", {"url"}));
+}
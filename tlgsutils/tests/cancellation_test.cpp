@@ -0,0 +1,58 @@
+#include <tlgsutils/cancellation.hpp>
+#include <drogon/drogon_test.h>
+#include <thread>
+
+DROGON_TEST(CancellationTest)
+{
+    tlgs::CancellationToken token;
+    CHECK(token.cancelled() == false);
+
+    int called = 0;
+    int unregistered_called = 0;
+    auto registration = token.onCancel([&]() { called++; });
+    {
+        auto gone = token.onCancel([&]() { unregistered_called++; });
+    }
+    token.cancel();
+    CHECK(token.cancelled());
+    CHECK(called == 1);
+    CHECK(unregistered_called == 0);
+
+    // Only the first cancel runs callbacks
+    token.cancel();
+    CHECK(called == 1);
+
+    // Too late to wait for it. Runs right away
+    int late = 0;
+    auto late_registration = token.onCancel([&]() { late++; });
+    CHECK(late == 1);
+    registration.reset();
+    late_registration.reset();
+}
+
+DROGON_TEST(CancellationRegistrationTest)
+{
+    tlgs::CancellationToken token;
+    int first = 0;
+    int second = 0;
+    tlgs::CancellationToken::Registration second_registration;
+    // Callbacks may unregister others while being cancelled
+    auto first_registration = token.onCancel([&]() {
+        first++;
+        second_registration.reset();
+    });
+    second_registration = token.onCancel([&]() { second++; });
+    token.cancel();
+    CHECK(first == 1);
+    CHECK(second == 0);
+
+    // Cancelled from another thread
+    tlgs::CancellationToken other;
+    std::atomic<int> calls = 0;
+    auto registration = other.onCancel([&]() { calls++; });
+    std::thread thread([&]() { other.cancel(); });
+    thread.join();
+    registration.reset();
+    CHECK(other.cancelled());
+    CHECK(calls == 1);
+}
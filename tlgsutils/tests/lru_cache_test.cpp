@@ -0,0 +1,86 @@
+#include <tlgsutils/lru_cache.hpp>
+#include <drogon/drogon_test.h>
+
+#include <string>
+
+namespace
+{
+struct FakeClock
+{
+    using duration = std::chrono::steady_clock::duration;
+    using time_point = std::chrono::steady_clock::time_point;
+    static inline time_point current{};
+
+    static time_point now()
+    {
+        return current;
+    }
+};
+}
+
+DROGON_TEST(LruCacheTest)
+{
+    tlgs::LruCache<std::string, int> cache(2, std::chrono::hours(1));
+    CHECK(cache.get("a") == std::nullopt);
+
+    cache.insert("a", 1);
+    cache.insert("b", 2);
+    CHECK(cache.get("a") == 1);
+    // b is now the least recently used
+    cache.insert("c", 3);
+    CHECK(cache.get("b") == std::nullopt);
+    CHECK(cache.get("a") == 1);
+    CHECK(cache.get("c") == 3);
+    CHECK(cache.size() == 2);
+
+    // Replacing keeps the size
+    cache.insert("a", 10);
+    CHECK(cache.get("a") == 10);
+    CHECK(cache.size() == 2);
+
+    auto stats = cache.stats();
+    CHECK(stats.hits == 4);
+    CHECK(stats.misses == 2);
+    CHECK(stats.evictions == 1);
+    CHECK(stats.hitRate() == 4.0 / 6.0);
+
+    cache.erase("a");
+    CHECK(cache.get("a") == std::nullopt);
+    cache.clear();
+    CHECK(cache.size() == 0);
+}
+
+DROGON_TEST(LruCacheCostTest)
+{
+    tlgs::LruCache<int, std::string> cache(10, std::chrono::hours(1));
+    cache.insert(1, "a", 4);
+    cache.insert(2, "b", 4);
+    // Needs both to go
+    cache.insert(3, "c", 8);
+    CHECK(cache.get(1) == std::nullopt);
+    CHECK(cache.get(2) == std::nullopt);
+    CHECK(cache.get(3) == "c");
+    CHECK(cache.stats().cost == 8);
+
+    // Too large to ever fit. Also drops the old value of the key
+    cache.insert(3, "huge", 11);
+    CHECK(cache.get(3) == std::nullopt);
+    CHECK(cache.stats().cost == 0);
+}
+
+DROGON_TEST(LruCacheTtlTest)
+{
+    using namespace std::chrono_literals;
+    tlgs::LruCache<std::string, int, FakeClock> cache(10, 60s);
+    cache.insert("a", 1);
+    cache.insert("b", 2, 1, 300s);
+
+    FakeClock::current += 59s;
+    CHECK(cache.get("a") == 1);
+    FakeClock::current += 1s;
+    CHECK(cache.get("a") == std::nullopt);
+    CHECK(cache.size() == 1);
+    CHECK(cache.get("b") == 2);
+    FakeClock::current += 240s;
+    CHECK(cache.get("b") == std::nullopt);
+}
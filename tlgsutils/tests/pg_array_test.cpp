@@ -0,0 +1,62 @@
+#include <tlgsutils/pg_array.hpp>
+#include <drogon/drogon_test.h>
+
+DROGON_TEST(PgArrayBuilderTest)
+{
+    tlgs::PgArrayBuilder builder;
+    CHECK(builder.str() == "{}");
+    CHECK(builder.empty());
+
+    builder.append("gemini://example.com/");
+    builder.append("a\"b\\c");
+    builder.append("x,y");
+    CHECK(builder.size() == 3);
+    CHECK(builder.str() == R"({"gemini://example.com/","a\"b\\c","x,y"})");
+
+    tlgs::PgArrayBuilder numbers;
+    numbers.append(1965);
+    numbers.append(-1);
+    numbers.append(true);
+    numbers.append(std::optional<int>{});
+    CHECK(numbers.str() == "{1965,-1,t,NULL}");
+
+    tlgs::PgArrayBuilder reals;
+    reals.append(0.5);
+    reals.append(1.25f);
+    reals.append(-3.0);
+    CHECK(reals.str() == "{0.5,1.25,-3}");
+
+    numbers.clear();
+    CHECK(numbers.str() == "{}");
+
+    CHECK(tlgs::toPgArray({"a", "b"}) == R"({"a","b"})");
+}
+
+DROGON_TEST(PgArrayParseTest)
+{
+    CHECK(tlgs::parsePgArray("{}").empty());
+    CHECK(tlgs::parsePgArray(" { } ").empty());
+
+    auto arr = tlgs::parsePgArray("{gemini://example.com/,gemini://example.org/a.gmi}");
+    REQUIRE(arr.size() == 2);
+    CHECK(arr[0] == "gemini://example.com/");
+    CHECK(arr[1] == "gemini://example.org/a.gmi");
+
+    arr = tlgs::parsePgArray(R"({"a b","x,y","q\"uote","back\\slash",NULL,plain})");
+    REQUIRE(arr.size() == 5);
+    CHECK(arr[0] == "a b");
+    CHECK(arr[1] == "x,y");
+    CHECK(arr[2] == "q\"uote");
+    CHECK(arr[3] == "back\\slash");
+    CHECK(arr[4] == "plain");
+
+    // Round trip through the builder
+    std::vector<std::string> values = {"", "{}", "\"", "\\", "gemini://example.com/?a,b"};
+    CHECK(tlgs::parsePgArray(tlgs::toPgArray(values)) == values);
+
+    CHECK_THROWS(tlgs::parsePgArray(""));
+    CHECK_THROWS(tlgs::parsePgArray("[\"a\"]"));
+    CHECK_THROWS(tlgs::parsePgArray("{\"a}"));
+    CHECK_THROWS(tlgs::parsePgArray("{a,}"));
+    CHECK_THROWS(tlgs::parsePgArray("{{a},{b}}"));
+}
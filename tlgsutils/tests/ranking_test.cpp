@@ -0,0 +1,76 @@
+#include <tlgsutils/ranking.hpp>
+#include <drogon/drogon_test.h>
+#include <algorithm>
+#include <cmath>
+
+static const std::vector<std::pair<tlgs::NodeIndex, tlgs::NodeIndex>> test_edges = {
+    {0, 2}, {0, 3}, {1, 2}, {1, 3}, {1, 4}, {5, 2}, {2, 0}, {4, 3}
+};
+
+DROGON_TEST(CsrGraphTest)
+{
+    auto graph = tlgs::LinkGraph::fromEdges(6, test_edges);
+    REQUIRE(graph.nodeCount() == 6);
+    CHECK(graph.out.edgeCount() == test_edges.size());
+    CHECK(graph.in.edgeCount() == test_edges.size());
+
+    CHECK(graph.out.degree(1) == 3);
+    CHECK(graph.in.degree(2) == 3);
+    CHECK(graph.in.degree(5) == 0);
+
+    auto out = graph.out.neighboursOf(1);
+    const std::vector<tlgs::NodeIndex> expected_out = {2, 3, 4};
+    CHECK(std::equal(out.begin(), out.end(), expected_out.begin(), expected_out.end()));
+    auto in = graph.in.neighboursOf(3);
+    const std::vector<tlgs::NodeIndex> expected_in = {0, 1, 4};
+    CHECK(std::equal(in.begin(), in.end(), expected_in.begin(), expected_in.end()));
+
+    auto empty = tlgs::LinkGraph::fromEdges(0, {});
+    CHECK(empty.nodeCount() == 0);
+}
+
+DROGON_TEST(HitsRankTest)
+{
+    auto graph = tlgs::LinkGraph::fromEdges(6, test_edges);
+    tlgs::RankingWorkspace workspace;
+    auto score = tlgs::hitsRank(graph, workspace);
+    // Values produced by the original vector-of-vector implementation
+    const std::vector<double> expected = {0.000157925, 0.000325386, 0.407920188, 0.407920188, 0.183350901, 0.000325386};
+    REQUIRE(score.size() == expected.size());
+    for(size_t i=0;i<expected.size();i++)
+        CHECK(std::abs(score[i] - expected[i]) < 1e-6);
+
+    // Reusing the workspace must not change the result
+    auto again = tlgs::hitsRank(graph, workspace);
+    for(size_t i=0;i<expected.size();i++)
+        CHECK(std::abs(again[i] - expected[i]) < 1e-6);
+}
+
+DROGON_TEST(SalsaRankTest)
+{
+    auto graph = tlgs::LinkGraph::fromEdges(6, test_edges);
+    tlgs::RankingWorkspace workspace;
+    auto score = tlgs::salsaRank(graph, workspace);
+    // Values produced by the original vector-of-vector implementation
+    const std::vector<double> expected = {0.166666667, 0.166666669, 0.249999998, 0.250000003, 0.083333335, 0.083333335};
+    REQUIRE(score.size() == expected.size());
+    for(size_t i=0;i<expected.size();i++)
+        CHECK(std::abs(score[i] - expected[i]) < 1e-6);
+
+    auto empty = tlgs::LinkGraph::fromEdges(0, {});
+    CHECK(tlgs::salsaRank(empty, workspace).empty());
+}
+
+DROGON_TEST(CancelledRankTest)
+{
+    auto graph = tlgs::LinkGraph::fromEdges(6, test_edges);
+    tlgs::RankingWorkspace workspace;
+    tlgs::CancellationToken cancel;
+    cancel.cancel();
+    // No iteration runs. Every node keeps its initial score
+    auto hits = tlgs::hitsRank(graph, workspace, &cancel);
+    REQUIRE(hits.size() == 6);
+    CHECK(std::all_of(hits.begin(), hits.end(), [&](double score) { return score == hits[0]; }));
+    auto salsa = tlgs::salsaRank(graph, workspace, &cancel);
+    CHECK(salsa.size() == 6);
+}
@@ -0,0 +1,47 @@
+#include <tlgsutils/redirect_map.hpp>
+#include <drogon/drogon_test.h>
+
+DROGON_TEST(RedirectMapTest)
+{
+    tlgs::RedirectMap map;
+    CHECK(map.resolve("gemini://example.com/") == std::nullopt);
+
+    map.add("gemini://example.com/a", "gemini://example.com/b");
+    CHECK(map.resolve("gemini://example.com/a") == "gemini://example.com/b");
+    CHECK(map.resolve("gemini://example.com/b") == std::nullopt);
+
+    // Chains collapse to the final target. No matter the order they are learned
+    map.add("gemini://example.com/b", "gemini://example.com/c");
+    CHECK(map.resolve("gemini://example.com/a") == "gemini://example.com/c");
+    map.add("gemini://example.com/z", "gemini://example.com/a");
+    CHECK(map.resolve("gemini://example.com/z") == "gemini://example.com/c");
+    CHECK(map.size() == 3);
+
+    // Updating a redirect replaces the old target
+    map.add("gemini://example.com/c", "gemini://example.com/d");
+    CHECK(map.resolve("gemini://example.com/a") == "gemini://example.com/d");
+    CHECK(map.resolve("gemini://example.com/z") == "gemini://example.com/d");
+
+    // So does changing a link in the middle of a chain that was already looked up
+    map.add("gemini://example.com/b", "gemini://example.com/e");
+    CHECK(map.resolve("gemini://example.com/a") == "gemini://example.com/e");
+    CHECK(map.resolve("gemini://example.com/z") == "gemini://example.com/e");
+    CHECK(map.resolve("gemini://example.com/c") == "gemini://example.com/d");
+
+    map.clear();
+    CHECK(map.size() == 0);
+}
+
+DROGON_TEST(RedirectMapLoopTest)
+{
+    tlgs::RedirectMap map;
+    map.add("gemini://example.com/a", "gemini://example.com/b");
+    map.add("gemini://example.com/b", "gemini://example.com/a");
+    // Loops terminate and lead back to where we started. Resolving must not rewrite them
+    CHECK(map.resolve("gemini://example.com/a") == "gemini://example.com/a");
+    CHECK(map.resolve("gemini://example.com/b") == "gemini://example.com/b");
+    CHECK(map.resolve("gemini://example.com/a") == "gemini://example.com/a");
+
+    map.add("gemini://example.com/self", "gemini://example.com/self");
+    CHECK(map.resolve("gemini://example.com/self") == "gemini://example.com/self");
+}
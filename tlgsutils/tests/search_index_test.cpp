@@ -0,0 +1,183 @@
+#include <tlgsutils/search_index.hpp>
+#include <drogon/drogon_test.h>
+#include <filesystem>
+#include <string>
+
+namespace
+{
+struct TempDir
+{
+    std::filesystem::path path;
+    TempDir()
+        : path(std::filesystem::temp_directory_path() / ("tlgs_index_test_" + std::to_string(::getpid())))
+    {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    ~TempDir()
+    {
+        std::filesystem::remove_all(path);
+    }
+};
+
+tlgs::SegmentBuilder::Document makeDoc(std::string url, std::vector<std::pair<std::string, uint32_t>> title,
+    std::vector<std::pair<std::string, uint32_t>> body)
+{
+    tlgs::SegmentBuilder::Document doc;
+    doc.url = std::move(url);
+    for(const auto& [_, freq] : title)
+        doc.lengths[0] += freq;
+    for(const auto& [_, freq] : body)
+        doc.lengths[1] += freq;
+    doc.terms[0] = std::move(title);
+    doc.terms[1] = std::move(body);
+    return doc;
+}
+
+std::vector<std::string> urls(const std::vector<tlgs::SearchIndex::Match>& matches)
+{
+    std::vector<std::string> result;
+    for(const auto& match : matches)
+        result.emplace_back(match.url);
+    return result;
+}
+}
+
+DROGON_TEST(PostingIteratorTest)
+{
+    TempDir dir;
+    // Spans many blocks. Documents with even IDs contain "even", every third "three"
+    tlgs::SegmentBuilder builder;
+    for(uint32_t i=0;i<1000;i++) {
+        std::vector<std::pair<std::string, uint32_t>> body = {{"all", i + 1}};
+        if(i % 2 == 0)
+            body.emplace_back("even", 1);
+        if(i % 3 == 0)
+            body.emplace_back("three", 2);
+        builder.add(makeDoc("gemini://example.com/" + std::to_string(i), {}, body));
+    }
+    const auto path = (dir.path / "segment.idx").string();
+    builder.write(path);
+    auto segment = tlgs::Segment::open(path);
+    REQUIRE(segment->docCount() == 1000);
+    CHECK(segment->termCount() == 3);
+    CHECK(segment->url(42) == "gemini://example.com/42");
+
+    auto all = segment->postings(tlgs::IndexField::Body, "all");
+    CHECK(all.docFreq() == 1000);
+    uint32_t count = 0;
+    bool in_order = true;
+    for(;all.valid();all.next()) {
+        in_order &= all.doc() == count && all.freq() == count + 1;
+        count++;
+    }
+    CHECK(in_order);
+    CHECK(count == 1000);
+
+    auto three = segment->postings(tlgs::IndexField::Body, "three");
+    three.advance(500);
+    REQUIRE(three.valid());
+    CHECK(three.doc() == 501);
+    CHECK(three.freq() == 2);
+    // Never moves backwards
+    three.advance(10);
+    CHECK(three.doc() == 501);
+    three.advance(999);
+    REQUIRE(three.valid());
+    CHECK(three.doc() == 999);
+    three.advance(1000);
+    CHECK(three.valid() == false);
+
+    CHECK(segment->postings(tlgs::IndexField::Body, "missing").valid() == false);
+    CHECK(segment->postings(tlgs::IndexField::Title, "all").valid() == false);
+
+    CHECK_THROWS(tlgs::Segment::open((dir.path / "nothing.idx").string()));
+}
+
+DROGON_TEST(SearchIndexTest)
+{
+    TempDir dir;
+    tlgs::IndexManifest manifest;
+    tlgs::SegmentBuilder old_segment;
+    old_segment.add(makeDoc("gemini://a/", {{"gemini", 1}}, {{"gemini", 3}, {"capsul", 1}}));
+    old_segment.add(makeDoc("gemini://b/", {}, {{"gemini", 1}, {"linux", 2}, {"capsul", 1}}));
+    old_segment.add(makeDoc("gemini://c/", {}, {{"linux", 4}}));
+    auto name = manifest.newSegmentName();
+    old_segment.write((dir.path / name).string());
+    manifest.segments.push_back(name);
+
+    // Replaces b. Which no longer mentions capsules
+    tlgs::SegmentBuilder new_segment;
+    new_segment.add(makeDoc("gemini://b/", {}, {{"gemini", 1}, {"linux", 2}}));
+    new_segment.add(makeDoc("gemini://d/", {{"capsul", 1}}, {{"capsul", 1}, {"gemini", 1}}));
+    name = manifest.newSegmentName();
+    new_segment.write((dir.path / name).string());
+    manifest.segments.push_back(name);
+    manifest.built_at = "2026-10-19 12:00:00";
+    manifest.save(dir.path.string());
+
+    auto loaded = tlgs::IndexManifest::load(dir.path.string());
+    CHECK(loaded.segments == manifest.segments);
+    CHECK(loaded.built_at == manifest.built_at);
+    CHECK(loaded.next_segment == 2);
+
+    auto index = tlgs::SearchIndex::open(dir.path.string());
+    CHECK(index->docCount() == 4);
+    CHECK(index->docFreq("gemini") == 4);
+
+    auto matches = index->search(std::vector<std::string>{"gemini", "capsul"}, 10);
+    const std::vector<std::string> expected = {"gemini://d/", "gemini://a/"};
+    CHECK(urls(matches) == expected);
+    CHECK(matches[0].score >= matches[1].score);
+    CHECK(urls(index->search(std::vector<std::string>{"linux"}, 10)).size() == 2);
+    CHECK(urls(index->search(std::vector<std::string>{"linux"}, 1)) == std::vector<std::string>(1, "gemini://c/"));
+    CHECK(index->search(std::vector<std::string>{"gemini", "missing"}, 10).empty());
+
+    // Merging keeps what's searchable and drops replaced documents
+    const auto merged_name = manifest.newSegmentName();
+    index->merge((dir.path / merged_name).string());
+    auto merged = tlgs::SearchIndex(std::vector{tlgs::Segment::open((dir.path / merged_name).string())});
+    CHECK(merged.segments()[0]->docCount() == 4);
+    CHECK(merged.docFreq("gemini") == 3);
+    auto merged_matches = merged.search(std::vector<std::string>{"gemini", "capsul"}, 10);
+    CHECK(urls(merged_matches) == urls(matches));
+    CHECK(urls(merged.search(std::vector<std::string>{"linux"}, 10)) == urls(index->search(std::vector<std::string>{"linux"}, 10)));
+
+    CHECK_THROWS(tlgs::SearchIndex::open((dir.path / "empty").string()));
+}
+
+DROGON_TEST(SearchIndexTopKTest)
+{
+    TempDir dir;
+    // Varied frequencies and lengths so some blocks can be skipped and others can't
+    tlgs::SegmentBuilder builder;
+    uint32_t state = 12345;
+    auto random = [&state](uint32_t max) {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) % max;
+    };
+    for(uint32_t i=0;i<5000;i++) {
+        std::vector<std::pair<std::string, uint32_t>> title;
+        std::vector<std::pair<std::string, uint32_t>> body = {{"gemini", 1 + random(8)}, {"filler", 1 + random(200)}};
+        if(random(3) == 0)
+            body.emplace_back("capsul", 1 + random(4));
+        if(random(20) == 0)
+            title.emplace_back("gemini", 1);
+        builder.add(makeDoc("gemini://example.com/" + std::to_string(i), title, body));
+    }
+    const auto name = "segment.idx";
+    builder.write((dir.path / name).string());
+    tlgs::SearchIndex index(std::vector{tlgs::Segment::open((dir.path / name).string())});
+
+    // Skipping blocks must not change what the best results are
+    const std::vector<std::string> terms = {"gemini", "capsul"};
+    auto all = index.search(terms, 5000, 2);
+    auto top = index.search(terms, 10, 2);
+    REQUIRE(top.size() == 10);
+    REQUIRE(all.size() > 10);
+    bool same_scores = true;
+    for(size_t i=0;i<top.size();i++)
+        same_scores &= top[i].score == all[i].score;
+    CHECK(same_scores);
+    CHECK(index.search(std::vector<std::string>{"gemini"}, 1)[0].score == index.search(std::vector<std::string>{"gemini"}, 5000)[0].score);
+}
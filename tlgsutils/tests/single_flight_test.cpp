@@ -0,0 +1,88 @@
+#include <tlgsutils/single_flight.hpp>
+#include <drogon/drogon_test.h>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+// Suspends until opened. So several calls are in flight at the same time
+struct Gate
+{
+    std::vector<std::coroutine_handle<>> waiting;
+
+    auto wait()
+    {
+        struct Awaiter
+        {
+            Gate* gate;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { gate->waiting.push_back(handle); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{this};
+    }
+
+    void open()
+    {
+        auto handles = std::move(waiting);
+        for(auto handle : handles)
+            handle.resume();
+    }
+};
+}
+
+DROGON_TEST(SingleFlightTest)
+{
+    tlgs::SingleFlight<std::string, int> flights;
+    Gate gate;
+    int calls = 0;
+    std::vector<int> results;
+    auto work = [&]() -> drogon::Task<int> {
+        calls++;
+        co_await gate.wait();
+        co_return 42;
+    };
+    for(int i=0;i<4;i++) {
+        drogon::async_run([&]() -> drogon::Task<void> {
+            results.push_back(co_await flights.run("query", work));
+        });
+    }
+    CHECK(calls == 1);
+    CHECK(flights.inFlight() == 1);
+    CHECK(flights.joined() == 3);
+    gate.open();
+    CHECK(flights.inFlight() == 0);
+    REQUIRE(results.size() == 4);
+    for(auto result : results)
+        CHECK(result == 42);
+
+    // Once done, the next call runs again
+    drogon::async_run([&]() -> drogon::Task<void> {
+        results.push_back(co_await flights.run("query", work));
+    });
+    gate.open();
+    CHECK(calls == 2);
+}
+
+DROGON_TEST(SingleFlightExceptionTest)
+{
+    tlgs::SingleFlight<std::string, int> flights;
+    Gate gate;
+    int failures = 0;
+    auto work = [&]() -> drogon::Task<int> {
+        co_await gate.wait();
+        throw std::runtime_error("failed");
+    };
+    for(int i=0;i<3;i++) {
+        drogon::async_run([&]() -> drogon::Task<void> {
+            try {
+                co_await flights.run("query", work);
+            }
+            catch(const std::runtime_error&) {
+                failures++;
+            }
+        });
+    }
+    gate.open();
+    CHECK(failures == 3);
+}
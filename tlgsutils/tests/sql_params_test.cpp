@@ -0,0 +1,37 @@
+#include <tlgsutils/sql_params.hpp>
+#include <drogon/drogon_test.h>
+
+#include <memory>
+
+namespace
+{
+// Stands in for a DB client. Returns the parameters it was given
+struct ParamRecorder
+{
+    template <typename... Args>
+    std::vector<std::string> execSqlCoro(const std::string&, const Args&... args)
+    {
+        return {args...};
+    }
+};
+}
+
+DROGON_TEST(ExecSqlWithParamsTest)
+{
+    auto db = std::make_shared<ParamRecorder>();
+    CHECK(tlgs::execSqlWithParams<4>(db, "", {}).empty());
+
+    std::vector<std::string> params = {"a", "b", "c", "d"};
+    CHECK(tlgs::execSqlWithParams<4>(db, "", params) == params);
+    params.pop_back();
+    CHECK(tlgs::execSqlWithParams<4>(db, "", params) == params);
+
+    params = {"a", "b", "c", "d", "e"};
+    CHECK_THROWS(tlgs::execSqlWithParams<4>(db, "", params));
+
+    // The most the search backends bind. The query and term array plus 15 filter constraints
+    params.clear();
+    for(size_t i=0;i<17;i++)
+        params.push_back(std::to_string(i));
+    CHECK(tlgs::execSqlWithParams<17>(db, "", params) == params);
+}
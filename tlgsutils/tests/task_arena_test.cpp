@@ -0,0 +1,27 @@
+#include <tlgsutils/task_arena.hpp>
+#include <drogon/drogon_test.h>
+#include <drogon/utils/coroutine.h>
+#include <stdexcept>
+#include <thread>
+
+DROGON_TEST(TaskArenaTest)
+{
+    auto caller = std::this_thread::get_id();
+    auto [value, worker] = drogon::sync_wait([]() -> drogon::Task<std::pair<int, std::thread::id>> {
+        co_return co_await tlgs::runInArena([]() {
+            return std::make_pair(42, std::this_thread::get_id());
+        });
+    }());
+    CHECK(value == 42);
+    CHECK(worker != caller);
+
+    int counter = 0;
+    drogon::sync_wait([&]() -> drogon::Task<void> {
+        co_await tlgs::runInArena([&]() { counter++; });
+    }());
+    CHECK(counter == 1);
+
+    CHECK_THROWS(drogon::sync_wait([]() -> drogon::Task<int> {
+        co_return co_await tlgs::runInArena([]() -> int { throw std::runtime_error("error"); });
+    }()));
+}
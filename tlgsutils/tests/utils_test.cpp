@@ -147,3 +147,23 @@ DROGON_TEST(XXHashTest)
 {
   CHECK(tlgs::xxHash64("Hello, World!") == "C49AACF8080FE47F");
 }
+
+DROGON_TEST(XXHash128Test)
+{
+  CHECK(tlgs::xxHash128("Hello, World!") == "531DF2844447DD5077DB03842CD75395");
+  CHECK(tlgs::xxHash128("") == "99AA06D3014798D86001C324468D497F");
+  CHECK(tlgs::xxHash128("a b") != tlgs::xxHash128("b a"));
+}
+
+DROGON_TEST(ValidUtf8Test)
+{
+  CHECK(tlgs::isValidUtf8("") == true);
+  CHECK(tlgs::isValidUtf8("Hello, World!") == true);
+  CHECK(tlgs::isValidUtf8("中文 日本語 한국어 🚀") == true);
+  CHECK(tlgs::isValidUtf8("\xC3\x28") == false); // bad continuation
+  CHECK(tlgs::isValidUtf8("\xE4\xB8") == false); // truncated
+  CHECK(tlgs::isValidUtf8("\xC0\xAF") == false); // overlong
+  CHECK(tlgs::isValidUtf8("\xED\xA0\x80") == false); // surrogate
+  CHECK(tlgs::isValidUtf8("\xF4\x90\x80\x80") == false); // above U+10FFFF
+  CHECK(tlgs::isValidUtf8("\xFF") == false);
+}
@@ -0,0 +1,65 @@
+#include <tlgsutils/when_all.hpp>
+#include <drogon/drogon_test.h>
+#include <trantor/net/EventLoopThread.h>
+#include <future>
+#include <stdexcept>
+
+static drogon::Task<int> square(int n)
+{
+    co_return n * n;
+}
+
+static drogon::Task<int> failAt(int n, int bad)
+{
+    if(n == bad)
+        throw std::runtime_error("bad");
+    co_return n;
+}
+
+static drogon::Task<int> onLoop(trantor::EventLoop* loop, int n)
+{
+    co_await drogon::switchThreadCoro(loop);
+    co_return n;
+}
+
+DROGON_TEST(WhenAllTest)
+{
+    std::vector<drogon::Task<int>> tasks;
+    for(int i=0;i<10;i++)
+        tasks.push_back(square(i));
+    auto result = drogon::sync_wait(tlgs::whenAll(std::move(tasks), 3));
+    REQUIRE(result.size() == 10);
+    for(int i=0;i<10;i++)
+        CHECK(result[i] == i * i);
+
+    auto empty = drogon::sync_wait(tlgs::whenAll(std::vector<drogon::Task<int>>{}, 3));
+    CHECK(empty.empty());
+
+    std::vector<drogon::Task<int>> failing;
+    for(int i=0;i<5;i++)
+        failing.push_back(failAt(i, 2));
+    CHECK_THROWS(drogon::sync_wait(tlgs::whenAll(std::move(failing), 2)));
+}
+
+DROGON_TEST(WhenAllResumeLoopTest)
+{
+    // Tasks finish on another loop. The caller must still come back to its own
+    trantor::EventLoopThread caller_thread;
+    trantor::EventLoopThread worker_thread;
+    caller_thread.run();
+    worker_thread.run();
+    auto caller = caller_thread.getLoop();
+    auto worker = worker_thread.getLoop();
+
+    std::promise<bool> resumed_on_caller;
+    caller->queueInLoop([&]() {
+        drogon::async_run([&]() -> drogon::Task<void> {
+            std::vector<drogon::Task<int>> tasks;
+            for(int i=0;i<4;i++)
+                tasks.push_back(onLoop(worker, i));
+            auto result = co_await tlgs::whenAll(std::move(tasks), 2);
+            resumed_on_caller.set_value(caller->isInLoopThread() && result.size() == 4);
+        });
+    });
+    CHECK(resumed_on_caller.get_future().get());
+}
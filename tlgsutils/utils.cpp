@@ -124,6 +124,60 @@ std::string tlgs::xxHash64(const std::string_view str)
     return drogon::utils::binaryStringToHex((unsigned char*)&hash, sizeof(hash));
 }
 
+std::string tlgs::xxHash128(const std::string_view str)
+{
+    auto hash = XXH3_128bits(str.data(), str.size());
+    XXH128_canonical_t canonical;
+    XXH128_canonicalFromHash(&canonical, hash);
+    return drogon::utils::binaryStringToHex(canonical.digest, sizeof(canonical.digest));
+}
+
+bool tlgs::isValidUtf8(const std::string_view str)
+{
+    const auto* data = reinterpret_cast<const unsigned char*>(str.data());
+    const size_t size = str.size();
+    size_t i = 0;
+    while(i < size) {
+        // Fast path for ASCII. Which is most of what we see
+        if(data[i] < 0x80) {
+            i++;
+            continue;
+        }
+
+        size_t len;
+        unsigned char min_second = 0x80, max_second = 0xBF;
+        if(data[i] >= 0xC2 && data[i] <= 0xDF)
+            len = 2;
+        else if(data[i] >= 0xE0 && data[i] <= 0xEF) {
+            len = 3;
+            if(data[i] == 0xE0)
+                min_second = 0xA0; // overlong
+            else if(data[i] == 0xED)
+                max_second = 0x9F; // surrogates
+        }
+        else if(data[i] >= 0xF0 && data[i] <= 0xF4) {
+            len = 4;
+            if(data[i] == 0xF0)
+                min_second = 0x90; // overlong
+            else if(data[i] == 0xF4)
+                max_second = 0x8F; // above U+10FFFF
+        }
+        else
+            return false;
+
+        if(i + len > size)
+            return false;
+        if(data[i+1] < min_second || data[i+1] > max_second)
+            return false;
+        for(size_t j=2;j<len;j++) {
+            if((data[i+j] & 0xC0) != 0x80)
+                return false;
+        }
+        i += len;
+    }
+    return true;
+}
+
 std::optional<unsigned long long> tlgs::try_strtoull(const std::string& str)
 {
     char* endptr;
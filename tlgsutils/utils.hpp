@@ -49,6 +49,21 @@ bool isNonUriAction(const std::string& sv);
  */
 std::string xxHash64(const std::string_view str);
 
+/**
+ * @brief Computes the 128 bit XXH3 hash of a string. For when collisions must be practically impossible.
+ * ex: cache keys
+ *
+ * @param str the string
+ * @return std::string hex encoded hash. In the canonical (big endian) byte order
+ */
+std::string xxHash128(const std::string_view str);
+
+/**
+ * @brief Check if a string is well formed UTF-8. Overlong encodings, surrogates and code points above U+10FFFF
+ * are rejected
+ */
+bool isValidUtf8(const std::string_view str);
+
 template <typename T, typename Func>
     requires std::is_invocable_v<Func, typename T::value_type>
 auto filter(const T& data, Func&& func)
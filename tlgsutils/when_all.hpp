@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+
+namespace tlgs
+{
+
+namespace detail
+{
+struct WhenAllState
+{
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> remaining = 0;
+    std::coroutine_handle<> waiter;
+    // Where the waiter is resumed. Not whichever loop the last task finished on
+    trantor::EventLoop* loop = nullptr;
+    std::exception_ptr exception;
+    std::mutex mtx;
+
+    void done()
+    {
+        if(remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        if(loop != nullptr)
+            loop->queueInLoop([handle = waiter]() { handle.resume(); });
+        else
+            waiter.resume();
+    }
+};
+
+struct WhenAllAwaiter
+{
+    // Not owning. The awaiting coroutine keeps the state alive
+    WhenAllState* state;
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+        state->waiter = handle;
+        state->loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+        // The awaiter holds one count itself. So workers can't resume us before we are suspended. Don't
+        // suspend at all if everything finished in the mean time
+        return state->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void await_resume() const noexcept {}
+};
+}
+
+/**
+ * @brief Run tasks concurrently and wait for all of them. At most max_concurrency tasks are in flight at the
+ * same time. Results are in the same order as the tasks.
+ *
+ * @note If any task throws, the first exception is rethrown after all tasks finished.
+ * @note The caller is resumed on the event loop it was running on
+ */
+template <typename T>
+drogon::Task<std::vector<T>> whenAll(std::vector<drogon::Task<T>> tasks, size_t max_concurrency)
+{
+    const size_t workers = std::min(std::max(max_concurrency, size_t{1}), tasks.size());
+    if(workers == 0)
+        co_return {};
+
+    std::vector<std::optional<T>> results(tasks.size());
+    auto state = std::make_shared<detail::WhenAllState>();
+    state->remaining = workers + 1;
+    for(size_t i=0;i<workers;i++) {
+        // Each worker keeps pulling tasks until there is none left
+        drogon::async_run([state, &tasks, &results]() -> drogon::Task<void> {
+            size_t idx;
+            while((idx = state->next.fetch_add(1, std::memory_order_acq_rel)) < tasks.size()) {
+                try {
+                    results[idx] = co_await std::move(tasks[idx]);
+                }
+                catch(...) {
+                    std::lock_guard lock(state->mtx);
+                    if(!state->exception)
+                        state->exception = std::current_exception();
+                }
+            }
+            state->done();
+        });
+    }
+    co_await detail::WhenAllAwaiter{state.get()};
+
+    if(state->exception)
+        std::rethrow_exception(state->exception);
+    std::vector<T> ret;
+    ret.reserve(results.size());
+    for(auto& result : results)
+        ret.emplace_back(std::move(result.value()));
+    co_return ret;
+}
+
+}